@@ -0,0 +1,175 @@
+/* arena.c
+ * 18 Oct 2026
+ *
+ * Allocates memory that is all released at once.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file arena.c
+ *
+ * Everything a test allocates (its job, its strings, the buffers used
+ * to scan its results) comes from an arena.  When the test is finished
+ * the whole arena is reset with one call and handed to the next test,
+ * so after the first few tests a run doesn't call malloc at all and
+ * no big buffers are left on the stack.
+ *
+ * An arena is a list of chunks.  Allocations are carved off the front
+ * of the newest chunk.  A request too big for a standard chunk gets a
+ * chunk of its own that goes behind the newest one so the space left
+ * in the newest chunk isn't wasted.  Resetting frees every chunk but
+ * the first one allocated.
+ *
+ * Like malloc, these functions return NULL when out of memory.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;                ///< bytes available in data
+    // align data for any type
+    union { long double ld; void *p; intmax_t i; } data[];
+};
+
+
+#define ALIGNMENT sizeof(((struct arena_chunk*)0)->data[0])
+#define align(n) (((n) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+
+void arena_init(struct arena *a)
+{
+    memset(a, 0, sizeof(*a));
+}
+
+
+static struct arena_chunk* new_chunk(size_t size)
+{
+    struct arena_chunk *chunk;
+
+    chunk = malloc(sizeof(struct arena_chunk) + size);
+    if(chunk) {
+        chunk->next = NULL;
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+
+/** Returns size bytes, aligned for any type, that remain valid until
+ *  the arena is reset or freed.
+ */
+
+void* arena_alloc(struct arena *a, size_t size)
+{
+    struct arena_chunk *chunk;
+    char *ret;
+
+    size = align(size ? size : 1);
+
+    if(!a->chunks) {
+        // the first chunk is the one that's kept so make it a standard one.
+        chunk = new_chunk(ARENA_CHUNK_SIZE);
+        if(!chunk) {
+            return NULL;
+        }
+        a->chunks = chunk;
+        a->next = (char*)chunk->data;
+        a->end = a->next + chunk->size;
+    }
+
+    if(size <= (size_t)(a->end - a->next)) {
+        ret = a->next;
+        a->next += size;
+        return ret;
+    }
+
+    if(size > ARENA_CHUNK_SIZE/4) {
+        // give it a chunk of its own
+        chunk = new_chunk(size);
+        if(!chunk) {
+            return NULL;
+        }
+        chunk->next = a->chunks->next;
+        a->chunks->next = chunk;
+        return chunk->data;
+    }
+
+    chunk = new_chunk(ARENA_CHUNK_SIZE);
+    if(!chunk) {
+        return NULL;
+    }
+    chunk->next = a->chunks;
+    a->chunks = chunk;
+    a->next = (char*)chunk->data + size;
+    a->end = (char*)chunk->data + chunk->size;
+    return chunk->data;
+}
+
+
+void* arena_calloc(struct arena *a, size_t size)
+{
+    void *ret = arena_alloc(a, size);
+    if(ret) {
+        memset(ret, 0, size);
+    }
+    return ret;
+}
+
+
+char* arena_strndup(struct arena *a, const char *s, size_t len)
+{
+    char *ret = arena_alloc(a, len + 1);
+    if(ret) {
+        memcpy(ret, s, len);
+        ret[len] = '\0';
+    }
+    return ret;
+}
+
+
+char* arena_strdup(struct arena *a, const char *s)
+{
+    return arena_strndup(a, s, strlen(s));
+}
+
+
+/** Releases everything allocated from the arena.  The first chunk is
+ *  kept so the arena can be reused without calling malloc again.
+ */
+
+void arena_reset(struct arena *a)
+{
+    struct arena_chunk *chunk;
+
+    if(!a->chunks) {
+        return;
+    }
+
+    while(a->chunks->next) {
+        chunk = a->chunks;
+        a->chunks = chunk->next;
+        free(chunk);
+    }
+
+    a->next = (char*)a->chunks->data;
+    a->end = a->next + a->chunks->size;
+}
+
+
+void arena_free(struct arena *a)
+{
+    struct arena_chunk *chunk;
+
+    while(a->chunks) {
+        chunk = a->chunks;
+        a->chunks = chunk->next;
+        free(chunk);
+    }
+    a->next = a->end = NULL;
+}
@@ -0,0 +1,31 @@
+/* arena.h
+ * 18 Oct 2026
+ *
+ * Allocates memory that is all released at once.  See arena.c.
+ * This file is covered by the MIT License.
+ */
+
+#include <stddef.h>
+
+
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunks; ///< newest first, the last one is never freed by arena_reset()
+    char *next;                 ///< the next free byte in chunks
+    char *end;                  ///< one past the last byte in chunks
+    struct arena *next_free;    ///< for callers that keep a list of unused arenas
+};
+
+
+// large enough for a test and its scan buffers without a second chunk
+#define ARENA_CHUNK_SIZE 65536
+
+
+void arena_init(struct arena *a);
+void* arena_alloc(struct arena *a, size_t size);
+void* arena_calloc(struct arena *a, size_t size);
+char* arena_strdup(struct arena *a, const char *s);
+char* arena_strndup(struct arena *a, const char *s, size_t len);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
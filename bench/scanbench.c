@@ -0,0 +1,409 @@
+/* scanbench.c
+ * 18 Oct 2026
+ *
+ * Microbenchmarks for the testfile and status scanners, the comparison
+ * engine, and the readers that feed them.  Run "make bench".
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file scanbench.c
+ *
+ * Every benchmark chews through BENCH_BYTES of synthetic data and
+ * reports the best of BENCH_TRIES runs so that scheduling noise
+ * doesn't penalize a change.  Throughput is in MB/s of input.  Where
+ * it makes sense, the cost per token (or per refill, or per call) is
+ * printed too.
+ *
+ * Files are written to a tempfile so the fd and fp readers measure
+ * the page cache, not the disk.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "re2c/read-fd.h"
+#include "re2c/read-fp.h"
+#include "re2c/read-mem.h"
+#include "re2c/read-rand.h"
+
+#include "tfscan.h"
+#include "stscan.h"
+#include "compare.h"
+
+
+#define BENCH_BYTES (32*1024*1024)
+#define BENCH_TRIES 3
+
+
+struct data {
+    char *ptr;      ///< the data, NUL terminated so scanners may peek past the end
+    size_t len;
+    int fd;         ///< an unlinked tempfile holding the same data
+};
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void report(const char *name, double secs, size_t bytes,
+        long count, const char *unit)
+{
+    printf("%-44s %9.1f MB/s", name, bytes / secs / (1024.0*1024.0));
+    if(count) {
+        printf(" %9.1f ns/%s", secs * 1000000000.0 / count, unit);
+    }
+    printf("\n");
+}
+
+
+static void die(const char *msg)
+{
+    fprintf(stderr, "%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+
+/** Fills data with copies of the pattern until it holds at least
+ *  BENCH_BYTES, then writes it all to a tempfile.
+ */
+
+static void make_data(struct data *data, const char *head, const char *pattern)
+{
+    char name[] = "/tmp/scanbench-XXXXXX";
+    size_t hlen = strlen(head);
+    size_t plen = strlen(pattern);
+    size_t off, cnt;
+    ssize_t n;
+
+    data->len = hlen + (BENCH_BYTES + plen - 1) / plen * plen;
+    data->ptr = malloc(data->len + 1);
+    if(!data->ptr) die("malloc");
+
+    memcpy(data->ptr, head, hlen);
+    for(off=hlen; off < data->len; off += plen) {
+        memcpy(data->ptr + off, pattern, plen);
+    }
+    data->ptr[data->len] = '\0';
+
+    data->fd = mkstemp(name);
+    if(data->fd < 0) die("mkstemp");
+    unlink(name);
+    for(off=0; off < data->len; off += n) {
+        cnt = data->len - off;
+        n = write(data->fd, data->ptr + off, cnt);
+        if(n <= 0) die("write");
+    }
+}
+
+
+static void free_data(struct data *data)
+{
+    close(data->fd);
+    free(data->ptr);
+}
+
+
+static void rewind_data(struct data *data)
+{
+    if(lseek(data->fd, 0, SEEK_SET) < 0) die("lseek");
+}
+
+
+/** Attaches ss to the data, either directly to the memory or to the
+ *  tempfile through the given buffer.
+ */
+
+static void attach(scanstate *ss, struct data *data, char *buf, size_t bufsiz)
+{
+    if(buf) {
+        rewind_data(data);
+        scanstate_init(ss, buf, bufsiz);
+        readfd_attach(ss, data->fd);
+    } else {
+        readmem_init(ss, data->ptr, data->len);
+    }
+}
+
+
+static long scan_all(scanstate *ss)
+{
+    long tokens = 0;
+    int tok;
+
+    do {
+        tok = scan_next_token(ss);
+        if(tok < 0) {
+            fprintf(stderr, "scanner returned error %d\n", tok);
+            exit(1);
+        }
+        if(tok == 0) {
+            break;
+        }
+        tokens += 1;
+    } while(!scan_is_finished(ss));
+
+    return tokens;
+}
+
+
+static void bench_scanner(const char *name, struct data *data,
+        scanstate* (*attachproc)(scanstate*), size_t bufsiz)
+{
+    char *buf = NULL;
+    scanstate ss;
+    double start, best = 0;
+    long tokens = 0;
+    int i;
+
+    if(bufsiz) {
+        buf = malloc(bufsiz);
+        if(!buf) die("malloc");
+    }
+
+    for(i=0; i<BENCH_TRIES; i++) {
+        attach(&ss, data, buf, bufsiz);
+        (*attachproc)(&ss);
+        start = now();
+        tokens = scan_all(&ss);
+        start = now() - start;
+        if(!i || start < best) best = start;
+    }
+
+    report(name, best, data->len, tokens, "token");
+    free(buf);
+}
+
+
+static void bench_tfscan()
+{
+    struct data data;
+
+    // one short section after another
+    make_data(&data, "echo hi\n",
+            "STDOUT:\nhi\nSTDERR:\nho\nSTDOUT -n:\nhe\n");
+    bench_scanner("tfscan section-heavy, memory", &data, tfscan_attach, 0);
+    bench_scanner("tfscan section-heavy, fd 8K", &data, tfscan_attach, BUFSIZ);
+    free_data(&data);
+
+    // one giant section full of ordinary lines
+    make_data(&data, "echo hi\nSTDOUT:\n",
+            "the quick brown fox jumps over the lazy dog, STDOUT is here\n");
+    bench_scanner("tfscan data-heavy, memory", &data, tfscan_attach, 0);
+    bench_scanner("tfscan data-heavy, fd 8K", &data, tfscan_attach, BUFSIZ);
+    bench_scanner("tfscan data-heavy, fd 64K", &data, tfscan_attach, 65536);
+    free_data(&data);
+}
+
+
+static void bench_stscan()
+{
+    struct data data;
+
+    make_data(&data, "", "START\nCONFIG: /home/user/src/project/tmtest.conf\n"
+            "PREPARE\nRUNNING\nDONE\n");
+    bench_scanner("stscan status lines, memory", &data, stscan_attach, 0);
+    bench_scanner("stscan status lines, fd 8K", &data, stscan_attach, BUFSIZ);
+    free_data(&data);
+}
+
+
+static void bench_compare_size(struct data *data, size_t chunk, int use_fd)
+{
+    char name[64];
+    char buf[BUFSIZ];
+    scanstate ss;
+    double start, best = 0;
+    size_t off, n;
+    long calls = 0;
+    int i;
+
+    for(i=0; i<BENCH_TRIES; i++) {
+        attach(&ss, data, use_fd ? buf : NULL, sizeof(buf));
+        compare_attach(&ss);
+        calls = 0;
+        start = now();
+        for(off=0; off < data->len; off += n) {
+            n = data->len - off < chunk ? data->len - off : chunk;
+            if(compare_continue(&ss, data->ptr + off, n) != 0) {
+                fprintf(stderr, "compare failed at offset %ld\n", (long)off);
+                exit(1);
+            }
+            calls += 1;
+        }
+        if(compare_check_newlines(&ss) != cmp_full_match) {
+            fprintf(stderr, "compare_check_newlines didn't match\n");
+            exit(1);
+        }
+        start = now() - start;
+        if(!i || start < best) best = start;
+    }
+
+    snprintf(name, sizeof(name), "compare %s, %ld byte chunks",
+            (use_fd ? "fd 8K" : "memory"), (long)chunk);
+    report(name, best, data->len, calls, "call");
+}
+
+
+static void bench_compare()
+{
+    static const size_t sizes[] = { 16, 256, 4096, 65536 };
+    struct data data;
+    int i;
+
+    make_data(&data, "", "the quick brown fox jumps over the lazy dog\n");
+    for(i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+        bench_compare_size(&data, sizes[i], 0);
+    }
+    for(i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+        bench_compare_size(&data, sizes[i], 1);
+    }
+    free_data(&data);
+}
+
+
+/** Measures read_shiftbuf() by leaving a partial token of the given
+ *  size at the end of the buffer before every refill, just like a
+ *  scanner that hits the end of the buffer in the middle of a line.
+ */
+
+static void bench_shift(size_t partial)
+{
+    char name[64];
+    char buf[BUFSIZ];
+    scanstate ss;
+    double start, best = 0;
+    size_t total = 0;
+    long refills = 0;
+    ssize_t n;
+    int i;
+
+    for(i=0; i<BENCH_TRIES; i++) {
+        scanstate_init(&ss, buf, sizeof(buf));
+        readrand_attach(&ss, 1);
+        total = 0;
+        refills = 0;
+        start = now();
+        while(total < BENCH_BYTES) {
+            ss.cursor = ss.limit;
+            ss.token = (ss.limit - ss.bufptr >= partial ? ss.limit - partial : ss.bufptr);
+            n = (*ss.read)(&ss);
+            if(n <= 0) {
+                fprintf(stderr, "readrand returned %ld\n", (long)n);
+                exit(1);
+            }
+            total += n;
+            refills += 1;
+        }
+        start = now() - start;
+        if(!i || start < best) best = start;
+    }
+
+    snprintf(name, sizeof(name), "read_shiftbuf, %ld byte partial token", (long)partial);
+    report(name, best, total, refills, "refill");
+}
+
+
+/** Consumes everything the reader supplies without scanning it.
+ */
+
+static size_t drain(scanstate *ss)
+{
+    size_t total = 0;
+
+    for(;;) {
+        total += ss->limit - ss->cursor;
+        ss->cursor = ss->token = ss->limit;
+        if(total >= BENCH_BYTES) {
+            break;
+        }
+        if((*ss->read)(ss) <= 0) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static void bench_readers()
+{
+    struct data data;
+    char buf[BUFSIZ];
+    scanstate ss;
+    double start, best;
+    size_t total = 0;
+    FILE *fp;
+    int i;
+
+    make_data(&data, "", "the quick brown fox jumps over the lazy dog\n");
+
+    best = 0;
+    for(i=0; i<BENCH_TRIES; i++) {
+        attach(&ss, &data, buf, sizeof(buf));
+        start = now();
+        total = drain(&ss);
+        start = now() - start;
+        if(!i || start < best) best = start;
+    }
+    report("read-fd, 8K buffer", best, total, 0, NULL);
+
+    best = 0;
+    for(i=0; i<BENCH_TRIES; i++) {
+        rewind_data(&data);
+        fp = fdopen(dup(data.fd), "r");
+        if(!fp) die("fdopen");
+        scanstate_init(&ss, buf, sizeof(buf));
+        readfp_attach(&ss, fp);
+        start = now();
+        total = drain(&ss);
+        start = now() - start;
+        fclose(fp);
+        if(!i || start < best) best = start;
+    }
+    report("read-fp, 8K buffer", best, total, 0, NULL);
+
+    // read-mem hands the scanner the whole buffer without copying so
+    // there's nothing to time.  Make sure that's still true.
+    attach(&ss, &data, NULL, 0);
+    total = drain(&ss);
+    printf("%-44s %s\n", "read-mem", (total == data.len ?
+                "zero copy" : "SHORT READ"));
+
+    best = 0;
+    for(i=0; i<BENCH_TRIES; i++) {
+        scanstate_init(&ss, buf, sizeof(buf));
+        readrand_attach(&ss, 1);
+        start = now();
+        total = drain(&ss);
+        start = now() - start;
+        if(!i || start < best) best = start;
+    }
+    report("read-rand (synthetic source), 8K buffer", best, total, 0, NULL);
+
+    free_data(&data);
+}
+
+
+int main(int argc, char **argv)
+{
+    bench_tfscan();
+    bench_stscan();
+    bench_compare();
+    bench_shift(0);
+    bench_shift(64);
+    bench_shift(1024);
+    bench_shift(4096);
+    bench_readers();
+
+    return 0;
+}
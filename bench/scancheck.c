@@ -0,0 +1,315 @@
+/* scancheck.c
+ * 18 Oct 2026
+ *
+ * Makes sure the scanners, the compare engine, and the readers that
+ * feed them take linear time even on hostile input.  Run "make
+ * linearcheck".
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file scancheck.c
+ *
+ * Each check scans the same kind of input twice, once CHECK_SMALL
+ * bytes long and once CHECK_GROWTH times longer, and compares the
+ * best of CHECK_TRIES runs of each.  Linear code takes about
+ * CHECK_GROWTH times as long on the bigger input, quadratic code
+ * takes CHECK_GROWTH squared times as long.  A check fails if the
+ * ratio is more than CHECK_SLACK times what linear would be, which
+ * leaves plenty of room for a noisy machine without letting
+ * anything quadratic through.
+ *
+ * The input comes from gen_read(), which repeats a pattern and can
+ * hand out data in tiny pieces, or from read-rand.  Every scanner
+ * is driven the way tmtest drives it: scan_next_token() until
+ * scan_is_finished().
+ *
+ * Exits with 1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "re2c/read.h"
+#include "re2c/read-rand.h"
+#include "re2c/scan-dyn.h"
+
+#include "tfscan.h"
+#include "stscan.h"
+#include "compare.h"
+
+
+#define CHECK_SMALL (1024*1024)
+#define CHECK_GROWTH 8
+#define CHECK_SLACK 2.5
+#define CHECK_TRIES 3
+
+
+/** A reader that supplies len bytes by repeating pattern, optionally
+ *  ending with a newline.
+ */
+
+struct gen {
+    const char *pattern;
+    size_t plen;
+    size_t len;         ///< total number of bytes to supply
+    size_t off;         ///< number of bytes supplied so far
+    int tiny;           ///< if set, every other read supplies only one byte
+    int endnl;          ///< if set, the last byte is a newline
+    int reads;
+};
+
+
+static ssize_t gen_read(scanstate *ss)
+{
+    struct gen *gen = ss->readref;
+    char *cp;
+    ssize_t avail, n, i;
+
+    if(ss->at_eof) {
+        return 0;
+    }
+
+    avail = read_shiftbuf(ss);
+    n = gen->len - gen->off;
+    if(n > avail) {
+        n = avail;
+    }
+    if(gen->tiny && (gen->reads++ & 1) && n > 1) {
+        n = 1;
+    }
+
+    cp = (char*)ss->limit;
+    for(i=0; i<n; i++) {
+        cp[i] = gen->pattern[(gen->off + i) % gen->plen];
+    }
+    if(gen->endnl && n > 0 && gen->off + n == gen->len) {
+        cp[n-1] = '\n';
+    }
+    ss->limit += n;
+    gen->off += n;
+
+    // a full buffer returns 0 too but isn't eof.
+    if(gen->off == gen->len && n == 0) {
+        ss->at_eof = 1;
+    }
+    return n;
+}
+
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+/** Describes one check.  run() scans len bytes and returns the
+ *  number of bytes it consumed so we can tell it didn't stop early.
+ */
+
+struct check {
+    const char *name;
+    size_t (*run)(const struct check *check, size_t len);
+    scanstate* (*attach)(scanstate *ss);
+    const char *pattern;
+    int tiny;
+    size_t bufsiz;      ///< scan buffer size, BUFSIZ if 0
+    size_t bufmax;      ///< if set, the buffer may grow this big
+    int endnl;          ///< if set, the input ends with a newline
+};
+
+
+static scanstate* setup(const struct check *check, struct gen *gen, size_t len)
+{
+    scanstate *ss;
+
+    memset(gen, 0, sizeof(*gen));
+    gen->pattern = check->pattern;
+    gen->plen = strlen(check->pattern);
+    gen->len = len;
+    gen->tiny = check->tiny;
+    gen->endnl = check->endnl;
+
+    ss = dynscan_create_growable(check->bufsiz ? check->bufsiz : BUFSIZ, check->bufmax);
+    if(!ss) {
+        perror("dynscan_create");
+        exit(1);
+    }
+    ss->readref = gen;
+    ss->read = gen_read;
+    return ss;
+}
+
+
+static size_t run_scanner(const struct check *check, size_t len)
+{
+    struct gen gen;
+    scanstate *ss;
+    size_t total = 0;
+    int tok;
+
+    ss = setup(check, &gen, len);
+    (*check->attach)(ss);
+
+    do {
+        tok = scan_next_token(ss);
+        if(tok < 0) {
+            fprintf(stderr, "%s: scanner returned error %d\n", check->name, tok);
+            exit(1);
+        }
+        if(tok == 0) {
+            break;
+        }
+        total += token_length(ss);
+    } while(!scan_is_finished(ss));
+
+    dynscan_free(ss);
+    return total;
+}
+
+
+/** Compares the generated data against the same pattern fed in
+ *  chunks that don't line up with the reader's.
+ */
+
+static size_t run_compare(const struct check *check, size_t len)
+{
+    static const size_t chunks[] = { 1, 7, 4093, 61 };
+    char *data;
+    struct gen gen;
+    scanstate *ss;
+    size_t off, n, plen;
+    int i;
+
+    ss = setup(check, &gen, len);
+    compare_attach(ss);
+
+    plen = strlen(check->pattern);
+    data = malloc(65536 + plen);
+    if(!data) {
+        perror("malloc");
+        exit(1);
+    }
+    for(off=0; off < 65536 + plen; off++) {
+        data[off] = check->pattern[off % plen];
+    }
+
+    for(off=0, i=0; off < len; off += n, i++) {
+        n = chunks[i % 4];
+        if(n > len - off) {
+            n = len - off;
+        }
+        if(compare_continue(ss, data + off % plen, n) != 0) {
+            fprintf(stderr, "%s: compare failed at offset %ld\n", check->name, (long)off);
+            exit(1);
+        }
+    }
+    if(compare_check(ss) != cmp_full_match) {
+        fprintf(stderr, "%s: compare_check didn't match\n", check->name);
+        exit(1);
+    }
+
+    free(data);
+    dynscan_free(ss);
+    return len;
+}
+
+
+/** Scans data from read-rand.  It never runs out so we stop once
+ *  we've seen len bytes.
+ */
+
+static size_t run_rand(const struct check *check, size_t len)
+{
+    scanstate *ss;
+    size_t total = 0;
+    int tok;
+
+    ss = dynscan_create(BUFSIZ);
+    if(!ss) {
+        perror("dynscan_create");
+        exit(1);
+    }
+    readrand_attach(ss, 1);
+    (*check->attach)(ss);
+
+    while(total < len) {
+        tok = scan_next_token(ss);
+        if(tok <= 0) {
+            fprintf(stderr, "%s: scanner returned %d\n", check->name, tok);
+            exit(1);
+        }
+        total += token_length(ss);
+    }
+
+    dynscan_free(ss);
+    return total;
+}
+
+
+static double best_time(const struct check *check, size_t len)
+{
+    double start, best = 0;
+    size_t got;
+    int i;
+
+    for(i=0; i<CHECK_TRIES; i++) {
+        start = now();
+        got = (*check->run)(check, len);
+        start = now() - start;
+        if(got < len) {
+            fprintf(stderr, "%s: only scanned %ld of %ld bytes\n",
+                    check->name, (long)got, (long)len);
+            exit(1);
+        }
+        if(!i || start < best) best = start;
+    }
+
+    return best;
+}
+
+
+static const struct check checks[] = {
+    { "tfscan, no newlines",          run_scanner, tfscan_attach, "x" },
+    { "tfscan, no newlines, tiny reads", run_scanner, tfscan_attach, "x", 1 },
+    { "tfscan, all keywords",         run_scanner, tfscan_attach, "STDOUT:\nSTDERR:\n" },
+    { "tfscan, keywords without newlines", run_scanner, tfscan_attach, "STDOUT " },
+    { "tfscan, keywords run together", run_scanner, tfscan_attach, "STDOUTSTDERR" },
+    { "tfscan, CR-only lines",        run_scanner, tfscan_attach, "STDOUT:\rdata\r" },
+    { "tfscan, one-byte lines, tiny reads", run_scanner, tfscan_attach, "\n", 1 },
+    { "tfscan, read-rand",            run_rand, tfscan_attach },
+    // status files always end in a newline
+    { "stscan, status lines",         run_scanner, stscan_attach, "START\nCONFIG: /a/b\nRUNNING\nDONE\n", 0, 0, 0, 1 },
+    { "stscan, status lines, tiny reads", run_scanner, stscan_attach, "START\nRUNNING\n", 1, 0, 0, 1 },
+    { "stscan, garbage",              run_scanner, stscan_attach, "ABORTEDX\n\n", 0, 0, 0, 1 },
+    { "stscan, one growable line",    run_scanner, stscan_attach, "ABORTED: reason", 0, 0, 64*1024*1024, 1 },
+    { "stscan, read-rand",            run_rand, stscan_attach },
+    { "compare, no newlines",         run_compare, NULL, "x" },
+    { "compare, tiny reads",          run_compare, NULL, "line\n", 1 },
+};
+
+
+int main(int argc, char **argv)
+{
+    double small, large, ratio;
+    int failures = 0;
+    int i;
+
+    for(i=0; i<sizeof(checks)/sizeof(checks[0]); i++) {
+        small = best_time(&checks[i], CHECK_SMALL);
+        large = best_time(&checks[i], CHECK_SMALL * CHECK_GROWTH);
+        ratio = large / (small > 0 ? small : 1e-9);
+        printf("%-40s %8.2f ms %8.2f ms %6.1fx %s\n", checks[i].name,
+                small * 1000, large * 1000, ratio,
+                (ratio > CHECK_GROWTH * CHECK_SLACK ? "SUPERLINEAR" : "ok"));
+        if(ratio > CHECK_GROWTH * CHECK_SLACK) {
+            failures += 1;
+        }
+    }
+
+    return failures ? 1 : 0;
+}
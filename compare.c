@@ -18,6 +18,7 @@
 #include <string.h>
 #include <assert.h>
 #include "compare.h"
+#include "re2c/read-mem.h"
 
 
 #define STATE (*(int*)&(ss)->scanref)
@@ -55,18 +56,10 @@ static int has_extra_nl(const char *ptr, size_t len)
 
 
 
-/**
- * Feeds more bytes to the comparison engine.
- * 
- * @param ss The scanstate from compare_attach.
- * @param ptr The start of the data to compare.
- * @param len The number of bytes to compare, from 0 to MAXINT.
- *
- * @returns 0 if we still don't have an answer, 1 if the match
- * failed.
- */
-
-int compare_continue(scanstate *ss, const char *ptr, size_t len)
+// written once and compiled twice, like the tfscan routines: with mem
+// true the scanner reads from memory so a refill is always eof.
+static inline __attribute__((always_inline))
+int continue_compare(scanstate *ss, const char *ptr, size_t len, int mem)
 {
 	int prev_had_nl = 0;
     int n;
@@ -91,7 +84,7 @@ int compare_continue(scanstate *ss, const char *ptr, size_t len)
 			}
 
 			ss->token = ss->cursor;
-            n = (*ss->read)(ss);
+            n = (mem ? 0 : (*ss->read)(ss));
             ss->line += n;
             if(n < 0) {
                 // there was an error while trying to fill the buffer
@@ -131,6 +124,26 @@ int compare_continue(scanstate *ss, const char *ptr, size_t len)
 }
 
 
+/**
+ * Feeds more bytes to the comparison engine.
+ * 
+ * @param ss The scanstate from compare_attach.
+ * @param ptr The start of the data to compare.
+ * @param len The number of bytes to compare, from 0 to MAXINT.
+ *
+ * @returns 0 if we still don't have an answer, 1 if the match
+ * failed.
+ */
+
+int compare_continue(scanstate *ss, const char *ptr, size_t len)
+{
+    if(readmem_attached(ss)) {
+        return continue_compare(ss, ptr, len, 1);
+    }
+    return continue_compare(ss, ptr, len, 0);
+}
+
+
 /**
  * Returns an appropriate code for how well matched the two streams
  * are.  Assumes that you're at EOF on the ptr stream.
@@ -0,0 +1,498 @@
+/* daemon.c
+ * 18 Oct 2026
+ *
+ * Lets a long-lived tmtest run tests for short-lived ones.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file daemon.c
+ *
+ * tmtest --daemon=PATH listens on a Unix domain socket.  When
+ * TMTEST_SOCKET names that socket, tmtest becomes a client: it hands
+ * its stdin, stdout, and stderr to the daemon along with its cwd,
+ * arguments, and environment, then waits for the exit status.
+ *
+ * The daemon forks a child for each request.  The child takes on the
+ * client's fds, cwd, and environment and runs the tests exactly as the
+ * client would have, so results, rewritten testfiles, and config file
+ * output all go straight to the client's terminal.  Forking also means
+ * that each request starts from the daemon's state, never the previous
+ * request's, and any options given to the daemon act as defaults.
+ * The daemon doesn't remember anything between requests: each one
+ * finds its tests, reads its config files, and sets up its testdir
+ * just like a tmtest run from the shell, so it starts no faster.
+ *
+ * The child drops TMTEST_SOCKET from the client's environment.
+ * Requests run one at a time, so a test that runs tmtest itself would
+ * otherwise wait forever for the daemon that's running it.
+ *
+ * The protocol:
+ *
+ *   - The client sends a struct request_header and, in the same
+ *     message, fds 0, 1 and 2 as SCM_RIGHTS.
+ *   - Then header.len bytes: the cwd, header.argc arguments, and the
+ *     environment, each NUL-terminated.
+ *   - When the tests are done, the daemon sends the exit status as an
+ *     int and closes the connection.
+ *
+ * If the client goes away early (it was interrupted, most likely) the
+ * daemon interrupts the request too.  Requests are run one at a time.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "daemon.h"
+
+
+// the most cwd, argument, and environment bytes a request may carry.
+// the kernel limits a client's arguments and environment to far less.
+#define MAX_REQUEST (64*1024*1024)
+
+
+struct request_header {
+    unsigned int len;           ///< the number of bytes that follow
+    unsigned int argc;          ///< the number of arguments in them
+};
+
+
+static int make_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *cp = buf;
+    ssize_t cnt;
+
+    while(len > 0) {
+        cnt = write(fd, cp, len);
+        if(cnt < 0 && errno == EINTR) {
+            continue;
+        }
+        if(cnt <= 0) {
+            return -1;
+        }
+        cp += cnt;
+        len -= cnt;
+    }
+
+    return 0;
+}
+
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    char *cp = buf;
+    ssize_t cnt;
+
+    while(len > 0) {
+        cnt = read(fd, cp, len);
+        if(cnt < 0 && errno == EINTR) {
+            continue;
+        }
+        if(cnt <= 0) {
+            return -1;
+        }
+        cp += cnt;
+        len -= cnt;
+    }
+
+    return 0;
+}
+
+
+static int append_string(char **buf, size_t *len, const char *str)
+{
+    size_t slen = strlen(str) + 1;
+    char *grow;
+
+    grow = realloc(*buf, *len + slen);
+    if(!grow) {
+        return -1;
+    }
+    memcpy(grow + *len, str, slen);
+    *buf = grow;
+    *len += slen;
+    return 0;
+}
+
+
+/** Asks the daemon listening at path to run the tests.
+ *
+ *  @returns the exit status the daemon reported, -1 if there's no
+ *  daemon listening (so the caller should run the tests itself), or
+ *  DAEMON_LOST if it stopped answering partway through.
+ */
+
+int daemon_request(const char *path, int argc, char **argv)
+{
+    extern char **environ;
+    struct sockaddr_un addr;
+    struct request_header hdr;
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    char cwd[PATH_MAX];
+    char *payload = NULL;
+    size_t len = 0;
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int sock, status, err, i;
+
+    if(make_address(&addr, path) < 0) {
+        return -1;
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if(sock < 0) {
+        return -1;
+    }
+    if(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    // if we can't even build the request, run the tests ourselves.
+    err = (!getcwd(cwd, sizeof(cwd)) || append_string(&payload, &len, cwd) < 0);
+    for(i=0; !err && i<argc; i++) {
+        err = append_string(&payload, &len, argv[i]);
+    }
+    for(i=0; !err && environ[i]; i++) {
+        err = append_string(&payload, &len, environ[i]);
+    }
+    if(err) {
+        free(payload);
+        close(sock);
+        return -1;
+    }
+
+    hdr.len = len;
+    hdr.argc = argc;
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if(sendmsg(sock, &msg, 0) != sizeof(hdr) || write_all(sock, payload, len) < 0 ||
+            read_all(sock, &status, sizeof(status)) < 0) {
+        fprintf(stderr, "Lost the tmtest daemon at %s\n", path);
+        status = DAEMON_LOST;
+    }
+
+    free(payload);
+    close(sock);
+    return status;
+}
+
+
+/** Closes every fd that arrived with msg.  Whatever we don't use must
+ *  be closed or the client would never see its fds close.
+ */
+
+static void close_rights(struct msghdr *msg)
+{
+    struct cmsghdr *cmsg;
+    int *fds;
+    int i, n;
+
+    for(cmsg=CMSG_FIRSTHDR(msg); cmsg; cmsg=CMSG_NXTHDR(msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        fds = (int*)CMSG_DATA(cmsg);
+        n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(i=0; i<n; i++) {
+            close(fds[i]);
+        }
+    }
+}
+
+
+/** Reads a request from conn.  *vec receives the cwd, the arguments,
+ *  NULL, the environment, and NULL.  They point into *payload.  Both
+ *  are malloc'd and must be freed even if this fails.
+ *
+ *  @returns 0 on success, -1 if the request was garbage.
+ */
+
+static int read_request(int conn, int fds[3], char **payload, char ***vec, int *argc)
+{
+    char cbuf[CMSG_SPACE(3 * sizeof(int))];
+    struct request_header hdr;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    char *cp, *end;
+    ssize_t cnt;
+    int n, i;
+
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    cnt = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+    if(cnt < 0) {
+        return -1;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cnt != sizeof(hdr) || (msg.msg_flags & MSG_CTRUNC) || !cmsg ||
+            cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)) ||
+            CMSG_NXTHDR(&msg, cmsg)) {
+        close_rights(&msg);
+        return -1;
+    }
+    // from here on the caller closes the fds.
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+
+    // every string takes at least its NUL, and there's the cwd too.
+    if(hdr.len > MAX_REQUEST || hdr.argc >= hdr.len) {
+        return -1;
+    }
+
+    *payload = malloc(hdr.len + 1);
+    if(!*payload || read_all(conn, *payload, hdr.len) < 0) {
+        return -1;
+    }
+    (*payload)[hdr.len] = '\0';
+    end = *payload + hdr.len;
+
+    // count the strings so the vectors can be allocated in one go.
+    for(n=0, cp=*payload; cp < end; cp += strlen(cp) + 1) {
+        n++;
+    }
+    if(n < hdr.argc + 1) {
+        return -1;
+    }
+    *vec = malloc((n + 2) * sizeof(char*));
+    if(!*vec) {
+        return -1;
+    }
+    for(i=0, cp=*payload; cp < end; cp += strlen(cp) + 1) {
+        (*vec)[i++] = cp;
+        if(i == hdr.argc + 1) {
+            (*vec)[i++] = NULL;
+        }
+    }
+    (*vec)[i] = NULL;
+
+    *argc = hdr.argc;
+    return 0;
+}
+
+
+static int sigchld_pipe[2];
+
+static void sig_chld(int sig)
+{
+    int saved = errno;
+    if(write(sigchld_pipe[1], "", 1) < 0) {
+        // the pipe is full so the main loop will wake up anyway.
+    }
+    errno = saved;
+}
+
+
+/** Runs one request in a child and waits for it to finish.
+ *
+ *  @returns the child's wait status.
+ */
+
+static int run_request(int listener, int conn, daemon_proc run)
+{
+    extern char **environ;
+    struct pollfd pfd[2];
+    char *payload = NULL;
+    char **vec = NULL;
+    int fds[3] = { -1, -1, -1 };
+    int argc, child, status = 0;
+    char c;
+    int i;
+
+    if(read_request(conn, fds, &payload, &vec, &argc) < 0) {
+        fprintf(stderr, "tmtest daemon: ignoring a garbled request\n");
+        status = -1;
+        goto done;
+    }
+
+    // don't let the child print anything we left in our buffers.
+    fflush(stdout);
+    fflush(stderr);
+    child = fork();
+    if(child < 0) {
+        perror("tmtest daemon: forking");
+        status = -1;
+        goto done;
+    }
+    if(child == 0) {
+        close(listener);
+        close(conn);
+        close(sigchld_pipe[0]);
+        close(sigchld_pipe[1]);
+        signal(SIGCHLD, SIG_DFL);
+        for(i=0; i<3; i++) {
+            if(dup2(fds[i], i) < 0) {
+                _exit(1);
+            }
+            close(fds[i]);
+        }
+        if(chdir(vec[0]) < 0) {
+            fprintf(stderr, "Could not chdir to %s: %s\n", vec[0], strerror(errno));
+            _exit(1);
+        }
+        environ = vec + argc + 2;
+        unsetenv(SOCKET_ENV);
+        exit(run(argc, vec + 1));
+    }
+
+    // the client's fds belong to the child now.
+    for(i=0; i<3; i++) {
+        close(fds[i]);
+        fds[i] = -1;
+    }
+
+    // wait for the child while watching for the client to hang up.
+    pfd[0].fd = sigchld_pipe[0];
+    pfd[0].events = POLLIN;
+    pfd[1].fd = conn;
+    pfd[1].events = POLLIN;
+    while(waitpid(child, &status, WNOHANG) == 0) {
+        if(poll(pfd, 2, -1) < 0 && errno != EINTR) {
+            // can't tell when the client leaves.  just wait.
+            waitpid(child, &status, 0);
+            break;
+        }
+        while(pfd[0].revents && read(sigchld_pipe[0], &c, 1) > 0) {
+            // drain it
+        }
+        if(pfd[1].revents) {
+            kill(child, SIGINT);
+            pfd[1].fd = -1;
+        }
+    }
+
+done:
+    for(i=0; i<3; i++) {
+        if(fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    free(vec);
+    free(payload);
+    return status;
+}
+
+
+/** Listens on path and runs every request that arrives by calling
+ *  run() in a child process.
+ *
+ *  @returns -1 if it couldn't listen or accept (and the reason was
+ *  printed).  Otherwise it never returns.
+ */
+
+int daemon_serve(const char *path, daemon_proc run)
+{
+    struct sockaddr_un addr;
+    struct ucred cred;
+    socklen_t credlen;
+    mode_t mask;
+    int listener, conn;
+    int status, result;
+
+    if(make_address(&addr, path) < 0) {
+        return -1;
+    }
+
+    listener = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if(listener < 0) {
+        perror("tmtest daemon: socket");
+        return -1;
+    }
+
+    // a socket that nobody answers was left by a dead daemon.
+    conn = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if(conn >= 0 && connect(conn, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "A tmtest daemon is already listening on %s\n", path);
+        return -1;
+    }
+    close(conn);
+    unlink(path);
+
+    // only we may connect.
+    mask = umask(077);
+    if(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 8) < 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", path, strerror(errno));
+        umask(mask);
+        close(listener);
+        return -1;
+    }
+    umask(mask);
+
+    if(pipe2(sigchld_pipe, O_CLOEXEC|O_NONBLOCK) < 0) {
+        perror("tmtest daemon: pipe");
+        return -1;
+    }
+    signal(SIGCHLD, sig_chld);
+    signal(SIGPIPE, SIG_IGN);
+
+    for(;;) {
+        conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if(conn < 0) {
+            if(errno != EINTR && errno != ECONNABORTED) {
+                perror("tmtest daemon: accept");
+                return -1;
+            }
+            continue;
+        }
+
+        credlen = sizeof(cred);
+        if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0 ||
+                cred.uid != getuid()) {
+            close(conn);
+            continue;
+        }
+
+        status = run_request(listener, conn, run);
+        if(status >= 0) {
+            result = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            write_all(conn, &result, sizeof(result));
+        }
+        close(conn);
+    }
+}
@@ -0,0 +1,19 @@
+/* daemon.h
+ * 18 Oct 2026
+ *
+ * Lets a long-lived tmtest run tests for short-lived ones.
+ * See daemon.c.
+ * This file is covered by the MIT License.
+ */
+
+
+// if set, tmtest asks the daemon listening on this socket to run the tests.
+#define SOCKET_ENV "TMTEST_SOCKET"
+
+// returned by daemon_request() if the daemon went away mid-request.
+#define DAEMON_LOST -2
+
+typedef int (*daemon_proc)(int argc, char **argv);
+
+int daemon_request(const char *path, int argc, char **argv);
+int daemon_serve(const char *path, daemon_proc run);
@@ -0,0 +1,325 @@
+/* isolate.c
+ * 18 Oct 2026
+ *
+ * Runs a shell in its own user, mount, network and pid namespaces.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file isolate.c
+ *
+ * isolate_spawn() forks a helper that creates the namespaces, mounts a
+ * fresh tmpfs on each testhome, copies the tmtest.setup snapshot into
+ * it if there is one, and brings up the loopback interface.
+ * It then forks the shell, which becomes pid 1 in the new pid
+ * namespace and mounts a /proc that shows only the processes in it.
+ * When the shell exits the kernel kills everything the
+ * test left running in the background.
+ *
+ * Because tmtest can't see into the tmpfs, the helper calls each
+ * home's finished hook once the shell has exited.  The runner's hook
+ * compares the FILE sections and lists the leftovers right there and
+ * writes them to the test's status file as "FILE: yes path" and
+ * "LEFTOVER: not deleted: ...".  Then the tmpfs is unmounted, so
+ * nothing the test left behind is ever copied out.  The helper exits
+ * with the shell's status so tmtest can't tell the difference.
+ *
+ * The uid and gid are mapped to themselves so the test doesn't notice
+ * the user namespace either.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "isolate.h"
+#include "snapshot.h"
+
+
+// exit status if the namespaces couldn't be set up, like a failed exec.
+#define ISOLATE_FAILED 127
+
+
+static void die(const char *what, const char *arg)
+{
+    fprintf(stderr, "--isolate: could not %s%s: %s\n", what, arg, strerror(errno));
+    _exit(ISOLATE_FAILED);
+}
+
+
+static void write_proc(const char *file, const char *text)
+{
+    int fd;
+
+    fd = open(file, O_WRONLY);
+    if(fd < 0 || write(fd, text, strlen(text)) != strlen(text)) {
+        die("write ", file);
+    }
+    close(fd);
+}
+
+
+static void map_ids(uid_t uid, gid_t gid)
+{
+    char buf[64];
+
+    // the kernel won't let us write gid_map until setgroups is denied.
+    write_proc("/proc/self/setgroups", "deny");
+    snprintf(buf, sizeof(buf), "%ld %ld 1\n", (long)uid, (long)uid);
+    write_proc("/proc/self/uid_map", buf);
+    snprintf(buf, sizeof(buf), "%ld %ld 1\n", (long)gid, (long)gid);
+    write_proc("/proc/self/gid_map", buf);
+}
+
+
+/** A new network namespace only has a loopback interface and it's down.
+ */
+
+static void loopback_up()
+{
+    struct ifreq ifr;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+    if(sock < 0) {
+        die("create a socket", "");
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, "lo", sizeof(ifr.ifr_name) - 1);
+    if(ioctl(sock, SIOCGIFFLAGS, &ifr) < 0) {
+        die("get the flags for ", "lo");
+    }
+    ifr.ifr_flags |= IFF_UP;
+    if(ioctl(sock, SIOCSIFFLAGS, &ifr) < 0) {
+        die("bring up ", "lo");
+    }
+
+    close(sock);
+}
+
+
+static int int_cmp(const void *a, const void *b)
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+
+/** Closes the fds from lo to hi.  Like cloexec_inherited_fds() in
+ *  main.c, it does it the slow way if the kernel is too old for
+ *  close_range.
+ */
+
+static void close_fds(unsigned int lo, unsigned int hi)
+{
+    long fd, max;
+
+#ifdef CLOSE_RANGE_CLOEXEC
+    if(close_range(lo, hi, 0) == 0) {
+        return;
+    }
+#endif
+
+    max = sysconf(_SC_OPEN_MAX);
+    for(fd=lo; fd <= hi && fd < max; fd++) {
+        close(fd);
+    }
+}
+
+
+/** Closes every fd above stderr except the ones in keep and the homes'
+ *  hookfds.  Unlike the shell, the helper doesn't exec so close-on-exec
+ *  doesn't help it.  It must close the pipe's write end or the shell
+ *  would never see EOF.
+ */
+
+static void close_others(const int *keep, int nkeep, int infd,
+        const struct isolated_home *homes, int nhomes)
+{
+    int n = nkeep + 1 + nhomes;
+    int sorted[n];
+    unsigned int lo = 3;
+    int i;
+
+    memcpy(sorted, keep, nkeep * sizeof(int));
+    sorted[nkeep] = infd;
+    for(i=0; i<nhomes; i++) {
+        sorted[nkeep+1+i] = homes[i].hookfd;
+    }
+    qsort(sorted, n, sizeof(int), int_cmp);
+
+    for(i=0; i<n; i++) {
+        if(sorted[i] < 0) {
+            continue;
+        }
+        if(sorted[i] > lo) {
+            close_fds(lo, sorted[i] - 1);
+        }
+        if(sorted[i] >= lo) {
+            lo = sorted[i] + 1;
+        }
+    }
+    close_fds(lo, ~0U);
+}
+
+
+/** The helper: runs in the new namespaces, starts the shell as pid 1,
+ *  calls the finished hooks, and exits the same way the shell did.
+ */
+
+static void run_helper(const char *prog, char *const argv[], int infd,
+        const int *keep, int nkeep,
+        const struct isolated_home *homes, int nhomes)
+{
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+    int child, status;
+    int i;
+
+    close_others(keep, nkeep, infd, homes, nhomes);
+
+    if(unshare(CLONE_NEWUSER|CLONE_NEWNS|CLONE_NEWNET|CLONE_NEWPID) < 0) {
+        die("create namespaces", "");
+    }
+    map_ids(uid, gid);
+
+    // make sure our mounts don't propagate back to the real system.
+    if(mount(NULL, "/", NULL, MS_REC|MS_PRIVATE, NULL) < 0) {
+        die("make mounts private", "");
+    }
+    for(i=0; i<nhomes; i++) {
+        if(mount("tmpfs", homes[i].path, "tmpfs", MS_NOSUID|MS_NODEV, "mode=0700") < 0) {
+            die("mount a tmpfs on ", homes[i].path);
+        }
+        // tmtest left the real testhome empty so the copy goes in here.
+        if(homes[i].seed && snapshot_copy(homes[i].seed, homes[i].path) < 0) {
+            die("seed ", homes[i].path);
+        }
+    }
+    loopback_up();
+
+    child = fork();
+    if(child < 0) {
+        die("fork", "");
+    }
+    if(child == 0) {
+        // the shell is pid 1.  don't let it outlive the helper.
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        // the old /proc shows the pids outside the namespace.
+        if(mount("proc", "/proc", "proc", MS_NOSUID|MS_NODEV|MS_NOEXEC, NULL) < 0) {
+            die("mount ", "/proc");
+        }
+        if(dup2(infd, STDIN_FILENO) < 0) {
+            die("dup2 the script to stdin", "");
+        }
+        for(i=0; i<nkeep; i++) {
+            fcntl(keep[i], F_SETFD, 0);
+        }
+        // the tmpfs is mounted over the testhome so cd into it again.
+        if(chdir(homes[0].path) < 0) {
+            die("chdir to ", homes[0].path);
+        }
+        if(strchr(prog, '/')) {
+            execv(prog, argv);
+        } else {
+            execvp(prog, argv);
+        }
+        die("execute ", prog);
+    }
+    close(infd);
+
+    while(waitpid(child, &status, 0) < 0) {
+        if(errno != EINTR) {
+            die("wait for ", prog);
+        }
+    }
+
+    for(i=0; i<nhomes; i++) {
+        if(homes[i].finished) {
+            homes[i].finished(&homes[i]);
+        }
+        umount2(homes[i].path, MNT_DETACH);
+    }
+
+    if(WIFSIGNALED(status)) {
+        signal(WTERMSIG(status), SIG_DFL);
+        kill(getpid(), WTERMSIG(status));
+    }
+    _exit(WIFEXITED(status) ? WEXITSTATUS(status) : ISOLATE_FAILED);
+}
+
+
+/** Starts prog in new namespaces with its stdin reading from infd.
+ *  Like spawn_child() in runner.c, the child only inherits stdout,
+ *  stderr, and the fds in keep.  Each home gets a fresh tmpfs, seeded
+ *  if the home has a seed, and the shell starts in the first one.
+ *
+ *  @returns the pid of the helper, which exits with the shell's status.
+ */
+
+int isolate_spawn(const char *prog, char *const argv[], int infd,
+        const int *keep, int nkeep,
+        const struct isolated_home *homes, int nhomes)
+{
+    int helper;
+
+    // like spawn_child(), the helper leads its own process group.
+    // both sides call setpgid so it's in place no matter who runs first.
+    helper = fork();
+    if(helper == 0) {
+        setpgid(0, 0);
+        run_helper(prog, argv, infd, keep, nkeep, homes, nhomes);
+    }
+    if(helper > 0) {
+        setpgid(helper, helper);
+    }
+
+    return helper;
+}
+
+
+/** Makes sure that we're allowed to create the namespaces so that
+ *  --isolate can fail up front rather than once for every test.
+ *
+ *  @returns 0 if so, -1 if not (and the reason was printed).
+ */
+
+int isolate_check()
+{
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+    int child, status;
+
+    child = fork();
+    if(child < 0) {
+        return -1;
+    }
+    if(child == 0) {
+        if(unshare(CLONE_NEWUSER|CLONE_NEWNS|CLONE_NEWNET|CLONE_NEWPID) < 0) {
+            die("create namespaces", "");
+        }
+        map_ids(uid, gid);
+        _exit(0);
+    }
+
+    if(waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,27 @@
+/* isolate.h
+ * 18 Oct 2026
+ *
+ * Runs a shell in its own namespaces.  See isolate.c.
+ * This file is covered by the MIT License.
+ */
+
+
+/** A testhome that gets a fresh tmpfs in the new mount namespace.
+ */
+
+struct isolated_home {
+    const char *path;       ///< the testhome
+    int statusfd;           ///< the test's status file
+    const char *seed;       ///< copied into the tmpfs before the test starts, NULL if none
+    /// called inside the namespace once the shell has exited, while the
+    /// tmpfs can still be seen.  it reports what it finds through statusfd.
+    void (*finished)(const struct isolated_home *home);
+    int hookfd;             ///< kept open in the helper for finished, -1 if none.  the shell doesn't get it.
+    void *refcon;           ///< for use by finished
+};
+
+
+int isolate_spawn(const char *prog, char *const argv[], int infd,
+        const int *keep, int nkeep,
+        const struct isolated_home *homes, int nhomes);
+int isolate_check();
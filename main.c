@@ -9,75 +9,71 @@
  */
 
 
+// for close_range
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/wait.h>
 #include <sys/time.h>
-#include <time.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <dirent.h>
+#include <signal.h>
 #include <getopt.h>
-#include <assert.h>
-
-#include "re2c/read-fd.h"
 
 #include "test.h"
-#include "qscandir.h"
+#include "perf.h"
+#include "prof.h"
+#include "reaper.h"
+#include "runner.h"
 #include "vars.h"
-#include "tfscan.h"
 #include "pathconv.h"
-#include "pathstack.h"
-
-#define DIFFPROG "/usr/bin/diff"
-#define SHPROG   "/bin/bash"
-
-
-enum {
-    outmode_test,
-    outmode_dump,
-    outmode_diff
-};
-
-/* configuration options */
-int outmode = outmode_test;
-int allfiles = 0;     // run a testfile even if it begins with a dash
-int dumpscript = 0;   // print the script instead of running it
-int quiet = 0;
-int verbose = 0;
-char *config_file;    // absolute path to the user-specified config file
-                      // null if user didn't specify a config file.
+#include "rusage.h"
+#include "watch.h"
+#include "daemon.h"
+
+
+/* configuration options.  the ones that affect how the tests are run
+ * live in the runner. */
+struct runner runner;
+int repeat_given = 0; // true if the user specified --repeat
+int watch = 0;        // rerun tests when they or their config files change
+char *daemon_path;    // listen for requests on this socket.  null if not a daemon.
+char *perf_baseline;  // compare test timings against this file.  null if none.
+int perf_threshold = 25;  // percent slower before a test is flagged
+int perf_update = 0;  // replace existing baseline timings with this run's
+int profile = 0;      // print how long each phase of running tests took
 
 const char *orig_cwd; // tmtest changes dirs before running a test
 
-// The testdir contains fifos, tempfiles, etc for running the test.
-#define TESTDIR "/tmp/tmtest-XXXXXX"
-char g_testdir[sizeof(TESTDIR)];
-
-#define OUTNAME "stdout"
-#define ERRNAME "stderr"
-#define STATUSNAME "status"
-#define TESTHOME "test"
-char g_outname[sizeof(TESTDIR)+sizeof(OUTNAME)];
-char g_errname[sizeof(TESTDIR)+sizeof(ERRNAME)];
-char g_statusname[sizeof(TESTDIR)+sizeof(STATUSNAME)];
-char g_testhome[sizeof(TESTDIR)+sizeof(TESTHOME)];
-
-// file in tmpdir that holds stdout
-#define DIFFNAME "diff"
 
+/** With --watch, every test that was run and every directory that was
+ *  searched for tests is remembered so the tests can be rerun without
+ *  walking the tree again.
+ */
 
-int g_outfd;
-int g_errfd;
-int g_statusfd;
+struct watched_test {
+    char *abspath;
+    char *relpath;
+    int dirty;                  ///< true if the test needs to be run again
+};
 
+struct watched_dir {
+    char *path;                 ///< new testfiles in here are run too
+    int print_absolute;         ///< print their names as absolute paths
+};
 
-struct timeval test_start_time;
-struct timeval test_stop_time;
+struct watched_test *watched_tests;
+int nwatched_tests;
+struct watched_dir *watched_dirs;
+int nwatched_dirs;
+struct watched_dir *new_dirs;   ///< dirs that appeared since the last round
+int nnew_dirs;
 
 
 // exit values:
@@ -95,836 +91,71 @@ enum {
 #define stringify(x) xstringify(x)
 
 
-#define is_dash(s) ((s)[0] == '-' && (s)[1] == '\0')
-
-
-/** Returns zero if s1 ends with s2, nonzero if not.
- */
-
-static int strcmpend(const char *s1, const char *s2)
-{
-    size_t n1 = strlen(s1);
-    size_t n2 = strlen(s2);
-
-    if(n2 <= n1) {
-        return strncmp(s1+n1-n2, s2, n2);
-    } else {
-        return 1;
-    }
-}
-
-
-static int i_have_permission(const struct stat *st, int op)
-{
-    if(st->st_mode & S_IRWXU & op) {
-        if(geteuid() == st->st_uid) {
-            return 1;
-        }
-    }
-
-    if(st->st_mode & S_IRWXG & op) {
-        if(getegid() == st->st_gid) {
-            return 1;
-        }
-    }
-
-    if(st->st_mode & S_IRWXO & op) {
-        return 1;
-    }
-
-    return 0;
-}
-
-
-static void copy_string(char *dst, const char *src, int dstsiz)
-{
-    dst[0] = '\0';
-    strncat(dst, src, dstsiz - 1);
-}
-
-
-static void cat_path(char *dst, const char *s1, const char *s2, int siz)
-{
-    // copies s1 and s2 into dst, separated with a "/" character.
-    // Generally s1 will be an absolute path and s2 will be relative.
-
-    int s1len = strlen(s1);
-    int s2len = strlen(s2);
-    if(s1len + s2len + 2 > siz) {
-        fprintf(stderr, "Path overflow!\n");
-        exit(argument_error);
-    }
-
-    memcpy(dst, s1, s1len);
-    dst[s1len] = '/';
-    memcpy(dst + s1len + 1, s2, s2len + 1); // include null terminator
-}
-
-
-/** Prints the given template to the given file, performing substitutions.
- */
-
-static void print_template(struct test *test, const char *tmpl,  FILE *fp)
-{
-    char varbuf[32];
-    const char *cp, *ocp, *ce;
-    int len;
-
-    for(ocp=cp=tmpl; (cp=strchr(cp,'%')); cp++) {
-        if(cp[1] == '(') {
-            // perform a substitution
-            fwrite(ocp, cp - ocp, 1, fp);
-            cp += 2;
-            ce = strchr(cp,')');
-            if(!ce) {
-                fprintf(stderr, "Unterminated template variable: '%.20s'\n", cp);
-                exit(runtime_error);
-            }
-            len = ce - cp;
-            if(len <= 0) {
-                fprintf(stderr, "Garbage template variable: '%.20s'\n", cp);
-                exit(runtime_error);
-            }
-            // truncate variable name if it doesn't fit into varbuf.
-            if(len > sizeof(varbuf)-1) {
-                len = sizeof(varbuf)-1;
-            }
-            memcpy(varbuf, cp, len);
-            varbuf[len] = '\0';
-            if(printvar(test,fp,varbuf) != 0) {
-                // printvar has already printed the error message
-                exit(runtime_error);
-            }
-            ocp = cp = ce+1;
-        }
-    }
-
-    fputs(ocp, fp);
-}
-
-
-/** Checks the actual results against the expected results.
- *
- * Returns 0 if all results match, or a code telling what
- * part didn't match.
- */
-
-
-static void reset_fd(int fd, const char *fname)
-{
-    if(lseek(fd, 0, SEEK_SET) < 0) {
-        fprintf(stderr, "Couldn't seek to start of %s: %s\n",
-                fname, strerror(errno));
-        exit(runtime_error);
-    }
-
-    if(ftruncate(fd, 0) < 0) {
-        fprintf(stderr, "Couldn't reset file %s: %s\n",
-                fname, strerror(errno));
-        exit(runtime_error);
-    }
-}
-
-
-static int wait_for_child(int child, const char *name)
-{
-    int pid;
-    int status;
-
-    // wait patiently for child to finish.
-    pid = waitpid(child, &status, 0);
-    if(pid < 0) {
-        fprintf(stderr, "Error waiting for %s to finish: %s\n",
-                strerror(errno), name);
-        exit(runtime_error);
-    }
-
-    if(WIFSIGNALED(status)) {
-        if(WTERMSIG(status) == SIGINT) {
-            // If test was interrupted with a sigint then raise it on ourselves.
-            // Otherwise it can be hard to interrupt a series of tests
-            // (you kill one test but the next one fires right up).
-            kill(getpid(), SIGINT);
-        }
-    } else if(!WIFEXITED(status)) {
-        // not signalled, but os claims child didn't exit normally.
-        fprintf(stderr, "WTF??  Unknown status returned by %s: %d\n",
-                name, status);
-        exit(runtime_error);
-    }
-
-    return status;
-}
-
-
-static int open_file(char *fn, int fnsiz, const char *name, int flags)
-{
-    int fd;
-
-    cat_path(fn, g_testdir, name, fnsiz);
-    fd = open(fn, flags|O_RDWR|O_CREAT/*|O_EXCL*/, S_IRUSR|S_IWUSR);
-    if(fd < 0) {
-        fprintf(stderr, "couldn't open %s: %s\n", fn, strerror(errno));
-        exit(runtime_error);
-    }
-
-    return fd;
-}
-
-
-static void write_stdin_to_tmpfile(struct test *test)
-{
-    int diffsiz;
-    int fd;
-
-    diffsiz = sizeof(TESTDIR) + sizeof(DIFFNAME);
-    test->diffname = malloc(diffsiz);
-    if(!test->diffname) {
-        perror("malloc");
-        exit(runtime_error);
-    }
-
-    fd = open_file(test->diffname, diffsiz, DIFFNAME, 0);
-    assert(strlen(test->diffname) == sizeof(TESTDIR)+sizeof(DIFFNAME)-1);
-    write_file(test, fd, 0, NULL);
-    close(fd);
-}
-
-
-/** Forks off a diff process and sets it up to receive the dumped test.
- */
-
-static int start_diff(struct test *test)
-{
-    int pipes[2];
-    int child;
-    const char *filename = NULL;
-
-    assert(test->testfile);
-    // if the test is coming from stdin, we need to copy it to a
-    // real file before we can diff against it.
-    if(is_dash(test->testfile)) {
-        // first, write all of our stdin to a tmpfile.
-        write_stdin_to_tmpfile(test);
-        // then, read the test from this file instead of stdin.
-        filename = test->diffname;
-        assert(filename);
-        assert(filename[0]);
-    } else {
-        filename = test->testpath;
-    }
-
-    if(pipe(pipes) < 0) {
-        perror("creating diff pipe");
-        exit(runtime_error);
-    }
-
-    child = fork();
-    if(child < 0) {
-        perror("forking diff");
-        exit(runtime_error);
-    }
-    if(child == 0) {
-        if(dup2(pipes[0], 0) < 0) {
-            perror("dup2ing test output to child's stdin");
-            exit(runtime_error);
-        }
-        close(pipes[0]);
-        close(pipes[1]);
-
-        execl(DIFFPROG, DIFFPROG, "-u", filename, "-", (char*)NULL);
-        perror("executing " DIFFPROG " for test");
-        exit(runtime_error);
-    }
-
-    close(pipes[0]);
-    test->rewritefd = pipes[1];
-
-    return child;
-}
-
-
-/** Waits for the forked diff process to finish.
- */
-
-static void finish_diff(struct test *test, int diffpid)
-{
-    int status;
-    int exitcode;
-
-    close(test->rewritefd);
-
-    status = wait_for_child(diffpid, "diff");
-    if(WIFSIGNALED(status)) {
-        fprintf(stderr, "diff terminated by signal %d!\n", WTERMSIG(status));
-        exit(runtime_error);
-    }
-
-    exitcode = WEXITSTATUS(status);
-
-    // I forget what return code 1 meands but it's harmless
-    // (in gnu diff anyway; dunno about other diffs)
-    if(exitcode != 0 && exitcode != 1) {
-        fprintf(stderr, "diff returned %d!\n", exitcode);
-        exit(runtime_error);
-    }
-}
-
-
-static int open_test_file(struct test *test)
-{
-    int fd;
-
-    // If the filename is a dash then we just use stdin.
-    if(is_dash(test->testfile)) {
-        return STDIN_FILENO;
-    }
-
-    fd = open(test->testfile, O_RDONLY);
-    if(fd < 0) {
-        fprintf(stderr, "Could not open %s: %s\n", test->testfile, strerror(errno));
-        exit(runtime_error);
-    }
-
-    return fd;
-}
-
-
-static int select_no_pseudo_dirs(const struct dirent *d)
-{
-    if(d->d_name[0] == '.' && d->d_name[1] == '\0') return 0;
-    if(d->d_name[0] == '.' && d->d_name[1] == '.' && d->d_name[2] == '\0') return 0;
-    return 1;
-}
-
-
-static int remove_subdirs(struct test *test, struct pathstack *stack, char *start, char *msg, int msgsiz)
-{
-    struct stat st;
-    char **ents;
-    char *path;
-    struct pathstate state;
-    int count = 0;
-    int i, subcnt;
-
-    ents = qscandir(pathstack_absolute(stack), select_no_pseudo_dirs, qdirentcoll);
-    if(!ents) {
-        // qscandir has already printed the error message
-        exit(runtime_error);
-    }
-
-    for(i=0; ents[i]; i++) {
-        count += 1;
-        subcnt = 0;
-
-        if(pathstack_push(stack, ents[i], &state) != 0) {
-            fprintf(stderr, "path too long: %s\n", ents[i]);
-            exit(runtime_error);
-        }
-        path = pathstack_absolute(stack);
-
-        if(stat(path, &st) < 0) {
-            test_abort(test, "Could not locate %s: %s\n", path, strerror(errno));
-        }
-
-        if(S_ISDIR(st.st_mode)) {
-            subcnt = remove_subdirs(test, stack, start, msg, msgsiz);
-            if(rmdir(path) < 0) {
-                test_abort(test, "Could not rmdir %s: %s\n", path, strerror(errno));
-            }
-        } else {
-            if(unlink(path) < 0) {
-                test_abort(test, "Could not unlink %s: %s\n", path, strerror(errno));
-            }
-        }
-
-        if(subcnt == 0) {
-            // only add a dir to the message if we didn't remove any subdirs
-            // we don't care if there's truncation here since it's only being
-            // displayed to the user and the dirs are being deleted anyway.
-            if(msg[0]) {
-                strncat(msg, ", ", msgsiz - strlen(msg) - 1);
-            } else {
-                strncat(msg, "not deleted: ", msgsiz - strlen(msg) - 1);
-            }
-            strncat(msg, start, msgsiz - strlen(msg) - 1);
-        }
-
-        pathstack_pop(stack, &state);
-        free(ents[i]);
-    }
-
-    free(ents);
-    return count;
-}
-
-
-/** Ensures no files or dirs were left behind in the testhome.
- *  If there were, it deletes them and marks the test as failed.
- */
-
-static void check_testhome(struct test *test)
-{
-    char buf[PATH_MAX];
-    struct pathstack stack;
-    char message[BUFSIZ];
-
-    if(pathstack_init(&stack, buf, sizeof(buf), g_testhome) != 0) {
-        fprintf(stderr, "path too long: %s\n", g_testhome);
-        exit(runtime_error);
-    }
-    message[0] = '\0';
-    remove_subdirs(test, &stack, buf+strlen(g_testhome)+1, message, sizeof(message));
-
-    if(message[0] && test->status == test_was_started) {
-        test->status = test_has_failed;
-        test->status_reason = strdup(message);
-    }
-}
-
-
-// quick sanity check to be absolutely certain we're not starting
-// a test with files and dirs left over from a previous run.
-static void verify_testhome(struct test *test)
-{
-    DIR *directory;
-    struct dirent *entry;
-
-    directory = opendir(g_testhome);
-    if(directory == NULL) {
-        test_abort(test, "Could not open directory '%s': %s\n",
-                g_testhome, strerror(errno));
-    }
-
-    while((entry = readdir(directory)) != NULL) {
-        if(select_no_pseudo_dirs(entry)) {
-            test_abort(test, "Almost started test with files in %s: %s", g_testhome, entry->d_name);
-        }
-    }
-
-    closedir(directory);
-}
-
-
-int valid_filename(const char *name)
-{
-    return is_dash(name) || allfiles || strcmpend(name, ".test") == 0;
-}
-
-
-/** Runs the named testfile.
- *
- * When config files are executing, they use the standard stdout
- * and stderr.  That way, the user sees any output while the test
- * is running (should help with debugging).  However, when the
- * test itself is running, its output is redirected into outfd/errfd.
- *
- * It may appear that outmode_dump mixes stdio and Unix I/O, but it
- * doesn't really.  We only print to stdio when testing, and we only
- * dump the file when dumping.  They cannot both happen simultaneously.
- *
- * @returns 1 if we should keep testing, 0 if we should stop now.
- */
-
-static int run_test(const char *abspath, const char *relpath)
-{
-    struct test test;
-    char buf[BUFSIZ];   // scan buffer for the testfile
-    int pipes[2];
-    int child;
-    int keepontruckin = 0;
-    int diffpid;
-    int fd = -1;
-    int i;
-    FILE *tochild;
-    jmp_buf abort_jump;
-
-    // defined in the exec.c file generated by exec.tmpl.
-    extern const char exec_template[];
-
-    if(!valid_filename(abspath)) {
-        return 1;
-    }
-
-    // so that we can safely single quote filenames in the shell.
-    if(strchr(abspath, '\'') || strchr(abspath, '"')) {
-        fprintf(stderr, "%s was skipped because its file name contains a quote character.\n", relpath);
-        return 1;
-    }
-
-    test_init(&test);
-    if(setjmp(abort_jump)) {
-        // test was aborted.
-        fprintf(stderr, "Test aborted: %s\n", test.status_reason);
-        exit(runtime_error);
-    }
-
-    test.testfile = relpath;
-    test.testpath = abspath;
-    test.outfd = g_outfd;
-    test.errfd = g_errfd;
-    test.statusfd = g_statusfd;
-
-    verify_testhome(&test);
-
-    // initialize the test mode
-    switch(outmode) {
-        case outmode_test:
-            // nothing to do
-            break;
-        case outmode_dump:
-            test.rewritefd = STDOUT_FILENO;
-            break;
-        case outmode_diff:
-            diffpid = start_diff(&test);
-            break;
-        default:
-            assert(!"Unhandled outmode 1 in run_test()");
-    }
-
-    // reset the stdout and stderr capture files.
-    reset_fd(test.outfd, "stdout");
-    reset_fd(test.errfd, "stderr");
-    reset_fd(test.statusfd, "status");
-
-    // set up the pipe to feed input to the child.
-    // ignore sigpipes since we don't want a signal raised if child
-    // quits early (which almost always happens since it exits before
-    // it reads its expected stdout/stderr).
-    if(pipe(pipes) < 0) {
-        perror("creating test pipe");
-        exit(runtime_error);
-    }
-
-    // fork child process
-    child = fork();
-    if(child < 0) {
-        perror("forking test");
-        exit(runtime_error);
-    }
-    if(child == 0) {
-        if(dup2(pipes[0], 0) < 0) {
-            perror("dup2ing input to test's stdin");
-            exit(runtime_error);
-        }
-        close(pipes[0]);
-        close(pipes[1]);
-
-        if(chdir(g_testhome) != 0) {
-            fprintf(stderr, "Could not chdir 2 to %s: %s\n", g_testhome, strerror(errno));
-            exit(runtime_error);
-        }
-
-        execl(SHPROG, SHPROG, "-s", (char*)NULL);
-        perror("executing " SHPROG " for test");
-        exit(runtime_error);
-    }
-
-    // create the testfile scanner.  it will either scan from
-    // the testfile itself or from stdin if filename is "-".
-    scanstate_init(&test.testscanner, buf, sizeof(buf));
-    if(test.diffname) {
-        if(lseek(test.diff_fd, 0, SEEK_SET) < 0) {
-            fprintf(stderr, "Couldn't seek to start of %s: %s\n",
-                    test.diffname, strerror(errno));
-            exit(runtime_error);
-        }
-        readfd_attach(&test.testscanner, test.diff_fd);
-    } else {
-        readfd_attach(&test.testscanner, open_test_file(&test));
-    }
-    tfscan_attach(&test.testscanner);
-
-    if(dumpscript) {
-        print_template(&test, exec_template, stdout);
-        // don't want to print a summary of the tests run so make
-        // sure tmtest realizes it's dumping a test.
-        outmode = outmode_dump;
-    } else {
-        // set up the pipes for the parent
-        close(pipes[0]);
-        tochild = fdopen(pipes[1], "w");
-        if(!tochild) {
-            perror("calling fdopen on pipe");
-            exit(runtime_error);
-        }
-
-        // write the test script to the kid
-        print_template(&test, exec_template, tochild);
-        fclose(tochild);
-
-        // wait for the test to finish
-        i = wait_for_child(child, "test");
-        test.exitsignal = (WIFSIGNALED(i) ? WTERMSIG(i) : 0);
-        test.exitcored = (WIFSIGNALED(i) ? WCOREDUMP(i) : 0);
-        test.exitno = (WIFEXITED(i) ? WEXITSTATUS(i) : 256);
-
-        // read the status file to determine what happened
-        // and store the information in the test struct.
-        scan_status_file(&test);
-        check_testhome(&test);
-
-        // process and output the test results
-        switch(outmode) {
-            case outmode_test:
-                test_results(&test);
-                break;
-            case outmode_dump:
-                dump_results(&test);
-                break;
-            case outmode_diff:
-                dump_results(&test);
-                finish_diff(&test, diffpid);
-                break;
-            default:
-                assert(!"Unhandled outmode 2 in run_test()");
-        }
-
-        // if we had to open the testfile to read it, we now close it.
-        // because the scanner is statically allocated, there's no
-        // need to destroy it.
-        if(fd >= 0) {
-            close(fd);
-        }
-
-        keepontruckin = !was_aborted(test.status);
-    }
-
-    usleep(10000); // TODO: this is really weird.  it slows us way down.  Get rid of it!!!
-        // without this we get "shell-init: error retrieving current directory: getcwd: cannot access parent directories: No such file or directory"
-        // get rid of this when switching to event based handling.
-
-    test_free(&test);
-
-    return keepontruckin;
-}
-
-
-int process_file(const char *path, int print_absolute)
-{
-    char buf[PATH_MAX];
-
-    if(print_absolute) {
-        return run_test(path, path);
-    }
-
-    // We do the treewalk using absolute paths so that ../.. and friends
-    // don't mess us up and we don't walk off the end of a string.
-    // Need to convert back to relative before running the test.
-
-    if(!abs2rel(path, orig_cwd, buf, sizeof(buf))) {
-        fprintf(stderr, "Could not convert %s to relative from %s\n", path, orig_cwd);
-        exit(runtime_error);
-    }
-
-    return run_test(path, buf);
-}
-
-
-int is_file(const char *path)
-{
-    struct stat st;
-
-    if(stat(path, &st) < 0) {
-        fprintf(stderr, "Could not locate %s: %s\n", path, strerror(errno));
-        exit(runtime_error);
-    }
-
-    if(!i_have_permission(&st, 0444)) {
-        fprintf(stderr, "Could not open %s: permission denied!\n", path);
-        exit(runtime_error);
-    }
-
-    return S_ISREG(st.st_mode);
-}
-
-
-/** This routine filters out any dirents that begin with '.'.
- *  We don't want to process any hidden files or special directories.
- */
-
-static int select_nodots(const struct dirent *d)
-{
-    // common case: if the filename doesn't begin with a dot, use it.
-    if(d->d_name[0] != '.') {
-        return 1;
-    }
-
-    // otherwise, ignore it.
-    return 0;
-}
-
-
-void shift_down(char **entry)
-{
-    do {
-        entry[0] = entry[1];
-    } while(*entry++);
-}
-
-
-/** Runs all tests in the current directory and all its subdirectories.
- *  This routine operates on absolute paths and then converts back
- *  to relative so that paths are always normalized properly.
- */
-
-int process_directory(struct pathstack *ps, int print_absolute)
-{
-    int keepontruckin = 1;
-    char **entries, **entry;
-    struct pathstate save;
-
-    entries = qscandir(pathstack_absolute(ps), select_nodots, qdirentcoll);
-    if(!entries) {
-        // qscandir has already printed the error message
-        exit(runtime_error);
-    }
-
-    // first process files in dir
-    for(entry=entries; *entry && keepontruckin; ) {
-        if(pathstack_push(ps, *entry, &save) != 0) {
-            fprintf(stderr, "path too long: %s\n", *entry);
-            exit(runtime_error);
-        }
-        if(is_file(pathstack_absolute(ps))) {
-            keepontruckin = process_file(pathstack_absolute(ps), print_absolute);
-            free(*entry);
-            shift_down(entry);
-        } else {
-            entry += 1;
-        }
-        pathstack_pop(ps, &save);
-    }
-
-    // then process the subdirectories
-    for(entry=entries; *entry; entry++) {
-        if(keepontruckin) {
-            if(pathstack_push(ps, *entry, &save) != 0) {
-                fprintf(stderr, "path too long: %s\n", *entry);
-                exit(runtime_error);
-            }
-            keepontruckin = process_directory(ps, print_absolute);
-            pathstack_pop(ps, &save);
-        }
-        free(*entry);
-    }
-
-    free(entries);
-    return keepontruckin;
-}
-
-
-static int process_path(const char *path)
-{
-    char buf[PATH_MAX];
-    struct pathstack stack;
-    int print_absolute = 0;
-
-    if(is_dash(path)) {
-        return run_test(path, path);
-    }
-
-    if(path[0] == '/') {
-        print_absolute = 1;
-        if(pathstack_init(&stack, buf, sizeof(buf), path)) {
-            fprintf(stderr, "path too long: %s\n", path);
-            exit(runtime_error);
-        }
-    } else {
-        if(pathstack_init(&stack, buf, sizeof(buf), orig_cwd)) {
-            fprintf(stderr, "path too long: %s\n", orig_cwd);
-            exit(runtime_error);
-        }
-        pathstack_push(&stack, path, NULL);
-    }
-
-    // nasty hack to normalize the path
-    normalize_absolute_path(buf);
-    stack.curlen = strlen(buf);
-
-    if(is_file(buf)) {
-        // make sure user gets a reason if a test is explicitly named on the cmdline but not run
-        if(!valid_filename(path)) {
-            fprintf(stderr, "%s was skipped because it doesn't end in '.test'.\n", path);
-        }
-
-        return process_file(buf, print_absolute);
-    } else {
-        return process_directory(&stack, print_absolute);
-    }
-}
-
+/** Marks every fd we inherited (other than stdin, stdout, and stderr)
+ *  close-on-exec so it doesn't leak into the tests.
+ */
 
-static void checkerr(int err, const char *op, const char *name)
+static void cloexec_inherited_fds()
 {
-    if(err < 0) {
-        fprintf(stderr, "There was an error %s %s: %s\n",
-                op, name, strerror(errno));
-        // not much else we can do other than complain...
+    long fd, max;
+
+#ifdef CLOSE_RANGE_CLOEXEC
+    if(close_range(3, ~0U, CLOSE_RANGE_CLOEXEC) == 0) {
+        return;
+    }
+#endif
+
+    // the kernel is too old for close_range so do it the slow way.
+    max = sysconf(_SC_OPEN_MAX);
+    for(fd=3; fd < max; fd++) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
     }
 }
 
 
 static void stop_tests()
 {
-    gettimeofday(&test_stop_time, NULL);
+    runner_stop(&runner);
 
-    checkerr(close(g_outfd), "closing", g_outname);
-    checkerr(close(g_errfd), "closing", g_errname);
-    checkerr(close(g_statusfd), "closing", g_statusname);
+    if(runner.kept_count) {
+        fprintf(stderr, "Kept the testhome%s of %d failed test%s in %s\n",
+                (runner.kept_count != 1 ? "s" : ""), runner.kept_count,
+                (runner.kept_count != 1 ? "s" : ""), runner.testdir);
+    }
+}
 
-    checkerr(unlink(g_outname), "deleting", g_outname);
-    checkerr(unlink(g_errname), "deleting", g_errname);
-    checkerr(unlink(g_statusname), "deleting", g_statusname);
 
-    // the test already ensured this dir is empty
-    checkerr(rmdir(g_testhome), "deleting", g_testhome);
+/** Stops the tests and exits.  If a SIGINT is why they stopped,
+ *  that's the error we exit with.
+ */
 
-    checkerr(rmdir(g_testdir), "removing directory", g_testdir);
+static void stop_tests_and_exit(int err)
+{
+    stop_tests();
+    exit(runner.interrupted ? interrupted_error : err);
 }
 
 
 static void sig_int(int blah)
 {
-    stop_tests();
-    exit(interrupted_error);
+    // runner_stop isn't async-signal-safe.  The runner notices the
+    // flag, returns -1, and the main path kills the tests.
+    runner.interrupted = 1;
 }
 
 
-/** Prepare system for running tests.
- *
- * We do all I/O for all tests through only three file descriptors.
- * We seek to the beginning of each file before running each test.
- * This should save some inode thrashing.
+/** Installs sig_int without SA_RESTART so that a SIGINT breaks the
+ *  runner out of whatever it's waiting for.
  */
 
-static void start_tests()
+static void catch_sigint()
 {
-    signal(SIGPIPE, SIG_IGN);
-    signal(SIGINT, sig_int);
-
-    memcpy(g_testdir, TESTDIR, sizeof(g_testdir));
-    if(!mkdtemp(g_testdir)) {
-        fprintf(stderr, "Could not call mkdtemp() on %s: %s\n", g_testdir, strerror(errno));
-        exit(initialization_error);
-    }
-
-    // errors are handled by open_file.
-    g_outfd = open_file(g_outname, sizeof(g_outname), OUTNAME, 0);
-    assert(strlen(g_outname) == sizeof(g_outname)-1);
-    g_errfd = open_file(g_errname, sizeof(g_errname), ERRNAME, 0);
-    assert(strlen(g_errname) == sizeof(g_errname)-1);
-    g_statusfd = open_file(g_statusname, sizeof(g_statusname), STATUSNAME, O_APPEND);
-    assert(strlen(g_statusname) == sizeof(g_statusname)-1);
+    struct sigaction sa;
 
-    cat_path(g_testhome, g_testdir, TESTHOME, sizeof(g_testhome));
-
-    if(mkdir(g_testhome, 0700) < 0) {
-        fprintf(stderr, "couldn't create %s: %s\n", g_testhome, strerror(errno));
-        exit(initialization_error);
-    }
-
-    gettimeofday(&test_start_time, NULL);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sig_int;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
 }
 
 
@@ -937,10 +168,10 @@ static void set_config_file(const char *cfg)
         exit(argument_error);
     }
 
-    if(cfg[0] == '/') {
-        copy_string(buf, cfg, sizeof(buf));
-    } else {
-        cat_path(buf, orig_cwd, cfg, sizeof(buf));
+    if(snprintf(buf, sizeof(buf), "%s%s%s", (cfg[0] == '/' ? "" : orig_cwd),
+                (cfg[0] == '/' ? "" : "/"), cfg) >= sizeof(buf)) {
+        fprintf(stderr, "Path overflow!\n");
+        exit(argument_error);
     }
 
     normalize_absolute_path(buf);
@@ -948,13 +179,17 @@ static void set_config_file(const char *cfg)
     // need to ensure as well as we can that the file is readable because
     // we don't open it ourselves.  Bash does.  And that can lead to some
     // really cryptic error messages.
-    if(!is_file(buf)) {
-        fprintf(stderr, "Could not open %s: not a file!\n", buf);
-        exit(runtime_error);
+    switch(is_file(buf)) {
+        case -1:
+            // is_file has already printed the error message
+            exit(runtime_error);
+        case 0:
+            fprintf(stderr, "Could not open %s: not a file!\n", buf);
+            exit(runtime_error);
     }
 
-    config_file = strdup(buf);
-    if(!config_file) {
+    runner.test_opts.config_file = strdup(buf);
+    if(!runner.test_opts.config_file) {
         perror("strdup");
         exit(runtime_error);
     }
@@ -968,6 +203,21 @@ static void usage()
             "  -o: output the test file with the new output.\n"
             "  -d: output a diff between the expected and actual outputs.\n"
             "  -q --quiet: be quiet when running tests\n"
+            "  -j --jobs=N: run up to N tests at once\n"
+            "  --batch=N: run N tests, each in a subshell, per shell\n"
+            "  --daemon=PATH: run tests for clients that connect to PATH\n"
+            "  --dir-shell: read the config files once per directory\n"
+            "  --isolate: run each test in its own namespaces\n"
+            "  --grace=MS: wait MS for background processes to exit (1000)\n"
+            "  --keep-failed: don't delete the files failed tests leave behind\n"
+            "  --watch: rerun tests when they or their config files change\n"
+            "  --repeat=N: run each test N times\n"
+            "  --until-fail: stop repeating a test once it fails\n"
+            "  --perf-baseline=FILE: report tests slower than the timings in FILE\n"
+            "  --perf-threshold=PCT: percent slower before a test is reported (25)\n"
+            "  --perf-update: replace the timings in FILE with this run's\n"
+            "  --profile: print how long each phase of running the tests took\n"
+            "  --shell=PROG: run tests with PROG instead of " SHPROG "\n"
             "  -v --verbose: print more when running tests\n"
             "  -V --version: print the version of this program.\n"
             "  -h --help: prints this help text\n"
@@ -976,6 +226,39 @@ static void usage()
 }
 
 
+/** Parses the numeric argument to a command-line option.
+ *  Exits with an error if it's garbage or less than min.
+ */
+
+static int parse_count(const char *name, const char *arg, int min)
+{
+    char *end;
+    long val;
+
+    errno = 0;
+    val = strtol(arg, &end, 10);
+    if(errno || end == arg || *end || val < min || val > 0x7fffffff) {
+        fprintf(stderr, "--%s needs a number of at least %d, not '%s'.\n",
+                name, min, arg);
+        exit(argument_error);
+    }
+
+    return val;
+}
+
+
+// long options that don't have a single-character equivalent.
+enum {
+    opt_repeat = 256,
+    opt_perf_baseline,
+    opt_perf_threshold,
+    opt_shell,
+    opt_batch,
+    opt_grace,
+    opt_daemon,
+};
+
+
 static void process_args(int argc, char **argv)
 {
     char buf[256], *cp;
@@ -984,16 +267,31 @@ static void process_args(int argc, char **argv)
     optidx = 0;
     static struct option longopts[] = {
         // name, has_arg (1=reqd,2=opt), flag, val
-        {"ignore-extension", 0, &allfiles, 1},
+        {"ignore-extension", 0, &runner.allfiles, 1},
+        {"batch", 1, 0, opt_batch},
         {"config", 1, 0, 'c'},
+        {"daemon", 1, 0, opt_daemon},
         {"diff", 0, 0, 'd'},
-        {"dump-script", 0, &dumpscript, 1},
+        {"dir-shell", 0, &runner.dir_shell, 1},
+        {"dump-script", 0, &runner.dumpscript, 1},
         {"failures-only", 0, 0, 'f'},
+        {"grace", 1, 0, opt_grace},
         {"help", 0, 0, 'h'},
+        {"isolate", 0, &runner.isolate, 1},
+        {"jobs", 1, 0, 'j'},
+        {"keep-failed", 0, &runner.keep_failed, 1},
         {"output", 0, 0, 'o'},
+        {"perf-baseline", 1, 0, opt_perf_baseline},
+        {"perf-threshold", 1, 0, opt_perf_threshold},
+        {"perf-update", 0, &perf_update, 1},
+        {"profile", 0, &profile, 1},
         {"quiet", 0, 0, 'q'},
+        {"repeat", 1, 0, opt_repeat},
+        {"shell", 1, 0, opt_shell},
+        {"until-fail", 0, &runner.until_fail, 1},
         {"verbose", 0, 0, 'v'},
         {"version", 0, 0, 'V'},
+        {"watch", 0, &watch, 1},
         {0, 0, 0, 0},
     };
 
@@ -1001,7 +299,7 @@ static void process_args(int argc, char **argv)
     // options.  Why oh why doesn't glibc do this for us???
     cp = buf;
     for(i=0; longopts[i].name; i++) {
-        if(!longopts[i].flag) {
+        if(!longopts[i].flag && longopts[i].val < 256) {
             *cp++ = longopts[i].val;
             if(longopts[i].has_arg > 0) *cp++ = ':';
             if(longopts[i].has_arg > 1) *cp++ = ':';
@@ -1019,29 +317,70 @@ static void process_args(int argc, char **argv)
                 break;
 
             case 'd':
-                outmode = outmode_diff;
+                runner.outmode = outmode_diff;
                 break;
 
             case 'h':
                 usage();
                 exit(0);
 
+            case 'j':
+                runner.jobs = parse_count("jobs", optarg, 1);
+                break;
+
             case 'o':
-                outmode = outmode_dump;
+                runner.outmode = outmode_dump;
                 break;
 
             case 'q':
-                quiet++;
+                runner.test_opts.quiet++;
                 break;
 
             case 'v':
-                verbose++;
+                runner.test_opts.verbose++;
                 break;
 
             case 'V':
                 printf("tmtest version %s\n", stringify(VERSION));
                 exit(0);
 
+            case opt_repeat:
+                runner.repeat_count = parse_count("repeat", optarg, 1);
+                repeat_given = 1;
+                break;
+
+            case opt_perf_baseline:
+                perf_baseline = optarg;
+                break;
+
+            case opt_perf_threshold:
+                perf_threshold = parse_count("perf-threshold", optarg, 0);
+                break;
+
+            case opt_batch:
+                runner.batch_size = parse_count("batch", optarg, 1);
+                break;
+
+            case opt_daemon:
+                if(!optarg[0]) {
+                    fprintf(stderr, "--daemon needs the path of a socket\n");
+                    exit(argument_error);
+                }
+                daemon_path = optarg;
+                break;
+
+            case opt_grace:
+                runner.grace = parse_count("grace", optarg, 0);
+                break;
+
+            case opt_shell:
+                if(!optarg[0]) {
+                    fprintf(stderr, "--shell needs the name of a shell\n");
+                    exit(argument_error);
+                }
+                runner.shell_prog = optarg;
+                break;
+
             case '?':
                 // getopt_long already printed the error message
                 exit(argument_error);
@@ -1072,41 +411,520 @@ static const char* dup_cwd()
 }
 
 
-void start_treewalk()
+/** Watches dir and the config files above it that affect its tests.
+ *  The dirs above are left alone; they can be huge and busy.
+ */
+
+static void watch_dir_and_configs(const char *dir)
 {
+    static char lastdir[PATH_MAX];
     char buf[PATH_MAX];
-    struct pathstack pathstack;
+    char *cp;
+
+    // tests are run directory by directory.
+    if(strcmp(dir, lastdir) == 0) {
+        return;
+    }
+    snprintf(lastdir, sizeof(lastdir), "%s", dir);
+
+    watch_dir(dir);
+    snprintf(buf, sizeof(buf), "%s", dir);
+    while((cp = strrchr(buf, '/'))) {
+        cp[1] = '\0';
+        if(strlen(buf) + strlen(CONFIG_FILE) < sizeof(buf)) {
+            strcat(buf, CONFIG_FILE);
+            if(file_exists(buf)) {
+                watch_file(buf);
+            }
+        }
+        *cp = '\0';
+    }
+}
+
+
+static struct watched_test* remember_test(const char *abspath, const char *relpath)
+{
+    struct watched_test *grow;
+    char dir[PATH_MAX];
+
+    grow = realloc(watched_tests, (nwatched_tests + 1) * sizeof(struct watched_test));
+    if(!grow) {
+        perror("allocating watched tests");
+        exit(runtime_error);
+    }
+    watched_tests = grow;
+    grow[nwatched_tests].abspath = strdup(abspath);
+    grow[nwatched_tests].relpath = strdup(relpath);
+    grow[nwatched_tests].dirty = 0;
+    if(!grow[nwatched_tests].abspath || !grow[nwatched_tests].relpath) {
+        perror("strdup");
+        exit(runtime_error);
+    }
+    nwatched_tests += 1;
+
+    snprintf(dir, sizeof(dir), "%s", abspath);
+    *strrchr(dir, '/') = '\0';
+    watch_dir_and_configs(dir);
+
+    return &grow[nwatched_tests-1];
+}
+
+
+/** The runner calls this with every testfile it finds.
+ */
+
+static void found_test(struct runner *r, const char *abspath, const char *relpath)
+{
+    int i;
+
+    // a dir that was moved away and back again is searched again.
+    for(i=0; i<nwatched_tests; i++) {
+        if(strcmp(watched_tests[i].abspath, abspath) == 0) {
+            return;
+        }
+    }
+
+    remember_test(abspath, relpath);
+}
+
+
+/** The runner calls this with every directory it searches.
+ */
+
+static void found_dir(struct runner *r, const char *path, int print_absolute)
+{
+    struct watched_dir *grow;
+    int i;
+
+    for(i=0; i<nwatched_dirs; i++) {
+        if(strcmp(watched_dirs[i].path, path) == 0) {
+            // it was recreated so it needs a new watch.
+            watch_dir(path);
+            return;
+        }
+    }
+
+    grow = realloc(watched_dirs, (nwatched_dirs + 1) * sizeof(struct watched_dir));
+    if(!grow) {
+        perror("allocating watched dirs");
+        exit(runtime_error);
+    }
+    watched_dirs = grow;
+    grow[nwatched_dirs].path = strdup(path);
+    grow[nwatched_dirs].print_absolute = print_absolute;
+    if(!grow[nwatched_dirs].path) {
+        perror("strdup");
+        exit(runtime_error);
+    }
+    nwatched_dirs += 1;
+
+    watch_dir_and_configs(path);
+}
+
+
+/** Returns true if path is in dir or one of its subdirectories.
+ */
+
+static int is_below(const char *path, const char *dir, int dirlen)
+{
+    return strncmp(path, dir, dirlen) == 0 && (path[dirlen] == '/' ||
+            (dirlen > 0 && dir[dirlen-1] == '/'));
+}
+
+
+/** Remembers a new subdir of a dir that was searched so its tests can
+ *  be run.  The runner watches it when it searches it.
+ */
+
+static void remember_new_dir(const char *path, int print_absolute)
+{
+    struct watched_dir *grow;
+    int i;
+
+    for(i=0; i<nnew_dirs; i++) {
+        if(strcmp(new_dirs[i].path, path) == 0) {
+            return;
+        }
+    }
 
-    if(pathstack_init(&pathstack, buf, sizeof(buf), orig_cwd)) {
-        fprintf(stderr, "path too long: %s\n", orig_cwd);
+    grow = realloc(new_dirs, (nnew_dirs + 1) * sizeof(struct watched_dir));
+    if(!grow) {
+        perror("allocating new dirs");
+        exit(runtime_error);
+    }
+    new_dirs = grow;
+    grow[nnew_dirs].path = strdup(path);
+    grow[nnew_dirs].print_absolute = print_absolute;
+    if(!grow[nnew_dirs].path) {
+        perror("strdup");
         exit(runtime_error);
     }
+    nnew_dirs += 1;
+}
+
+
+/** Marks the tests that need to be run again because path changed.
+ *  The --config file affects every test, a config file affects every
+ *  test below it, tmtest.setup affects every test in its dir, and a
+ *  testfile only affects itself.  If path is a new testfile or subdir
+ *  in one of the dirs that were searched, it's added.
+ */
+
+static void mark_changed(const char *path)
+{
+    const char *name = strrchr(path, '/') + 1;
+    int dirlen = name - path - 1;
+    struct watched_test *wt;
+    const char *relpath;
+    char buf[PATH_MAX];
+    struct stat st;
+    int i, found = 0;
+
+    if(runner.test_opts.config_file &&
+            strcmp(path, runner.test_opts.config_file) == 0) {
+        for(i=0; i<nwatched_tests; i++) {
+            watched_tests[i].dirty = 1;
+        }
+        return;
+    }
+
+    for(i=0; i<nwatched_tests; i++) {
+        if(strcmp(name, CONFIG_FILE) == 0) {
+            found = is_below(watched_tests[i].abspath, path, dirlen);
+        } else if(strcmp(name, SETUP_FILE) == 0) {
+            found = is_below(watched_tests[i].abspath, path, dirlen) &&
+                strchr(watched_tests[i].abspath + dirlen + 1, '/') == NULL;
+        } else {
+            found = (strcmp(watched_tests[i].abspath, path) == 0);
+        }
+        if(found) {
+            watched_tests[i].dirty = 1;
+        }
+    }
+
+    if(strcmp(name, CONFIG_FILE) == 0 || strcmp(name, SETUP_FILE) == 0) {
+        return;
+    }
+    for(i=0; i<nwatched_tests; i++) {
+        if(strcmp(watched_tests[i].abspath, path) == 0) {
+            return;
+        }
+    }
+
+    // a new testfile or subdir?
+    for(i=0; i<nwatched_dirs; i++) {
+        if(strlen(watched_dirs[i].path) == dirlen &&
+                strncmp(watched_dirs[i].path, path, dirlen) == 0) {
+            if(name[0] != '.' && lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+                remember_new_dir(path, watched_dirs[i].print_absolute);
+            } else if(valid_filename(&runner, path) && file_exists((char*)path)) {
+                relpath = runner_display_name(&runner, path,
+                        watched_dirs[i].print_absolute, buf, sizeof(buf));
+                if(relpath) {
+                    wt = remember_test(path, relpath);
+                    wt->dirty = 1;
+                }
+            }
+            return;
+        }
+    }
+}
+
+
+/** Runs the tests that were marked by mark_changed().  Tests whose
+ *  testfiles have disappeared are forgotten.
+ *
+ *  @returns the number of tests that were run, or -1 if there was
+ *  an error.
+ */
+
+static int rerun_changed_tests()
+{
+    struct watched_test *wt;
+    int count = 0;
+    int i, result;
+
+    for(i=0; i<nwatched_tests && !runner.stop_testing; i++) {
+        wt = &watched_tests[i];
+        if(!wt->dirty) {
+            continue;
+        }
+        wt->dirty = 0;
+
+        if(!file_exists(wt->abspath)) {
+            free(wt->abspath);
+            free(wt->relpath);
+            nwatched_tests -= 1;
+            memmove(wt, wt+1, (nwatched_tests - i) * sizeof(struct watched_test));
+            i -= 1;
+            continue;
+        }
+        count += 1;
+        result = runner_run_test(&runner, wt->abspath, wt->relpath);
+        if(result < 0) {
+            return -1;
+        }
+        if(!result) {
+            break;
+        }
+    }
+
+    return count;
+}
+
+
+/** Searches the dirs that were found by mark_changed() and runs the
+ *  tests in them.
+ *
+ *  @returns the number of dirs that were searched, or -1 if there was
+ *  an error.
+ */
+
+static int run_new_dirs()
+{
+    const char *path;
+    char buf[PATH_MAX];
+    struct stat st;
+    int count = 0;
+    int i, result = 1;
+
+    for(i=0; i<nnew_dirs; i++) {
+        if(result > 0 && !runner.stop_testing) {
+            path = runner_display_name(&runner, new_dirs[i].path,
+                    new_dirs[i].print_absolute, buf, sizeof(buf));
+            // it may have been removed again already.
+            if(path && stat(new_dirs[i].path, &st) == 0 && S_ISDIR(st.st_mode)) {
+                count += 1;
+                result = runner_run_path(&runner, path);
+            }
+        }
+        free(new_dirs[i].path);
+    }
+    nnew_dirs = 0;
+
+    return (result < 0 ? -1 : count);
+}
+
+
+/** Waits for testfiles and config files to change and reruns the
+ *  tests they affect.  Runs until interrupted.
+ */
+
+static void watch_tests()
+{
+    char **changed;
+    int overflow;
+    int i, count;
+
+    for(;;) {
+        changed = watch_changes(&overflow);
+        if(runner.interrupted) {
+            watch_free(changed);
+            stop_tests_and_exit(interrupted_error);
+        }
+
+        // if inotify lost track, who knows what changed.
+        for(i=0; i<nwatched_tests; i++) {
+            watched_tests[i].dirty = overflow;
+        }
+        for(i=0; changed && changed[i]; i++) {
+            mark_changed(changed[i]);
+        }
+        watch_free(changed);
+
+        // tmtest.setup and the config files may have changed.
+        runner_new_round(&runner);
+        forget_config_files(runner.test_opts.configs);
+        rusage_mark();
+
+        count = rerun_changed_tests();
+        if(count >= 0) {
+            i = run_new_dirs();
+            count = (i < 0 ? -1 : count + i);
+        }
+        if(count < 0 || (count && runner_finish(&runner) < 0)) {
+            stop_tests_and_exit(runtime_error);
+        }
+        // a new dir may not have had any tests in it.
+        if(runner.counts.runs) {
+            gettimeofday(&runner.stop_time, NULL);
+            print_test_summary(&runner.counts, runner.test_opts.quiet, &runner.start_time, &runner.stop_time);
+            fflush(stdout);
+        }
+    }
+}
+
+
+static int run_tmtest(int argc, char **argv);
+
+
+/** Runs a request for the daemon.  We're in a fresh child with the
+ *  client's fds, cwd, and environment.
+ */
+
+static int daemon_run(int argc, char **argv)
+{
+    daemon_path = NULL;
+    // make getopt start over.
+    optind = 0;
+    return run_tmtest(argc, argv);
+}
+
+
+/** Returns true if the arguments ask us to be the daemon.
+ */
+
+static int wants_daemon(int argc, char **argv)
+{
+    int i;
+
+    for(i=1; i<argc; i++) {
+        if(strncmp(argv[i], "--daemon", 8) == 0) {
+            return 1;
+        }
+    }
 
-    process_directory(&pathstack, 0);
+    return 0;
 }
 
 
 int main(int argc, char **argv)
 {
+    const char *sock = getenv(SOCKET_ENV);
+    int status;
+
+    // if there's a daemon, let it do the work.
+    if(sock && sock[0] && !wants_daemon(argc, argv)) {
+        status = daemon_request(sock, argc, argv);
+        if(status == DAEMON_LOST) {
+            exit(runtime_error);
+        }
+        if(status >= 0) {
+            exit(status);
+        }
+        // nobody's listening so run the tests ourselves.
+    }
+
+    // the daemon's options are the defaults for its requests so this
+    // only happens once.
+    runner_init(&runner);
+    return run_tmtest(argc, argv);
+}
+
+
+static int run_tmtest(int argc, char **argv)
+{
+    int result = 1;
+
     orig_cwd = dup_cwd();
+    cloexec_inherited_fds();
+
+    // we deliberately ignore $SHELL, it's the user's interactive shell.
+    if(getenv("TM_SHELL") && getenv("TM_SHELL")[0]) {
+        runner.shell_prog = getenv("TM_SHELL");
+    }
     process_args(argc, argv);
     argv += optind;
 
-    start_tests();
+    if(daemon_path) {
+        daemon_serve(daemon_path, daemon_run);
+        // daemon_serve has already printed the error message
+        exit(initialization_error);
+    }
+
+    if(runner.outmode != outmode_test) {
+        // rewriting the same testfile more than once makes no sense.
+        runner.repeat_count = 1;
+        runner.until_fail = 0;
+    } else if(runner.until_fail && !repeat_given) {
+        // keep going until the test fails.
+        runner.repeat_count = 0;
+    }
+
+    if(runner.isolate && runner.outmode != outmode_test) {
+        // the files for FILE sections never leave the test's namespace.
+        fprintf(stderr, "--isolate can't be used with -d or -o.\n");
+        exit(argument_error);
+    }
+    if(watch && (runner.outmode != outmode_test || runner.dumpscript)) {
+        fprintf(stderr, "--watch can't be used when rewriting or dumping tests.\n");
+        exit(argument_error);
+    }
+    if(watch) {
+        if(watch_init() < 0) {
+            // watch_init has already printed the error message
+            exit(initialization_error);
+        }
+        runner.found_test = found_test;
+        runner.found_dir = found_dir;
+        if(runner.test_opts.config_file) {
+            // it may be outside the tree.
+            watch_file(runner.test_opts.config_file);
+        }
+    }
+
+    if(perf_baseline && perf_load(&runner.perf, perf_baseline) < 0) {
+        exit(runtime_error);
+    }
+    runner.record_perf = (perf_baseline != NULL);
+    if(profile) {
+        prof_enable(&runner.prof);
+    }
+
+    runner.orig_cwd = orig_cwd;
+    catch_sigint();
+    signal(SIGPIPE, SIG_IGN);
+#ifdef PR_SET_CHILD_SUBREAPER
+    // anything a test leaves running is reparented to us rather than
+    // init so the runner can wait for it.
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+#endif
+    if(runner_start(&runner) < 0) {
+        // runner_start has already printed the error message
+        stop_tests_and_exit(initialization_error);
+    }
+
     if(optind < argc) {
-        for(; *argv; argv++) {
-            if(!process_path(*argv)) break;
+        for(; *argv && result > 0; argv++) {
+            result = runner_run_path(&runner, *argv);
         }
     } else {
-        start_treewalk();
+        result = runner_run_tree(&runner);
+    }
+    if(result < 0 || runner_finish(&runner) < 0) {
+        // the error message has already been printed
+        stop_tests_and_exit(runtime_error);
     }
+
+    if(watch) {
+        gettimeofday(&runner.stop_time, NULL);
+        print_test_summary(&runner.counts, runner.test_opts.quiet, &runner.start_time, &runner.stop_time);
+        fflush(stdout);
+        watch_tests();
+    }
+
     stop_tests();
+    if(runner.interrupted) {
+        exit(interrupted_error);
+    }
 
-    if(outmode == outmode_test) {
-        print_test_summary(&test_start_time, &test_stop_time);
+    if(runner.outmode == outmode_test) {
+        print_test_summary(&runner.counts, runner.test_opts.quiet, &runner.start_time, &runner.stop_time);
+        if(runner.repeat_count != 1) {
+            perf_print_repeats(&runner.perf, runner.test_opts.verbose);
+        }
+        if(perf_baseline) {
+            perf_print_report(&runner.perf, perf_baseline, perf_threshold);
+            perf_save(&runner.perf, perf_baseline, perf_update);
+        }
     }
 
+    // stdout may be holding a rewritten testfile so use stderr.
+    fflush(stdout);
+    prof_print(&runner.prof, stderr, (runner.stop_time.tv_sec - runner.start_time.tv_sec) +
+            (runner.stop_time.tv_usec - runner.start_time.tv_usec) / 1000000.0);
+
+    perf_free(&runner.perf);
     free((char*)orig_cwd);
-    return test_get_exit_value();
+    return test_get_exit_value(&runner.counts);
 }
-
@@ -0,0 +1,435 @@
+/* perf.c
+ * 18 Oct 2026
+ *
+ * Remembers how long each test took so that a run can be compared
+ * against the timings of a previous run.
+ *
+ * This file is covered by the MIT License.
+ *
+ * Like rusage.c, this file is split off from test.c because it makes
+ * some fairly non-portable calls.
+ */
+
+/** @file perf.c
+ *
+ * The baseline file is plain text, one test per line:
+ *
+ *     wall cpu runs testname
+ *
+ * wall and cpu are the median number of seconds the test took, runs
+ * tells how many samples the median was taken from.  The test name
+ * comes last so that it may contain spaces.  Lines starting with '#'
+ * are ignored.
+ *
+ * Tiny tests are noisy so a test is only flagged as a regression if
+ * its median time grew by more than the threshold percentage AND by
+ * more than PERF_MIN_DELTA seconds.  Use --repeat to take the median
+ * of several runs when the noise is still too high.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "perf.h"
+
+
+// changes smaller than this are considered to be noise
+#define PERF_MIN_DELTA 0.010
+
+
+struct perf_entry {
+    char *name;
+    struct perf_entry *next;    ///< next entry in this hash bucket
+
+    double base_wall;           ///< median wall time from the baseline, -1 if none
+    double base_cpu;            ///< median cpu time from the baseline
+    int base_runs;              ///< number of samples the baseline was taken from
+
+    double *wall;               ///< wall times recorded during this run
+    double *cpu;                ///< cpu times recorded during this run
+    int nsamples;
+    int maxsamples;
+    int failures;               ///< number of the samples where the test failed
+};
+
+
+/** Frees everything that was recorded or loaded, leaving perf empty
+ *  and ready to be used again.
+ */
+
+void perf_free(struct perf *perf)
+{
+    struct perf_entry *ent;
+    int i;
+
+    for(i=0; i<perf->count; i++) {
+        ent = perf->list[i];
+        free(ent->name);
+        free(ent->wall);
+        free(ent->cpu);
+        free(ent);
+    }
+    free(perf->list);
+    memset(perf, 0, sizeof(*perf));
+}
+
+
+static double tv2sec(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+
+void perf_start(struct perf_sample *sample)
+{
+    gettimeofday(&sample->start, NULL);
+    sample->wall = 0.0;
+    sample->cpu = 0.0;
+}
+
+
+/** Call this as soon as the test's shell has been reaped.
+ *
+ *  @param ru the resources used by the shell, as returned by wait4(2).
+ *    Only this test's shell is counted so timings stay accurate even
+ *    when several tests are running at once.
+ */
+
+void perf_stop(struct perf_sample *sample, const struct rusage *ru)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    sample->wall = tv2sec(&now) - tv2sec(&sample->start);
+    if(ru) {
+        sample->cpu = tv2sec(&ru->ru_utime) + tv2sec(&ru->ru_stime);
+    }
+}
+
+
+static unsigned int hash_name(const char *name)
+{
+    unsigned int h = 5381;
+
+    while(*name) {
+        h = h * 33 + (unsigned char)*name++;
+    }
+
+    return h % PERF_HASH_SIZE;
+}
+
+
+static struct perf_entry* find_entry(struct perf *perf, const char *name, int create)
+{
+    struct perf_entry *ent;
+    unsigned int h = hash_name(name);
+
+    for(ent=perf->hash[h]; ent; ent=ent->next) {
+        if(strcmp(ent->name, name) == 0) {
+            return ent;
+        }
+    }
+
+    if(!create) {
+        return NULL;
+    }
+
+    if(perf->count >= perf->max) {
+        struct perf_entry **list;
+        int max = perf->max ? perf->max * 2 : 64;
+        list = realloc(perf->list, max * sizeof(*list));
+        if(!list) {
+            return NULL;
+        }
+        perf->list = list;
+        perf->max = max;
+    }
+
+    ent = calloc(1, sizeof(*ent));
+    if(!ent) {
+        return NULL;
+    }
+    ent->name = strdup(name);
+    if(!ent->name) {
+        free(ent);
+        return NULL;
+    }
+    ent->base_wall = -1.0;
+    ent->base_cpu = -1.0;
+
+    ent->next = perf->hash[h];
+    perf->hash[h] = ent;
+    perf->list[perf->count++] = ent;
+
+    return ent;
+}
+
+
+/** Adds the sample to the timings collected for the named test.
+ *  Failure to allocate memory just means the sample is dropped.
+ *
+ *  @param failed true if this run of the test failed.
+ */
+
+void perf_record(struct perf *perf, const char *testname, const struct perf_sample *sample, int failed)
+{
+    struct perf_entry *ent;
+
+    ent = find_entry(perf, testname, 1);
+    if(!ent) {
+        return;
+    }
+
+    if(ent->nsamples >= ent->maxsamples) {
+        int max = ent->maxsamples ? ent->maxsamples * 2 : 4;
+        double *wall = realloc(ent->wall, max * sizeof(double));
+        double *cpu;
+        if(!wall) {
+            return;
+        }
+        ent->wall = wall;
+        cpu = realloc(ent->cpu, max * sizeof(double));
+        if(!cpu) {
+            return;
+        }
+        ent->cpu = cpu;
+        ent->maxsamples = max;
+    }
+
+    ent->wall[ent->nsamples] = sample->wall;
+    ent->cpu[ent->nsamples] = sample->cpu;
+    ent->nsamples += 1;
+    ent->failures += (failed != 0);
+}
+
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+/** Returns the median of the samples.  Reorders them.
+ */
+
+static double median(double *vals, int cnt)
+{
+    qsort(vals, cnt, sizeof(double), cmp_double);
+    if(cnt & 1) {
+        return vals[cnt/2];
+    }
+    return (vals[cnt/2-1] + vals[cnt/2]) / 2.0;
+}
+
+
+/** Reads the given baseline file.  It's not an error if the file
+ *  doesn't exist yet, it just means there's nothing to compare against.
+ *
+ *  @returns 0 on success, -1 if the file couldn't be read (the error
+ *  has already been printed).
+ */
+
+int perf_load(struct perf *perf, const char *filename)
+{
+    char line[BUFSIZ];
+    struct perf_entry *ent;
+    double wall, cpu;
+    int runs, pos, lineno = 0;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if(!fp) {
+        if(errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "Could not open %s: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), fp)) {
+        lineno += 1;
+        line[strcspn(line, "\n")] = '\0';
+        if(line[0] == '#' || line[0] == '\0') {
+            continue;
+        }
+
+        if(sscanf(line, "%lf %lf %d %n", &wall, &cpu, &runs, &pos) < 3 || !line[pos]) {
+            fprintf(stderr, "%s line %d: garbage in performance baseline.  Ignored.\n",
+                    filename, lineno);
+            continue;
+        }
+
+        ent = find_entry(perf, line+pos, 1);
+        if(ent) {
+            ent->base_wall = wall;
+            ent->base_cpu = cpu;
+            ent->base_runs = runs;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+
+/** Writes the baseline back out.  Tests that weren't in the baseline
+ *  are always added.  Tests that were already in the baseline are only
+ *  replaced with the latest timings if update is true, otherwise
+ *  a regression would silently become the new baseline.
+ *
+ *  The file is written to a tempfile and renamed into place so an
+ *  interrupted run can't destroy the baseline.
+ *
+ *  @returns 0 on success, -1 on error (the error has already been printed).
+ */
+
+int perf_save(struct perf *perf, const char *filename, int update)
+{
+    char tmpname[PATH_MAX];
+    struct perf_entry *ent;
+    FILE *fp;
+    int i;
+
+    if(snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename) >= sizeof(tmpname)) {
+        fprintf(stderr, "path too long: %s\n", filename);
+        return -1;
+    }
+
+    fp = fopen(tmpname, "w");
+    if(!fp) {
+        fprintf(stderr, "Could not create %s: %s\n", tmpname, strerror(errno));
+        return -1;
+    }
+
+    fprintf(fp, "# tmtest performance baseline\n");
+    fprintf(fp, "# wall cpu runs testname\n");
+    for(i=0; i<perf->count; i++) {
+        ent = perf->list[i];
+        if(ent->nsamples && (update || ent->base_wall < 0)) {
+            fprintf(fp, "%.4f %.4f %d %s\n", median(ent->wall, ent->nsamples),
+                    median(ent->cpu, ent->nsamples), ent->nsamples, ent->name);
+        } else if(ent->base_wall >= 0) {
+            fprintf(fp, "%.4f %.4f %d %s\n", ent->base_wall,
+                    ent->base_cpu, ent->base_runs, ent->name);
+        }
+    }
+
+    if(fclose(fp) != 0) {
+        fprintf(stderr, "Could not write %s: %s\n", tmpname, strerror(errno));
+        unlink(tmpname);
+        return -1;
+    }
+
+    if(rename(tmpname, filename) < 0) {
+        fprintf(stderr, "Could not rename %s to %s: %s\n",
+                tmpname, filename, strerror(errno));
+        unlink(tmpname);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int regressed(double base, double now, int threshold)
+{
+    return base >= 0 && now - base > PERF_MIN_DELTA &&
+        now > base * (100 + threshold) / 100.0;
+}
+
+
+/** Prints every test whose median time grew more than threshold
+ *  percent over its baseline.  Meant to be printed right after the
+ *  test summary.
+ *
+ *  @returns the number of regressions found.
+ */
+
+int perf_print_report(struct perf *perf, const char *filename, int threshold)
+{
+    struct perf_entry *ent;
+    double wall, cpu;
+    int count = 0;
+    int i;
+
+    for(i=0; i<perf->count; i++) {
+        ent = perf->list[i];
+        if(!ent->nsamples) {
+            continue;
+        }
+
+        wall = median(ent->wall, ent->nsamples);
+        cpu = median(ent->cpu, ent->nsamples);
+        if(!regressed(ent->base_wall, wall, threshold) &&
+                !regressed(ent->base_cpu, cpu, threshold)) {
+            continue;
+        }
+
+        if(count++ == 0) {
+            printf("\nPerformance regressions (more than %d%% slower than %s):\n",
+                    threshold, filename);
+        }
+        printf("SLOW %-25s %.3fs -> %.3fs wall, %.3fs -> %.3fs cpu",
+                ent->name, ent->base_wall, wall, ent->base_cpu, cpu);
+        if(ent->nsamples > 1) {
+            printf(" (median of %d)", ent->nsamples);
+        }
+        printf("\n");
+    }
+
+    printf("%d performance regression%s.\n", count, (count != 1 ? "s" : ""));
+    return count;
+}
+
+
+/** Prints how the runs of each repeated test went.  A test that
+ *  passed some runs and failed others is flaky.  Unless verbose is
+ *  set, only the flaky tests are listed.
+ *
+ *  @returns the number of flaky tests.
+ */
+
+int perf_print_repeats(struct perf *perf, int verbose)
+{
+    struct perf_entry *ent;
+    int count = 0;
+    int header = 0;
+    int flaky;
+    double med;
+    int i;
+
+    for(i=0; i<perf->count; i++) {
+        ent = perf->list[i];
+        if(ent->nsamples < 2) {
+            continue;
+        }
+
+        flaky = ent->failures && ent->failures < ent->nsamples;
+        count += flaky;
+        if(!flaky && !verbose) {
+            continue;
+        }
+
+        if(!header++) {
+            printf("\nRepeated tests (wall seconds min/median/max):\n");
+        }
+
+        // median sorts the samples so the min and max are at the ends.
+        med = median(ent->wall, ent->nsamples);
+        printf("%s %-25s %d of %d failed, %.3f/%.3f/%.3f\n",
+                (flaky ? "FLKY" : (ent->failures ? "FAIL" : "ok  ")),
+                ent->name, ent->failures, ent->nsamples,
+                ent->wall[0], med, ent->wall[ent->nsamples-1]);
+    }
+
+    printf("%d flaky test%s.\n", count, (count != 1 ? "s" : ""));
+    return count;
+}
@@ -0,0 +1,51 @@
+/* perf.h
+ * 18 Oct 2026
+ *
+ * Remembers how long each test took so that a run can be compared
+ * against the timings of a previous run.  See perf.c.
+ * This file is covered by the MIT License.
+ */
+
+#include <sys/time.h>
+
+struct rusage;
+struct perf_entry;
+
+
+#define PERF_HASH_SIZE 1024
+
+/** The timings collected for every test, along with the baseline
+ *  they're compared against.  Zero it before use and release it
+ *  with perf_free().
+ */
+
+struct perf {
+    struct perf_entry *hash[PERF_HASH_SIZE];
+    // all entries in the order that they were first seen so the saved
+    // baseline keeps the same order as the tests are run.
+    struct perf_entry **list;
+    int count;
+    int max;
+};
+
+
+/** Brackets a single run of a test.  Call perf_start() just before
+ *  the shell is forked and perf_stop() just after it has been reaped.
+ */
+
+struct perf_sample {
+    struct timeval start;   ///< wall clock time when the test was started
+    double wall;            ///< seconds the test took (valid after perf_stop)
+    double cpu;             ///< user+sys seconds the test took (valid after perf_stop)
+};
+
+
+void perf_start(struct perf_sample *sample);
+void perf_stop(struct perf_sample *sample, const struct rusage *ru);
+void perf_record(struct perf *perf, const char *testname, const struct perf_sample *sample, int failed);
+
+int perf_load(struct perf *perf, const char *filename);
+int perf_save(struct perf *perf, const char *filename, int update);
+int perf_print_report(struct perf *perf, const char *filename, int threshold);
+int perf_print_repeats(struct perf *perf, int verbose);
+void perf_free(struct perf *perf);
@@ -0,0 +1,148 @@
+/* prof.c
+ * 18 Oct 2026
+ *
+ * Times the phases that tmtest goes through to run each test.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file prof.c
+ *
+ * Every phase keeps a histogram of how long it took, one bucket per
+ * power of two microseconds, so percentiles can be printed without
+ * keeping every sample.  The percentiles are the upper bound of the
+ * bucket that they fall into so they're accurate to within a factor
+ * of two.
+ *
+ * When profiling is off, prof_start() and prof_stop() return
+ * immediately without reading the clock.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "prof.h"
+
+
+static const char *phase_names[prof_nphases] = {
+    "discovery",
+    "verify",
+    "fork",
+    "template",
+    "wait",
+    "status",
+    "testhome",
+    "results",
+    "settle",
+};
+
+
+void prof_enable(struct prof *prof)
+{
+    prof->enabled = 1;
+}
+
+
+/** Returns the current time, to be handed to prof_stop() when the
+ *  phase is over.
+ */
+
+double prof_start(const struct prof *prof)
+{
+    struct timespec ts;
+
+    if(!prof->enabled) {
+        return 0.0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+void prof_stop(struct prof *prof, enum prof_phase phase, double start)
+{
+    struct prof_stats *st = &prof->stats[phase];
+    double secs;
+    long usec;
+    int i;
+
+    if(!prof->enabled) {
+        return;
+    }
+
+    secs = prof_start(prof) - start;
+    st->count += 1;
+    st->total += secs;
+    if(secs > st->max) {
+        st->max = secs;
+    }
+
+    usec = (long)(secs * 1000000.0);
+    for(i=0; i < PROF_BUCKETS-1 && usec >= (1L << i); i++)
+        ;
+    st->buckets[i] += 1;
+}
+
+
+/** Returns the upper bound, in seconds, of the bucket containing the
+ *  given percentile.
+ */
+
+static double percentile(const struct prof_stats *st, int pct)
+{
+    long want = (st->count * pct + 99) / 100;
+    long seen = 0;
+    int i;
+
+    for(i=0; i<PROF_BUCKETS-1; i++) {
+        seen += st->buckets[i];
+        if(seen >= want) {
+            break;
+        }
+    }
+
+    if(i == PROF_BUCKETS-1 || (1L << i) / 1000000.0 > st->max) {
+        return st->max;
+    }
+    return (1L << i) / 1000000.0;
+}
+
+
+/** Prints the time spent in each phase.
+ *
+ *  @param wall the total number of seconds spent running tests.
+ *    Whatever wasn't spent in a phase is printed as "other".
+ */
+
+void prof_print(const struct prof *prof, FILE *fp, double wall)
+{
+    const struct prof_stats *st;
+    double accounted = 0.0;
+    int i;
+
+    if(!prof->enabled) {
+        return;
+    }
+
+    fprintf(fp, "\nProfile (p50/p90 are accurate to a factor of 2):\n");
+    fprintf(fp, "%-10s %7s %9s %6s %9s %9s %9s %9s\n", "phase", "count",
+            "total", "pct", "mean", "p50", "p90", "max");
+    for(i=0; i<prof_nphases; i++) {
+        st = &prof->stats[i];
+        if(!st->count) {
+            continue;
+        }
+        accounted += st->total;
+        fprintf(fp, "%-10s %7ld %8.3fs %5.1f%% %7.1fus %7.0fus %7.0fus %7.0fus\n",
+                phase_names[i], st->count, st->total,
+                (wall > 0 ? 100.0 * st->total / wall : 0.0),
+                st->total * 1000000.0 / st->count,
+                percentile(st, 50) * 1000000.0, percentile(st, 90) * 1000000.0,
+                st->max * 1000000.0);
+    }
+    if(wall > accounted) {
+        fprintf(fp, "%-10s %7s %8.3fs %5.1f%%\n", "other", "",
+                wall - accounted, 100.0 * (wall - accounted) / wall);
+    }
+}
@@ -0,0 +1,55 @@
+/* prof.h
+ * 18 Oct 2026
+ *
+ * Times the phases that tmtest goes through to run each test.
+ * See prof.c.
+ * This file is covered by the MIT License.
+ */
+
+#include <stdio.h>
+
+
+/** The phases of running a test that --profile times.  These are all
+ *  spent in tmtest itself so they never overlap.
+ */
+
+enum prof_phase {
+    prof_discovery,     ///< scanning directories for testfiles
+    prof_verify,        ///< verify_testhome()
+    prof_fork,          ///< forking the shell
+    prof_template,      ///< print_template(), writing the script to the shell
+    prof_wait,          ///< blocked waiting for the shell to exit
+    prof_status,        ///< scan_status_file()
+    prof_testhome,      ///< check_testhome()
+    prof_results,       ///< test_analyze_results() and printing the results
+    prof_settle,        ///< waiting for background processes (see sweep_processes())
+    prof_nphases
+};
+
+
+// bucket n holds durations shorter than 2^n microseconds.  The last
+// bucket holds everything longer than 2^(PROF_BUCKETS-2) us, about 67s.
+#define PROF_BUCKETS 28
+
+
+struct prof_stats {
+    long count;
+    double total;
+    double max;
+    long buckets[PROF_BUCKETS];
+};
+
+
+/** The times collected for each phase.  Zero it before use.
+ */
+
+struct prof {
+    int enabled;
+    struct prof_stats stats[prof_nphases];
+};
+
+
+void prof_enable(struct prof *prof);
+double prof_start(const struct prof *prof);
+void prof_stop(struct prof *prof, enum prof_phase phase, double start);
+void prof_print(const struct prof *prof, FILE *fp, double wall);
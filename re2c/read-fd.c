@@ -30,6 +30,10 @@ static ssize_t readfd_read(scanstate *ss)
 	}
 
     avail = read_shiftbuf(ss);
+    if(avail == 0) {
+        // the token fills the buffer.  that's not eof.
+        return 0;
+    }
 
     // ensure we get a full read
     do {
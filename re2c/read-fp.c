@@ -4,6 +4,7 @@
  */
 
 #include <stdio.h>
+#include <assert.h>
 
 #include "scan-dyn.h"
 #include "read-fp.h"
@@ -14,7 +15,11 @@ static ssize_t readfp_read(scanstate *ss)
     ssize_t n, avail;
 
     avail = read_shiftbuf(ss);
-    n = fread((void*)ss->limit, avail, 1, ss->readref);
+    if(avail == 0) {
+        // the token fills the buffer.  that's not eof.
+        return 0;
+    }
+    n = fread((void*)ss->limit, 1, avail, ss->readref);
     ss->limit += n;
 
     if(n <= 0) {
@@ -59,7 +64,7 @@ scanstate* readfp_attach(scanstate *ss, FILE *fp)
  * int on the current machine architecture.
  */
 
-scanstate* readfp_open(const char *path, int bufsiz)
+scanstate* readfp_open(const char *path, size_t bufsiz)
 {
     scanstate *ss;
     FILE *fp;
@@ -17,7 +17,7 @@
 /** Returns EOF because we're out of data.
  */
 
-static ssize_t readmem_read(scanstate *ss)
+ssize_t readmem_read(scanstate *ss)
 {
     return 0;
 }
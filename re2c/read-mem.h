@@ -9,6 +9,11 @@
 
 scanstate* readmem_init(scanstate *ss, const char *data, size_t len);
 scanstate* readmem_attach(scanstate *ss, const char *data, size_t len);
+ssize_t readmem_read(scanstate *ss);
+
+// true if all of the scanner's data is already in its buffer.  Scanners
+// and comparisons use this to pick versions that never need to refill.
+#define readmem_attached(ss) ((ss)->read == readmem_read)
 
 // convenience functions:
 #define readmem_init_str(ss,str) readmem_init(ss,str,strlen(str))
@@ -22,18 +22,6 @@
  * Returns the number of bytes available to read in the buffer.
  */
 
-/* TODO: could optimize for the fast case (no data that needs
- * to be shifted).  However, there's no burning need -- it wouldn't
- * offer much speedup  Bigger buffers would help a lot more.
- * NOTE: the middle line of this macro is incomplete!  Don't use!
-
-#define read_shiftbuf(ss) (ss->token == ss->limit ? \
-    (ss->token = ss->cursor = ss->bufptr, 0) : \
-    _read_shiftbuf(ss)) 
-
- */
-
-
 // cnt tells how many bytes need to be shifted downward.
 // The bytes that need to be shifted are those between the token
 // and the limit.
@@ -42,6 +30,7 @@ ssize_t read_shiftbuf(scanstate *ss)
 {
     const char *min;
     ssize_t cnt;
+    ssize_t delta;
 
     min = ss->token;
     if(ss->marker && ss->marker < min) {
@@ -51,7 +40,25 @@ ssize_t read_shiftbuf(scanstate *ss)
     // this tells how many bytes need to be shifted.
     cnt = ss->limit - min;
     if(cnt) {
-        ssize_t delta = min - ss->bufptr;
+        // While at least half the buffer is free past the limit, just
+        // read into it.  Otherwise a long token would be shifted again
+        // on every read, which gets quadratic.
+        if(ss->bufptr + ss->bufsiz - ss->limit >= ss->bufsiz/2) {
+            return ss->bufsiz - (ss->limit - ss->bufptr);
+        }
+
+        // If the token fills most of the buffer, shifting it won't
+        // free up much room.  Make the buffer bigger if we're allowed.
+        if(cnt > ss->bufsiz/2 && ss->grow && ss->bufmax > ss->bufsiz) {
+            if(ss->grow(ss) == 0) {
+                min = ss->token;
+                if(ss->marker && ss->marker < min) {
+                    min = ss->marker;
+                }
+            }
+        }
+
+        delta = min - ss->bufptr;
         memmove((void*)ss->bufptr, min, cnt);
         ss->cursor -= delta;
         ss->token -= delta;
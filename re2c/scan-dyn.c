@@ -51,19 +51,117 @@ scanstate* dynscan_create(size_t bufsiz)
     }
 
     scanstate_init(ss, bufptr, bufsiz);
+    ss->bufdyn = (bufptr != NULL);
     return ss;
 }
 
 
-/** Frees a scanstate allocated by dynamicscan_create().
+/** Doubles the size of the scan buffer (but never past bufmax),
+ *  adjusting all the pointers into it.  This is the scanstate's grow
+ *  routine (see growproc).
+ *
+ *  Returns 0 on success, -1 if the buffer is already as big as it's
+ *  allowed to be or if there wasn't enough memory.  Either way,
+ *  the scanner is still usable.
  */
 
-void dynscan_free(scanstate *ss)
+static int dynscan_grow(scanstate *ss)
+{
+    size_t newsiz;
+    size_t cursor, limit, marker, token;
+    char *newbuf;
+
+    newsiz = ss->bufsiz * 2;
+    if(newsiz > ss->bufmax) {
+        newsiz = ss->bufmax;
+    }
+    if(newsiz <= ss->bufsiz) {
+        return -1;
+    }
+
+    cursor = ss->cursor - ss->bufptr;
+    limit = ss->limit - ss->bufptr;
+    token = ss->token - ss->bufptr;
+    marker = (ss->marker ? ss->marker - ss->bufptr : 0);
+
+    if(ss->bufdyn) {
+        newbuf = realloc((void*)ss->bufptr, newsiz);
+    } else {
+        newbuf = malloc(newsiz);
+        if(newbuf) {
+            memcpy(newbuf, ss->bufptr, limit);
+        }
+    }
+    if(!newbuf) {
+        return -1;
+    }
+
+    ss->bufptr = newbuf;
+    ss->bufsiz = newsiz;
+    ss->bufdyn = 1;
+    ss->cursor = newbuf + cursor;
+    ss->limit = newbuf + limit;
+    ss->token = newbuf + token;
+    if(ss->marker) ss->marker = newbuf + marker;
+
+    return 0;
+}
+
+
+/** Like dynscan_create() except that the buffer grows as needed to
+ *  hold tokens up to maxsiz bytes long.
+ */
+
+scanstate* dynscan_create_growable(size_t bufsiz, size_t maxsiz)
+{
+    scanstate *ss = dynscan_create(bufsiz);
+    if(ss) {
+        dynscan_growable(ss, maxsiz);
+    }
+    return ss;
+}
+
+
+/** Allows the scanner's buffer to grow up to maxsiz bytes.
+ *
+ * When a token fills more than half of the buffer, read_shiftbuf()
+ * doubles it instead of shifting the token over and over, so even
+ * multi-megabyte tokens are scanned in linear time.  The buffer
+ * passed to scanstate_init() can be anything; the first time it
+ * grows it's copied to a malloc'd buffer and you need to call
+ * dynscan_release() when you're done scanning to free that.
+ */
+
+void dynscan_growable(scanstate *ss, size_t maxsiz)
 {
-    if(ss->bufptr) {
+    ss->bufmax = maxsiz;
+    ss->grow = dynscan_grow;
+}
+
+
+/** Frees the scanner's buffer if it was allocated by this file.
+ *  Use this on a scanstate that you allocated yourself but made
+ *  growable.  The scanner can't be used again until it's
+ *  reinitialized.
+ */
+
+void dynscan_release(scanstate *ss)
+{
+    if(ss->bufdyn) {
         free((void*)ss->bufptr);
+        ss->bufptr = NULL;
+        ss->bufsiz = 0;
+        ss->bufdyn = 0;
     }
+}
+
 
+/** Frees a scanstate allocated by dynamicscan_create().
+ */
+
+void dynscan_free(scanstate *ss)
+{
+    dynscan_release(ss);
     free(ss);
 }
 
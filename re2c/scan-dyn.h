@@ -11,5 +11,8 @@
 
 
 scanstate* dynscan_create(size_t bufsiz);
+scanstate* dynscan_create_growable(size_t bufsiz, size_t maxsiz);
+void dynscan_growable(scanstate *ss, size_t maxsiz);
+void dynscan_release(scanstate *ss);
 void dynscan_free(scanstate *ss);
 
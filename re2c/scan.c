@@ -22,6 +22,9 @@ void scanstate_init(scanstate *ss, const char *bufptr, size_t bufsiz)
     ss->at_eof = 0;
     ss->bufptr = bufptr;
     ss->bufsiz = bufsiz;
+    ss->bufmax = 0;
+    ss->grow = NULL;
+    ss->bufdyn = 0;
     ss->readref = NULL;
     ss->read = NULL;
     ss->scanref = NULL;
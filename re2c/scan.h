@@ -104,18 +104,22 @@ struct scanstate;
  * You only need to know this if you're writing your own read functions.
  *
  * This function is used to fetch more data for the scanner.  It must
- * first shift the pointers in ss to make room (see read_shiftbuffer())
+ * first shift the pointers in ss to make room (see read_shiftbuf())
  * then load new data into the unused bytes at the end of the buffer.
  *
  * I chose the shift technique over a ringbuffer because we should rarely
- * have to shift data.  If you find that your file has gigantic tokens
- * and you're burning a lot of cpu shifting partial tokens from the end
- * of the buffer to the start, you might want to use a ring buffer instead
- * of a shift buffer.  However, re2c itself can't handle ringbuffers or
+ * have to shift data.  re2c itself can't handle ringbuffers or
  * split tokens (nor can most scanners that I'm aware of), so shift
- * buffers are the best we can do.
- *
- * This routine returns 0 when there's no more data (EOF).
+ * buffers are the best we can do.  To keep gigantic tokens from being
+ * shifted over and over, read_shiftbuf() keeps reading into the end
+ * of the buffer like a ringbuffer would until less than half of it is
+ * free, and a buffer made growable (see dynscan_growable()) doubles
+ * in size rather than shifting a token that fills most of it.
+ *
+ * This routine returns 0 when there's no more data (EOF).  It also
+ * returns 0 if the current token fills the whole buffer so there's no
+ * room to read into, but it doesn't set at_eof.  The scanner should
+ * return what it has and let the next token pick up the rest.
  * If it returns a value less than 0, that value will be returned
  * to the caller instead of a token.  This can indicate an error
  * condition, or just a situation such as EWOULDBLOCK.
@@ -164,6 +168,17 @@ typedef ssize_t (*readproc)(struct scanstate *ss);
 typedef int (*scanproc)(struct scanstate *ss);
 
 
+/** Prototype of the routine that makes the buffer bigger
+ *
+ * read_shiftbuf() calls it instead of shifting a token that fills
+ * most of the buffer.  It must move the buffer and every pointer into
+ * it, and return 0, or return -1 and leave the scanstate alone.
+ * dynscan_growable() sets it up.
+ */
+
+typedef int (*growproc)(struct scanstate *ss);
+
+
 
 /** Represents the current state for a single scanner.
  *
@@ -187,6 +202,9 @@ struct scanstate {
 
     const char *bufptr; ///< The buffer currently in use
     size_t bufsiz;         ///< The maximum number of bytes that the buffer can hold
+    size_t bufmax;      ///< If larger than bufsiz, read_shiftbuf() may grow the buffer up to this many bytes.  See dynscan_growable().
+    growproc grow;      ///< Grows the buffer when bufmax allows it, NULL if the buffer can't grow.
+    int bufdyn;         ///< True if bufptr was malloc'd by scan-dyn.c.  dynscan_free() or dynscan_release() frees it.
 
     void *readref;      ///< Data specific to the reader (i.e. for readfp_attach() it's a FILE*).
     readproc read;      ///< The routine the scanner calls when the buffer needs to be reread.
@@ -220,12 +238,16 @@ void scanstate_reset(scanstate *ss);
  * without missing the errors, just call scan_token() and see if it
  * returns 0.
  *
+ * The previous token is finished so it's dropped before reading.
+ * Otherwise a token that filled the buffer would leave no room to
+ * read into and the empty read would look like EOF.
+ *
  * TODO: should this routine be removed entirely?
  */
 
 #define scan_is_finished(ss) \
     (((ss)->cursor < (ss)->limit) ? 0 : \
-		 ((ss)->at_eof || ((*(ss)->read)(ss) <= 0)) \
+		 ((ss)->at_eof || ((ss)->token = (ss)->cursor, (*(ss)->read)(ss) <= 0)) \
     )
 
 
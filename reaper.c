@@ -0,0 +1,204 @@
+/* reaper.c
+ * 18 Oct 2026
+ *
+ * Deletes directory trees on a background thread.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file reaper.c
+ *
+ * When a test leaves files behind, tmtest renames its testhome aside
+ * and hands the old one to the reaper so the next test can start
+ * right away.  The paths are sent to the reaper thread NUL-terminated
+ * over a pipe.  That way queueing a tree is a single write() and the
+ * two threads don't share anything that needs a lock.  reaper_stop()
+ * joins the thread so it must not be called from a signal handler.
+ * Each runner has its own reaper.
+ *
+ * The tree is removed with the *at() functions so the thread never
+ * needs to change directory, and symlinks are never followed.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "reaper.h"
+
+
+/** Removes everything in the directory dirfd, then closes dirfd.
+ *  Errors are printed but otherwise ignored; there's nobody left to
+ *  report them to.
+ */
+
+static void remove_contents(int dirfd, const char *path)
+{
+    struct dirent *ent;
+    int subfd;
+    DIR *dir;
+
+    dir = fdopendir(dirfd);
+    if(!dir) {
+        fprintf(stderr, "Could not read %s: %s\n", path, strerror(errno));
+        close(dirfd);
+        return;
+    }
+
+    while((ent = readdir(dir)) != NULL) {
+        if(ent->d_name[0] == '.' && (ent->d_name[1] == '\0' ||
+                (ent->d_name[1] == '.' && ent->d_name[2] == '\0'))) {
+            continue;
+        }
+
+        if(unlinkat(dirfd, ent->d_name, 0) == 0) {
+            continue;
+        }
+        if(errno != EISDIR && errno != EPERM) {
+            fprintf(stderr, "Could not unlink %s/%s: %s\n", path, ent->d_name, strerror(errno));
+            continue;
+        }
+
+        // it's a directory
+        subfd = openat(dirfd, ent->d_name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+        if(subfd < 0 && errno == EACCES) {
+            // the test took away our permissions.  it's our dir so take them back.
+            fchmodat(dirfd, ent->d_name, 0700, 0);
+            subfd = openat(dirfd, ent->d_name, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+        }
+        if(subfd < 0) {
+            fprintf(stderr, "Could not open %s/%s: %s\n", path, ent->d_name, strerror(errno));
+            continue;
+        }
+        remove_contents(subfd, ent->d_name);
+        if(unlinkat(dirfd, ent->d_name, AT_REMOVEDIR) < 0) {
+            fprintf(stderr, "Could not rmdir %s/%s: %s\n", path, ent->d_name, strerror(errno));
+        }
+    }
+
+    closedir(dir);
+}
+
+
+static void remove_tree(const char *path)
+{
+    int fd;
+
+    fd = open(path, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if(fd < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        return;
+    }
+    remove_contents(fd, path);
+    if(rmdir(path) < 0) {
+        fprintf(stderr, "Could not rmdir %s: %s\n", path, strerror(errno));
+    }
+}
+
+
+static void* reaper_main(void *arg)
+{
+    FILE *fp = arg;
+    char *path = NULL;
+    size_t size = 0;
+
+    while(getdelim(&path, &size, '\0', fp) > 0) {
+        remove_tree(path);
+    }
+
+    free(path);
+    fclose(fp);
+    return NULL;
+}
+
+
+/** Starts the reaper thread.
+ *
+ *  @returns 0 if it's running, -1 if not (and the reason was printed).
+ */
+
+int reaper_start(struct reaper *reaper)
+{
+    sigset_t all, old;
+    int pipes[2];
+    FILE *fp;
+    int err;
+
+    if(pipe2(pipes, O_CLOEXEC) < 0) {
+        perror("creating reaper pipe");
+        return -1;
+    }
+    fp = fdopen(pipes[0], "r");
+    if(!fp) {
+        perror("opening reaper pipe");
+        close(pipes[0]);
+        close(pipes[1]);
+        return -1;
+    }
+
+    // signals like SIGINT must be handled by the main thread.
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&reaper->thread, NULL, reaper_main, fp);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(err) {
+        fprintf(stderr, "Could not start the reaper thread: %s\n", strerror(err));
+        fclose(fp);
+        close(pipes[1]);
+        return -1;
+    }
+
+    reaper->fd = pipes[1];
+    reaper->running = 1;
+    return 0;
+}
+
+
+/** Arranges for the directory at path and everything in it to be
+ *  deleted.  Nothing may use path after this.  If the reaper isn't
+ *  running, the tree is deleted before this returns.
+ */
+
+void reaper_queue(struct reaper *reaper, const char *path)
+{
+    size_t len = strlen(path) + 1;
+    ssize_t cnt;
+
+    // writes to a pipe smaller than PIPE_BUF are all or nothing.
+    if(reaper->running && len <= PIPE_BUF) {
+        do {
+            cnt = write(reaper->fd, path, len);
+        } while(cnt < 0 && errno == EINTR);
+        if(cnt == len) {
+            return;
+        }
+        perror("queueing a tree to delete");
+    }
+
+    remove_tree(path);
+}
+
+
+/** Waits for the reaper to delete everything it was given, then stops it.
+ */
+
+void reaper_stop(struct reaper *reaper)
+{
+    if(!reaper->running) {
+        return;
+    }
+
+    close(reaper->fd);
+    reaper->running = 0;
+    pthread_join(reaper->thread, NULL);
+}
@@ -0,0 +1,23 @@
+/* reaper.h
+ * 18 Oct 2026
+ *
+ * Deletes directory trees on a background thread.  See reaper.c.
+ * This file is covered by the MIT License.
+ */
+
+#include <pthread.h>
+
+
+/** A thread that deletes the trees it's handed.  Zero it before use.
+ */
+
+struct reaper {
+    pthread_t thread;
+    int fd;         ///< write end of the queue, only valid if running
+    int running;
+};
+
+
+int reaper_start(struct reaper *reaper);
+void reaper_queue(struct reaper *reaper, const char *path);
+void reaper_stop(struct reaper *reaper);
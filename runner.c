@@ -0,0 +1,2826 @@
+/* runner.c
+ * 18 Oct 2026
+ *
+ * Runs testfiles and collects their results.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file runner.c
+ *
+ * Everything needed to run tests lives in a struct runner: the options,
+ * the slots and testdir, the tests that are running, and the results.
+ * main.c fills one in from the command line but any program can link
+ * with libtmtest and drive its own.
+ *
+ * Nothing in here calls exit().  Errors are printed to stderr and
+ * returned as -1, after which the runner should only be passed to
+ * runner_stop().  Functions that run tests return 1 to keep going, 0
+ * if a test asked us to stop (i.e. it was aborted), or -1.  When
+ * test_abort() gives up on a test, it records the reason in the test
+ * and the error is returned the same way.
+ *
+ * Each runner has its own options, config caches, tests, reaper
+ * thread, and timings, and it only ever waits for its own children, so
+ * a program can run several at once on separate threads.  Process-wide
+ * setup is left to the caller: see runner_start().
+ */
+
+// for pipe2 and posix_spawn_file_actions_addchdir_np
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <signal.h>
+#include <spawn.h>
+#include <assert.h>
+
+#include "re2c/read-fd.h"
+#include "re2c/read-mem.h"
+
+#include "test.h"
+#include "perf.h"
+#include "prof.h"
+#include "reaper.h"
+#include "runner.h"
+#include "arena.h"
+#include "qscandir.h"
+#include "vars.h"
+#include "tfscan.h"
+#include "pathconv.h"
+#include "pathstack.h"
+#include "script.h"
+#include "isolate.h"
+#include "snapshot.h"
+
+#define DIFFPROG "/usr/bin/diff"
+
+#define OUTNAME "stdout"
+#define ERRNAME "stderr"
+#define FD3NAME "fd3"
+#define STATUSNAME "status"
+#define PROLOGUENAME "config"
+#define TESTHOME "test"
+
+#define SNAPNAME "setup-"
+
+// testhomes with leftover files are renamed to this (plus a number)
+// and deleted in the background.
+#define ASIDENAME "home-"
+
+// file in tmpdir that holds stdout
+#define DIFFNAME "diff"
+
+// with --dir-shell and no --batch, this many tests share a shell
+#define DIR_BATCH 32
+
+// fds that max_slots() leaves for tmtest and the tests it's checking
+#define SLOT_FD_RESERVE 32
+
+
+/** Everything a single running test needs: the files that capture
+ *  its output and status, and the empty directory it runs in.
+ *
+ *  We do all I/O for all tests through these same four files,
+ *  truncating them before each test.  The first slot lives directly
+ *  in the testdir, any others (for running tests in parallel) live in
+ *  numbered subdirectories of it.
+ */
+
+struct slot {
+    char dir[PATH_MAX];         ///< the directory containing the files below
+    char outname[PATH_MAX];
+    char errname[PATH_MAX];
+    char fd3name[PATH_MAX];
+    char statusname[PATH_MAX];
+    char prologuename[PATH_MAX];
+    char home[PATH_MAX];        ///< the test's cwd.  must be empty when a test starts.
+    int outfd;
+    int errfd;
+    int fd3fd;                  ///< reads what the test wrote to fd 3.  the shell opens fd3name itself.
+    int statusfd;
+    int prologuefd;             ///< with --dir-shell, status from reading the config files.  otherwise -1.
+    int busy;                   ///< true while a test is using this slot
+};
+
+
+/** Tests that are ready to go but haven't been handed to a shell yet.
+ *  Normally a test is launched as soon as it's added.  With --batch,
+ *  up to batch_size tests are collected and run one after another,
+ *  each in its own subshell, by a single shell.
+ */
+
+struct batch {
+    struct job **jobs;
+    int njobs;
+    char shell[PATH_MAX];       ///< every test in a batch uses the same shell
+    char dir[PATH_MAX];         ///< with --dir-shell, every test is in this directory
+    const struct template_segment *tmpl;  ///< the template for the batch's shell
+    int tmplcnt;
+    struct script script;       ///< the scripts for all the tests in the batch
+};
+
+
+/** The tree that a directory's tmtest.setup built.  It's kept until
+ *  the last test that started with a copy of it has finished since
+ *  check_testhome() needs it to tell the copy from leftover files.
+ */
+
+struct snapshot {
+    char dir[PATH_MAX];         ///< the directory whose tests use this snapshot
+    char path[PATH_MAX];        ///< the tree, "" if the directory has no tmtest.setup
+    int status;                 ///< tmtest.setup's wait status
+    int refs;                   ///< the jobs using it, plus one while it's the current one
+};
+
+
+/** Repeated runs of a test share one of these.  It keeps the testfile
+ *  in memory so it's only read once and counts how the runs went.
+ */
+
+struct testsrc {
+    char *data;                 ///< the entire testfile, NUL terminated.  NULL if not loaded.
+    size_t len;
+    int runs;                   ///< number of runs that have been finished
+    int failures;               ///< number of those that failed
+};
+
+
+/** A test that has been started but whose results haven't been
+ *  processed yet.
+ */
+
+struct job {
+    struct test test;
+    struct slot *slot;
+    struct testsrc *src;        ///< NULL unless the test is being repeated
+    struct snapshot *snap;      ///< the tree the testhome was seeded with, NULL if none
+    char *abspath;
+    char *relpath;
+    int child;                  ///< pid of the shell running the test
+    int reaped;                 ///< true once the shell has been waited for
+    int skipped;                ///< true if the test was disabled without running a shell
+    int swept;                  ///< true once the processes the shell left running have been dealt with
+    int status;                 ///< the shell's wait status, valid once reaped
+    int diffpid;                ///< the diff reading the rewritten test, 0 if none
+    int testfd;                 ///< testfile to close when finished, -1 if none
+    struct perf_sample sample;
+    char scanbuf[BUFSIZ];       ///< scan buffer for the testfile
+};
+
+
+#define is_dash(s) ((s)[0] == '-' && (s)[1] == '\0')
+
+
+/** Returns zero if s1 ends with s2, nonzero if not.
+ */
+
+static int strcmpend(const char *s1, const char *s2)
+{
+    size_t n1 = strlen(s1);
+    size_t n2 = strlen(s2);
+
+    if(n2 <= n1) {
+        return strncmp(s1+n1-n2, s2, n2);
+    } else {
+        return 1;
+    }
+}
+
+
+static int i_have_permission(const struct stat *st, int op)
+{
+    if(st->st_mode & S_IRWXU & op) {
+        if(geteuid() == st->st_uid) {
+            return 1;
+        }
+    }
+
+    if(st->st_mode & S_IRWXG & op) {
+        if(getegid() == st->st_gid) {
+            return 1;
+        }
+    }
+
+    if(st->st_mode & S_IRWXO & op) {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static void copy_string(char *dst, const char *src, int dstsiz)
+{
+    size_t len = strlen(src);
+
+    if(len > dstsiz - 1) {
+        len = dstsiz - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+
+/** Copies s1 and s2 into dst, separated with a "/" character.
+ *  Generally s1 will be an absolute path and s2 will be relative.
+ *
+ *  @returns 0, or -1 if dst is too small.
+ */
+
+static int cat_path(char *dst, const char *s1, const char *s2, int siz)
+{
+    int s1len = strlen(s1);
+    int s2len = strlen(s2);
+    if(s1len + s2len + 2 > siz) {
+        return -1;
+    }
+
+    memcpy(dst, s1, s1len);
+    dst[s1len] = '/';
+    memcpy(dst + s1len + 1, s2, s2len + 1); // include null terminator
+    return 0;
+}
+
+
+/** Appends the given template to the script, performing substitutions.
+ *
+ *  The template was split into literals and variables by cstrfy at
+ *  build time so all we need to do here is walk the segments.  The
+ *  literals are referenced, not copied.
+ */
+
+static int expand_template(struct test *test,
+        const struct template_segment *tmpl, int count, struct script *sc)
+{
+    int i;
+
+    for(i=0; i<count; i++) {
+        if(tmpl[i].var == tmplvar_literal) {
+            script_add(sc, tmpl[i].text, tmpl[i].len);
+        } else if(printvar(test, sc, tmpl[i].var) != 0) {
+            // printvar has already printed the error message
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/** Returns the index of the TESTSTART segment.  Everything before it
+ *  reads the config files, everything after it runs the test.
+ */
+
+static int find_teststart(const struct template_segment *tmpl, int count)
+{
+    int i;
+
+    for(i=0; i<count; i++) {
+        if(tmpl[i].var == tmplvar_TESTSTART) {
+            return i;
+        }
+    }
+
+    assert(!"template has no TESTSTART");
+    return 0;
+}
+
+
+/** Sends the whole script to fd in a single writev (unless it's
+ *  bigger than the pipe).
+ */
+
+static int write_script(struct script *sc, int fd, const char *name)
+{
+    int err;
+
+    // EPIPE is normal, it means a config file aborted the test.
+    err = script_write(sc, fd);
+    if(err && err != EPIPE) {
+        fprintf(stderr, "Could not write script for %s: %s\n",
+                name, strerror(err));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int reset_fd(int fd, const char *fname)
+{
+    if(lseek(fd, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "Couldn't seek to start of %s: %s\n",
+                fname, strerror(errno));
+        return -1;
+    }
+
+    if(ftruncate(fd, 0) < 0) {
+        fprintf(stderr, "Couldn't reset file %s: %s\n",
+                fname, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int check_child_status(int status, const char *name)
+{
+    if(WIFSIGNALED(status)) {
+        if(WTERMSIG(status) == SIGINT) {
+            // If test was interrupted with a sigint then raise it on ourselves.
+            // Otherwise it can be hard to interrupt a series of tests
+            // (you kill one test but the next one fires right up).
+            kill(getpid(), SIGINT);
+        }
+    } else if(!WIFEXITED(status)) {
+        // not signalled, but os claims child didn't exit normally.
+        fprintf(stderr, "WTF??  Unknown status returned by %s: %d\n",
+                name, status);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/** Waits for the given child to finish and returns its status, or -1.
+ *  If ru is non-null, it receives the resources used by the child.
+ *  A signal interrupting the wait (see runner.interrupted) returns -1
+ *  without printing anything.
+ */
+
+static int wait_for_child(int child, const char *name, struct rusage *ru)
+{
+    int pid;
+    int status;
+
+    // wait patiently for child to finish.
+    pid = wait4(child, &status, 0, ru);
+    if(pid < 0) {
+        if(errno != EINTR) {
+            fprintf(stderr, "Error waiting for %s to finish: %s\n",
+                    name, strerror(errno));
+        }
+        return -1;
+    }
+
+    if(check_child_status(status, name) < 0) {
+        return -1;
+    }
+    return status;
+}
+
+
+/** Lists the processes in the given process group as "left running:
+ *  sleep, nc" in msg.  Zombies are already gone as far as the test is
+ *  concerned so they're skipped.
+ */
+
+static void list_processes(int pgid, char *msg, int msgsiz)
+{
+    char path[PATH_MAX], buf[BUFSIZ];
+    struct dirent *ent;
+    char *name, *end;
+    char state;
+    int fd, cnt, grp;
+    DIR *dir;
+
+    dir = opendir("/proc");
+    while(dir && (ent = readdir(dir)) != NULL) {
+        if(!isdigit((unsigned char)ent->d_name[0])) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%s/stat", ent->d_name);
+        fd = open(path, O_RDONLY|O_CLOEXEC);
+        if(fd < 0) {
+            continue;
+        }
+        cnt = read(fd, buf, sizeof(buf)-1);
+        close(fd);
+        if(cnt <= 0) {
+            continue;
+        }
+        buf[cnt] = '\0';
+
+        // "pid (name) state ppid pgrp ..." and name may contain parens.
+        name = strchr(buf, '(');
+        end = strrchr(buf, ')');
+        if(!name || !end || sscanf(end+1, " %c %*d %d", &state, &grp) != 2) {
+            continue;
+        }
+        if(grp != pgid || state == 'Z') {
+            continue;
+        }
+
+        *end = '\0';
+        strncat(msg, (msg[0] ? ", " : "left running: "), msgsiz - strlen(msg) - 1);
+        strncat(msg, name+1, msgsiz - strlen(msg) - 1);
+    }
+    if(dir) {
+        closedir(dir);
+    }
+
+    // no /proc?  at least say what happened.
+    if(!msg[0]) {
+        snprintf(msg, msgsiz, "left processes running");
+    }
+}
+
+
+/** Deals with anything the shell left running in the background.
+ *
+ *  The shell leads its own process group and tmtest is a subreaper
+ *  (see runner_start()), so everything the test started is either still
+ *  in the group or has been reparented to us.  We reap the group as it
+ *  exits, waiting up to grace ms for it to empty, so that nothing is
+ *  still writing to the capture files when they're read.  Whatever is
+ *  left after that is described in msg and killed.
+ */
+
+static void sweep_processes(struct runner *r, int pgid, char *msg, int msgsiz)
+{
+    struct timeval start, now;
+    useconds_t delay = 100;
+    long elapsed;
+
+    gettimeofday(&start, NULL);
+    for(;;) {
+        while(waitpid(-pgid, NULL, WNOHANG) > 0) {
+            // reaped an orphan
+        }
+        if(kill(-pgid, 0) < 0 && errno == ESRCH) {
+            return;
+        }
+
+        gettimeofday(&now, NULL);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+        if(elapsed >= r->grace) {
+            break;
+        }
+        usleep(delay);
+        if(delay < 10000) {
+            delay *= 2;
+        }
+    }
+
+    list_processes(pgid, msg, msgsiz);
+    kill(-pgid, SIGKILL);
+    while(waitpid(-pgid, NULL, 0) > 0 || errno == EINTR) {
+        // wait for every one of them to die
+    }
+}
+
+
+/** Opens a capture file.  The test's own fd 3 is redirected to its
+ *  slot's fd3 file so a capture file must never be fd 3 itself.
+ */
+
+static int open_file(char *fn, int fnsiz, const char *dir, const char *name, int flags)
+{
+    int fd, newfd;
+
+    if(cat_path(fn, dir, name, fnsiz) < 0) {
+        fprintf(stderr, "path too long: %s/%s\n", dir, name);
+        return -1;
+    }
+    fd = open(fn, flags|O_RDWR|O_CREAT|O_CLOEXEC/*|O_EXCL*/, S_IRUSR|S_IWUSR);
+    if(fd < 0) {
+        fprintf(stderr, "couldn't open %s: %s\n", fn, strerror(errno));
+        return -1;
+    }
+
+    if(fd == 3) {
+        newfd = fcntl(fd, F_DUPFD_CLOEXEC, 4);
+        close(fd);
+        if(newfd < 0) {
+            fprintf(stderr, "couldn't move %s: %s\n", fn, strerror(errno));
+            return -1;
+        }
+        fd = newfd;
+    }
+
+    return fd;
+}
+
+
+static int write_stdin_to_tmpfile(struct runner *r, struct test *test)
+{
+    int diffsiz;
+    int fd;
+
+    diffsiz = sizeof(TESTDIR) + sizeof(DIFFNAME);
+    test->diffname = arena_alloc(test->arena, diffsiz);
+    if(!test->diffname) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    fd = open_file(test->diffname, diffsiz, r->testdir, DIFFNAME, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    assert(strlen(test->diffname) == sizeof(TESTDIR)+sizeof(DIFFNAME)-1);
+    if(write_file(test, fd, 0, NULL) < 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+
+/** Starts prog with its stdin reading from infd.  The child inherits
+ *  stdout, stderr, and the fds listed in keep.  Every other fd tmtest
+ *  has is close-on-exec (see main()) so the child sees nothing else.
+ *  If dir is non-null, the child starts in that directory.  If
+ *  pgroup is true, the child leads a new process group (see
+ *  sweep_processes()).
+ *
+ *  posix_spawn doesn't need to copy our page tables like fork does so
+ *  it costs the same no matter how big tmtest gets.
+ *
+ *  @returns the child's pid, or -1 if the child couldn't be started.
+ */
+
+static int spawn_child(const char *prog, char *const argv[], int infd,
+        const int *keep, int nkeep, const char *dir, int pgroup)
+{
+    extern char **environ;
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    pid_t child = -1;
+    int have_fa = 0;
+    int err, i;
+
+    err = posix_spawnattr_init(&attr);
+    if(err) {
+        fprintf(stderr, "Could not set up %s: %s\n", prog, strerror(err));
+        return -1;
+    }
+    if(pgroup) {
+        // a pgroup of 0 means the child's pid becomes its pgid.
+        err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    }
+    if(!err) {
+        err = posix_spawn_file_actions_init(&fa);
+        have_fa = !err;
+    }
+    if(!err) {
+        err = posix_spawn_file_actions_adddup2(&fa, infd, STDIN_FILENO);
+    }
+    // dup2ing an fd onto itself clears its close-on-exec flag.  glibc
+    // only does that since 2.29, which addchdir_np needs anyway.
+    for(i=0; !err && i<nkeep; i++) {
+        err = posix_spawn_file_actions_adddup2(&fa, keep[i], keep[i]);
+    }
+    if(!err && dir) {
+        err = posix_spawn_file_actions_addchdir_np(&fa, dir);
+    }
+    if(err) {
+        fprintf(stderr, "Could not set up %s: %s\n", prog, strerror(err));
+        goto done;
+    }
+
+    if(strchr(prog, '/')) {
+        err = posix_spawn(&child, prog, &fa, &attr, argv, environ);
+    } else {
+        err = posix_spawnp(&child, prog, &fa, &attr, argv, environ);
+    }
+    if(err) {
+        fprintf(stderr, "executing %s for test: %s\n", prog, strerror(err));
+        child = -1;
+    }
+
+done:
+    if(have_fa) {
+        posix_spawn_file_actions_destroy(&fa);
+    }
+    posix_spawnattr_destroy(&attr);
+    return child;
+}
+
+
+/** Starts a diff process and sets it up to receive the dumped test.
+ */
+
+static int start_diff(struct runner *r, struct test *test)
+{
+    char *argv[5];
+    int pipes[2];
+    int child;
+    const char *filename = NULL;
+
+    assert(test->testfile);
+    // if the test is coming from stdin, we need to copy it to a
+    // real file before we can diff against it.
+    if(is_dash(test->testfile)) {
+        // first, write all of our stdin to a tmpfile.
+        if(write_stdin_to_tmpfile(r, test) < 0) {
+            return -1;
+        }
+        // then, read the test from this file instead of stdin.
+        filename = test->diffname;
+        assert(filename);
+        assert(filename[0]);
+    } else {
+        filename = test->testpath;
+    }
+
+    if(pipe2(pipes, O_CLOEXEC) < 0) {
+        perror("creating diff pipe");
+        return -1;
+    }
+
+    argv[0] = DIFFPROG;
+    argv[1] = "-u";
+    argv[2] = (char*)filename;
+    argv[3] = "-";
+    argv[4] = NULL;
+    child = spawn_child(DIFFPROG, argv, pipes[0], NULL, 0, NULL, 0);
+
+    close(pipes[0]);
+    if(child < 0) {
+        close(pipes[1]);
+        return -1;
+    }
+    test->rewritefd = pipes[1];
+
+    return child;
+}
+
+
+/** Waits for the forked diff process to finish.
+ */
+
+static int finish_diff(struct test *test, int diffpid)
+{
+    int status;
+    int exitcode;
+
+    close(test->rewritefd);
+
+    status = wait_for_child(diffpid, "diff", NULL);
+    if(status < 0) {
+        return -1;
+    }
+    if(WIFSIGNALED(status)) {
+        fprintf(stderr, "diff terminated by signal %d!\n", WTERMSIG(status));
+        return -1;
+    }
+
+    exitcode = WEXITSTATUS(status);
+
+    // I forget what return code 1 meands but it's harmless
+    // (in gnu diff anyway; dunno about other diffs)
+    if(exitcode != 0 && exitcode != 1) {
+        fprintf(stderr, "diff returned %d!\n", exitcode);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int open_test_file(struct test *test)
+{
+    int fd;
+
+    // If the filename is a dash then we just use stdin.
+    if(is_dash(test->testfile)) {
+        return STDIN_FILENO;
+    }
+
+    fd = open(test->testfile, O_RDONLY|O_CLOEXEC);
+    if(fd < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", test->testfile, strerror(errno));
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static int select_no_pseudo_dirs(const struct dirent *d)
+{
+    if(d->d_name[0] == '.' && d->d_name[1] == '\0') return 0;
+    if(d->d_name[0] == '.' && d->d_name[1] == '.' && d->d_name[2] == '\0') return 0;
+    return 1;
+}
+
+
+/** Lists the files and dirs under stack in msg, "not deleted: a, b".
+ *  Dirs are only listed if they're empty.  If seed isn't NULL, files
+ *  and dirs that are also in seed are expected so they're not listed.
+ *  Neither are the files that the test's FILE sections compared.
+ *
+ *  @returns the number of entries in the dir, or -1 if the test had
+ *  to be aborted.
+ */
+
+static int list_subdirs(struct test *test, struct pathstack *stack, char *start, char *msg, int msgsiz, const char *seed)
+{
+    char seedpath[PATH_MAX];
+    struct stat st;
+    char **ents;
+    char *path;
+    struct pathstate state;
+    int count = 0;
+    int i, subcnt, seeded;
+
+    ents = qscandir(pathstack_absolute(stack), select_no_pseudo_dirs, qdirentcoll);
+    if(!ents) {
+        // qscandir has already printed why
+        return test_abort(test, "Could not scan %s\n", pathstack_absolute(stack));
+    }
+
+    for(i=0; ents[i]; i++) {
+        count += 1;
+        subcnt = 0;
+
+        if(pathstack_push(stack, ents[i], &state) != 0) {
+            count = test_abort(test, "path too long: %s\n", ents[i]);
+            break;
+        }
+        path = pathstack_absolute(stack);
+
+        if(lstat(path, &st) < 0) {
+            count = test_abort(test, "Could not locate %s: %s\n", path, strerror(errno));
+            pathstack_pop(stack, &state);
+            break;
+        }
+
+        if(S_ISDIR(st.st_mode)) {
+            subcnt = list_subdirs(test, stack, start, msg, msgsiz, seed);
+            if(subcnt < 0) {
+                count = -1;
+                pathstack_pop(stack, &state);
+                break;
+            }
+        }
+
+        seeded = (!S_ISDIR(st.st_mode) && test_expects_file(test, start));
+        if(seed && !seeded) {
+            snprintf(seedpath, sizeof(seedpath), "%s/%s", seed, start);
+            seeded = (lstat(seedpath, &st) == 0);
+        }
+
+        if(subcnt == 0 && !seeded) {
+            // only add a dir to the message if it doesn't have any subdirs
+            // we don't care if there's truncation here since it's only being
+            // displayed to the user and the dirs are being deleted anyway.
+            if(msg[0]) {
+                strncat(msg, ", ", msgsiz - strlen(msg) - 1);
+            } else {
+                strncat(msg, "not deleted: ", msgsiz - strlen(msg) - 1);
+            }
+            strncat(msg, start, msgsiz - strlen(msg) - 1);
+        }
+
+        pathstack_pop(stack, &state);
+    }
+
+    for(i=0; ents[i]; i++) {
+        free(ents[i]);
+    }
+    free(ents);
+    return count;
+}
+
+
+/** Returns true if the directory has anything in it, -1 if the test
+ *  had to be aborted.
+ */
+
+static int dir_has_entries(struct test *test, const char *path)
+{
+    struct dirent *entry;
+    DIR *directory;
+    int found = 0;
+
+    directory = opendir(path);
+    if(directory == NULL) {
+        return test_abort(test, "Could not open directory '%s': %s\n",
+                path, strerror(errno));
+    }
+
+    while(!found && (entry = readdir(directory)) != NULL) {
+        found = select_no_pseudo_dirs(entry);
+    }
+
+    closedir(directory);
+    return found;
+}
+
+
+/** Ensures no files or dirs were left behind in the testhome.
+ *  If there were, the testhome is renamed to aside, a fresh one is
+ *  created for the next test, and the test is marked as failed.
+ *  Deleting the old one is up to the caller, usually reaper_queue(),
+ *  so a test that leaves a big tree behind doesn't hold up the run.
+ *  If the testhome was seeded, the files from seed don't count.
+ *
+ *  @returns 1 if the testhome was renamed, 0 if it was empty, -1 if
+ *  the test had to be aborted.
+ */
+
+static int check_testhome(struct runner *r, struct test *test, const char *home, char *aside, int asidesiz, const char *seed)
+{
+    char *buf, *message;
+    char name[32];
+    struct pathstack stack;
+    int found;
+
+    found = dir_has_entries(test, home);
+    if(found <= 0) {
+        return found;
+    }
+
+    snprintf(name, sizeof(name), ASIDENAME "%d", ++r->aside_count);
+    if(cat_path(aside, r->testdir, name, asidesiz) < 0) {
+        return test_abort(test, "path too long: %s/%s\n", r->testdir, name);
+    }
+    if(rename(home, aside) < 0) {
+        return test_abort(test, "Could not rename %s to %s: %s\n", home, aside, strerror(errno));
+    }
+    if(mkdir(home, 0700) < 0) {
+        // aside still has to be deleted.
+        test_abort(test, "Could not create %s: %s\n", home, strerror(errno));
+        return 1;
+    }
+
+    if(test->status == test_was_started) {
+        buf = test_alloc(test, PATH_MAX);
+        message = test_alloc(test, BUFSIZ);
+        if(!buf || !message) {
+            return 1;
+        }
+        if(pathstack_init(&stack, buf, PATH_MAX, aside) != 0) {
+            test_abort(test, "path too long: %s\n", aside);
+            return 1;
+        }
+        message[0] = '\0';
+        if(list_subdirs(test, &stack, buf+strlen(aside)+1, message, BUFSIZ, seed) < 0) {
+            return 1;
+        }
+        if(message[0]) {
+            test->status = test_has_failed;
+            test->status_reason = message;
+        }
+    }
+
+    return 1;
+}
+
+
+/** The finished hook for --isolate.  It runs in the helper, inside the
+ *  test's mount namespace, after the shell has exited, so it sees the
+ *  tmpfs that tmtest can't.  It does what test_compare_results() and
+ *  check_testhome() would do with the files and reports the results
+ *  through the status file.  Only the FILE sections are compared here,
+ *  the rest of the results are compared by tmtest as usual.
+ */
+
+static void finish_isolated_home(const struct isolated_home *home)
+{
+    struct job *job = home->refcon;
+    struct test *test = &job->test;
+    char buf[PATH_MAX], msg[BUFSIZ];
+    struct pathstack stack;
+
+    test->homefd = open(home->path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(test->homefd < 0) {
+        fprintf(stderr, "Could not open %s: %s\n", home->path, strerror(errno));
+        return;
+    }
+
+    // the files that FILE sections name aren't leftovers so the
+    // sections need to be compared before the testhome is listed.
+    if(test_report_files(test, home->hookfd, home->statusfd) < 0 && test->aborted) {
+        return;
+    }
+
+    if(pathstack_init(&stack, buf, sizeof(buf), home->path) != 0) {
+        return;
+    }
+    msg[0] = '\0';
+    if(list_subdirs(test, &stack, buf+strlen(home->path)+1, msg, sizeof(msg), home->seed) > 0 && msg[0]) {
+        dprintf(home->statusfd, "LEFTOVER: %s\n", msg);
+    }
+}
+
+
+// quick sanity check to be absolutely certain we're not starting
+// a test with files and dirs left over from a previous run.
+static int verify_testhome(struct test *test, const char *home)
+{
+    DIR *directory;
+    struct dirent *entry;
+    int err = 0;
+
+    directory = opendir(home);
+    if(directory == NULL) {
+        return test_abort(test, "Could not open directory '%s': %s\n",
+                home, strerror(errno));
+    }
+
+    while(!err && (entry = readdir(directory)) != NULL) {
+        if(select_no_pseudo_dirs(entry)) {
+            err = test_abort(test, "Almost started test with files in %s: %s", home, entry->d_name);
+        }
+    }
+
+    closedir(directory);
+    return err;
+}
+
+
+/** Returns true if the shell is bash and can handle the full template.
+ */
+
+static int is_bash(const char *shell)
+{
+    const char *cp = strrchr(shell, '/');
+    return strncmp(cp ? cp+1 : shell, "bash", 4) == 0;
+}
+
+
+int valid_filename(struct runner *r, const char *name)
+{
+    return is_dash(name) || r->allfiles || strcmpend(name, ".test") == 0;
+}
+
+
+static struct slot* find_free_slot(struct runner *r)
+{
+    int i;
+
+    for(i=0; i<r->nslots; i++) {
+        if(!r->slots[i].busy) {
+            return &r->slots[i];
+        }
+    }
+
+    assert(!"No free slot even though a test was just finished");
+    return NULL;
+}
+
+
+/** Returns the length of the directory part of path.
+ */
+
+static int dir_length(const char *path)
+{
+    const char *cp = strrchr(path, '/');
+    return cp ? cp - path : 0;
+}
+
+
+/** Returns true if the test can't join the pending batch.
+ */
+
+static int batch_mismatch(struct runner *r, const char *shell, const char *path)
+{
+    struct batch *pending = r->pending;
+    int len;
+
+    if(strcmp(pending->shell, shell) != 0) {
+        return 1;
+    }
+
+    if(r->dir_shell) {
+        len = dir_length(path);
+        if(strlen(pending->dir) != len || strncmp(pending->dir, path, len) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/** Adds the test to the pending batch.  Its script is generated when
+ *  the batch is launched.  Returns -1 if the test had to be aborted.
+ */
+
+static int add_to_batch(struct runner *r, struct job *job, const char *shell,
+        const struct template_segment *tmpl, int tmplcnt)
+{
+    struct batch *pending = r->pending;
+    int len;
+
+    if(!pending->njobs) {
+        copy_string(pending->shell, shell, sizeof(pending->shell));
+        pending->tmpl = tmpl;
+        pending->tmplcnt = tmplcnt;
+        if(r->dir_shell) {
+            len = dir_length(job->test.testpath);
+            if(len >= sizeof(pending->dir)) {
+                return test_abort(&job->test, "path too long: %s\n", job->test.testpath);
+            }
+            memcpy(pending->dir, job->test.testpath, len);
+            pending->dir[len] = '\0';
+        }
+    }
+    pending->jobs[pending->njobs++] = job;
+    return 0;
+}
+
+
+/** Generates the script for every test in the pending batch.  When
+ *  batching, each test runs in a subshell that moves to the test's
+ *  home and closes every other test's capture files, then the
+ *  subshell's exit status is written to the test's status file.
+ *
+ *  With --dir-shell, the part of the template that reads the config
+ *  files is run only once, before the first subshell.  Its status
+ *  goes to the prologue file of the last test in the batch since that
+ *  slot is the last to be freed.  Each subshell moves its own status
+ *  file onto the prologue's fd so ABORT and DISABLED still work and
+ *  the test sees no fds but its own.
+ */
+
+static int batch_script(struct runner *r, struct script *sc)
+{
+    struct batch *pending = r->pending;
+    struct slot *last = pending->jobs[pending->njobs-1]->slot;
+    struct slot *slot;
+    int subshell = (r->batch_size > 1 || r->dir_shell);
+    struct test *test;
+    int i, j, start = 0;
+    int statusfd, err;
+
+    script_reset(sc);
+
+    if(r->dir_shell) {
+        start = find_teststart(pending->tmpl, pending->tmplcnt);
+        if(reset_fd(last->prologuefd, "config status") < 0) {
+            return -1;
+        }
+        test = &pending->jobs[0]->test;
+        statusfd = test->statusfd;
+        test->statusfd = last->prologuefd;
+        err = expand_template(test, pending->tmpl, start, sc);
+        test->statusfd = statusfd;
+        if(err < 0) {
+            return -1;
+        }
+    }
+
+    for(j=0; j<pending->njobs; j++) {
+        test = &pending->jobs[j]->test;
+        if(subshell) {
+            script_printf(sc, "(\ncd '%s' || exit 1\nexec",
+                    pending->jobs[j]->slot->home);
+            for(i=0; i<pending->njobs; i++) {
+                slot = pending->jobs[i]->slot;
+                if(i != j) {
+                    script_printf(sc, " %d>&- %d>&- %d>&-",
+                            slot->outfd, slot->errfd, slot->statusfd);
+                }
+            }
+            // the status file moves to the prologue's fd, which is the
+            // one the ABORT and DISABLED functions write to.
+            if(r->dir_shell) {
+                script_printf(sc, " %d>&%d %d>&-", last->prologuefd,
+                        test->statusfd, test->statusfd);
+                test->prologuefd = last->prologuefd;
+            }
+            script_printf(sc, "\n");
+        }
+
+        statusfd = test->statusfd;
+        if(r->dir_shell) {
+            test->statusfd = last->prologuefd;
+        }
+        err = expand_template(test, pending->tmpl + start, pending->tmplcnt - start, sc);
+        test->statusfd = statusfd;
+        if(err < 0) {
+            return -1;
+        }
+
+        if(subshell) {
+            script_printf(sc, ")\necho \"EXIT: $?\" >&%d\n", test->statusfd);
+        }
+    }
+
+    return 0;
+}
+
+
+/** Starts a shell and sends it the scripts for all pending tests.
+ *
+ * set up the pipe to feed input to the child.
+ * ignore sigpipes since we don't want a signal raised if child
+ * quits early (which almost always happens since it exits before
+ * it reads its expected stdout/stderr).
+ *
+ * If the shell can't be started, the pending tests are dropped.
+ */
+
+static int launch_batch(struct runner *r)
+{
+    struct batch *pending = r->pending;
+    const char *shell = pending->shell;
+    struct isolated_home *homes;
+    struct slot *slot;
+    char *argv[3];
+    int *keep;
+    int nkeep = 0;
+    int pipes[2];
+    int child;
+    double t;
+    int i, err;
+
+    if(!pending->njobs) {
+        return 0;
+    }
+
+    t = prof_start(&r->prof);
+    err = batch_script(r, &pending->script);
+    prof_stop(&r->prof, prof_template, t);
+    if(err < 0) {
+        for(i=0; i<pending->njobs; i++) {
+            if(pending->jobs[i]->test.aborted) {
+                fprintf(stderr, "Test aborted: %s\n", pending->jobs[i]->test.status_reason);
+            }
+        }
+        pending->njobs = 0;
+        return -1;
+    }
+
+    if(pipe2(pipes, O_CLOEXEC) < 0) {
+        perror("creating test pipe");
+        pending->njobs = 0;
+        return -1;
+    }
+
+    // the tests only get to see their own capture files.
+    keep = malloc((3*pending->njobs + 1) * sizeof(int));
+    if(!keep) {
+        perror("allocating fds");
+        close(pipes[0]);
+        close(pipes[1]);
+        pending->njobs = 0;
+        return -1;
+    }
+    for(i=0; i<pending->njobs; i++) {
+        slot = pending->jobs[i]->slot;
+        keep[nkeep++] = slot->outfd;
+        keep[nkeep++] = slot->errfd;
+        keep[nkeep++] = slot->statusfd;
+    }
+    // with --dir-shell, the config files report to the last test's slot.
+    slot = pending->jobs[pending->njobs-1]->slot;
+    if(slot->prologuefd >= 0) {
+        keep[nkeep++] = slot->prologuefd;
+    }
+
+    // start the shell
+    t = prof_start(&r->prof);
+    for(i=0; i<pending->njobs; i++) {
+        perf_start(&pending->jobs[i]->sample);
+    }
+    argv[0] = (char*)shell;
+    argv[1] = "-s";
+    argv[2] = NULL;
+    if(r->isolate) {
+        child = -1;
+        homes = malloc(pending->njobs * sizeof(struct isolated_home));
+        if(!homes) {
+            perror("allocating homes");
+        } else {
+            for(i=0; i<pending->njobs; i++) {
+                homes[i].path = pending->jobs[i]->slot->home;
+                homes[i].statusfd = pending->jobs[i]->slot->statusfd;
+                homes[i].seed = (pending->jobs[i]->snap ? pending->jobs[i]->snap->path : NULL);
+                homes[i].finished = finish_isolated_home;
+                homes[i].refcon = pending->jobs[i];
+                // the testfile, so the hook can read the FILE sections.
+                homes[i].hookfd = pending->jobs[i]->testfd;
+                if(homes[i].hookfd < 0 && !(pending->jobs[i]->src && pending->jobs[i]->src->data)) {
+                    homes[i].hookfd = STDIN_FILENO;
+                }
+            }
+            child = isolate_spawn(shell, argv, pipes[0], keep, nkeep,
+                    homes, pending->njobs);
+            free(homes);
+            if(child < 0) {
+                perror("forking test");
+            }
+        }
+    } else {
+        child = spawn_child(shell, argv, pipes[0], keep, nkeep,
+                pending->jobs[0]->slot->home, 1);
+    }
+    free(keep);
+
+    // set up the pipes for the parent
+    prof_stop(&r->prof, prof_fork, t);
+    close(pipes[0]);
+    if(child < 0) {
+        close(pipes[1]);
+        pending->njobs = 0;
+        return -1;
+    }
+    for(i=0; i<pending->njobs; i++) {
+        pending->jobs[i]->child = child;
+    }
+
+    // write the test scripts to the kid
+    t = prof_start(&r->prof);
+    err = write_script(&pending->script, pipes[1], pending->jobs[0]->test.testfile);
+    close(pipes[1]);
+    prof_stop(&r->prof, prof_template, t);
+
+    pending->njobs = 0;
+    return err;
+}
+
+
+static void release_snapshot(struct runner *r, struct snapshot *snap)
+{
+    snap->refs -= 1;
+    if(snap->refs == 0) {
+        if(snap->path[0]) {
+            reaper_queue(&r->reaper, snap->path);
+        }
+        free(snap);
+    }
+}
+
+
+/** Runs the directory's tmtest.setup in a new, empty dir.  It reads
+ *  the same config files the tests do first.  Like the config files,
+ *  its stdout goes to stderr so it can't get mixed into a rewritten
+ *  testfile.  If a config file aborts or disables the test, the setup
+ *  isn't run; the test will find that out for itself.  Returns -1 if
+ *  the test had to be aborted.
+ */
+
+static int run_setup(struct runner *r, struct test *test,
+        struct snapshot *snap, const char *setup, const char *shell)
+{
+    char name[32], path[PATH_MAX];
+    struct script sc;
+    char *argv[5];
+    char *cmd;
+    int child, fd, err;
+
+    snprintf(name, sizeof(name), SNAPNAME "%d", ++r->snapshot_count);
+    if(cat_path(snap->path, r->testdir, name, sizeof(snap->path)) < 0) {
+        snap->path[0] = '\0';
+        return test_abort(test, "path too long: %s/%s\n", r->testdir, name);
+    }
+    if(mkdir(snap->path, 0700) < 0) {
+        // there's nothing for release_snapshot() to delete.
+        err = errno;
+        copy_string(path, snap->path, sizeof(path));
+        snap->path[0] = '\0';
+        return test_abort(test, "couldn't create %s: %s\n", path, strerror(err));
+    }
+
+    script_init(&sc);
+    script_printf(&sc, "exec >&2\n"
+            "ABORT () { exit 0; }\n"
+            "DISABLED () { exit 0; }\n"
+            "DISABLE () { exit 0; }\n");
+    if(setup_config_files(test, &sc) < 0) {
+        script_free(&sc);
+        return -1;
+    }
+    script_printf(&sc, ". \"$0\"\n");
+    cmd = script_string(&sc);
+    script_free(&sc);
+    if(!cmd) {
+        return test_abort(test, "allocating %s script: %s\n", SETUP_FILE, strerror(errno));
+    }
+
+    fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+    if(fd < 0) {
+        free(cmd);
+        return test_abort(test, "opening /dev/null: %s\n", strerror(errno));
+    }
+
+    argv[0] = (char*)shell;
+    argv[1] = "-c";
+    argv[2] = cmd;
+    argv[3] = (char*)setup;
+    argv[4] = NULL;
+    child = spawn_child(shell, argv, fd, NULL, 0, snap->path, 0);
+    close(fd);
+    free(cmd);
+    if(child < 0) {
+        return test_abort(test, "Could not run %s\n", setup);
+    }
+
+    snap->status = wait_for_child(child, SETUP_FILE, NULL);
+    if(snap->status < 0) {
+        return test_abort(test, "Could not run %s\n", setup);
+    }
+
+    return 0;
+}
+
+
+/** Returns the snapshot that the test's home should be seeded with.
+ *  The first time a directory's test asks, its tmtest.setup is run.
+ *  Tests are run directory by directory so only the last directory's
+ *  snapshot needs to be remembered.  Returns NULL with the test
+ *  aborted if the snapshot couldn't be made.
+ */
+
+static struct snapshot* find_snapshot(struct runner *r, struct test *test, const char *shell)
+{
+    char setup[PATH_MAX];
+    struct snapshot *snap;
+    const char *cp;
+    int len;
+
+    cp = strrchr(test->testpath, '/');
+    len = (cp ? cp - test->testpath : 0);
+    if(len >= sizeof(snap->dir)) {
+        return NULL;
+    }
+
+    if(r->cur_snapshot && len == strlen(r->cur_snapshot->dir) &&
+            memcmp(r->cur_snapshot->dir, test->testpath, len) == 0) {
+        return r->cur_snapshot;
+    }
+
+    if(r->cur_snapshot) {
+        release_snapshot(r, r->cur_snapshot);
+        r->cur_snapshot = NULL;
+    }
+    snap = calloc(1, sizeof(struct snapshot));
+    if(!snap) {
+        test_abort(test, "allocating snapshot: %s\n", strerror(errno));
+        return NULL;
+    }
+    memcpy(snap->dir, test->testpath, len);
+    snap->dir[len] = '\0';
+    snap->refs = 1;
+    r->cur_snapshot = snap;
+
+    if(cat_path(setup, snap->dir, SETUP_FILE, sizeof(setup)) == 0 && file_exists(setup)) {
+        if(run_setup(r, test, snap, setup, shell) < 0) {
+            return NULL;
+        }
+    }
+
+    return snap;
+}
+
+
+/** Gives the test's home a copy of the tree its directory's
+ *  tmtest.setup built.  If tmtest.setup failed, the job is marked
+ *  finished and failed instead, the same way static_disabled() does.
+ *
+ *  @returns 1 if the test shouldn't be run, -1 if it was aborted.
+ */
+
+static int seed_testhome(struct runner *r, struct job *job, const char *shell)
+{
+    struct test *test = &job->test;
+    struct snapshot *snap;
+    char buf[64];
+
+    snap = find_snapshot(r, test, shell);
+    if(test->aborted) {
+        return -1;
+    }
+    if(!snap || !snap->path[0]) {
+        return 0;
+    }
+
+    if(snap->status != 0) {
+        if(WIFEXITED(snap->status)) {
+            snprintf(buf, sizeof(buf), "exited with status %d", WEXITSTATUS(snap->status));
+        } else {
+            snprintf(buf, sizeof(buf), "terminated by signal %d", WTERMSIG(snap->status));
+        }
+        test->status = test_has_failed;
+        test->status_reason = test_alloc(test, strlen(SETUP_FILE) + strlen(buf) + 2);
+        if(!test->status_reason) {
+            return -1;
+        }
+        sprintf(test->status_reason, SETUP_FILE " %s", buf);
+        job->skipped = 1;
+        job->reaped = 1;
+        job->child = -1;
+        return 1;
+    }
+
+    // with --isolate, the copy goes in the testhome's tmpfs instead.
+    if(!r->isolate && snapshot_copy(snap->path, job->slot->home) < 0) {
+        return test_abort(test, "Could not copy %s to %s\n", snap->path, job->slot->home);
+    }
+    job->snap = snap;
+    snap->refs += 1;
+    return 0;
+}
+
+
+/** Checks whether the test is unconditionally disabled, either by
+ *  a config file or by the testfile itself, without running a shell.
+ *  If so, the job is marked finished with the same results the shell
+ *  would have produced.  See parse_disabled() for what qualifies.
+ *  Returns -1 if the test was aborted.
+ */
+
+static int static_disabled(struct job *job)
+{
+    struct test *test = &job->test;
+    const char *path, *reason;
+    char *buf;
+    char *treason = NULL;
+    ssize_t cnt;
+    int disabled = 0;
+    int inert;
+
+    path = config_disabled(test, &reason, &inert);
+    if(test->aborted) {
+        return -1;
+    }
+    if(path) {
+        test->status = config_was_disabled;
+        test->last_file_processed = arena_strdup(test->arena, path);
+        test->status_reason = (reason ? arena_strdup(test->arena, reason) : NULL);
+    } else {
+        // the config files run first and could keep the test from
+        // disabling itself.
+        if(!inert) {
+            return 0;
+        }
+        // stdin can't be rewound so tests read from it are left alone.
+        if(job->src && job->src->data) {
+            disabled = parse_disabled(job->src->data, job->src->len, &treason);
+        } else if(job->testfd >= 0) {
+            buf = test_alloc(test, BUFSIZ);
+            if(!buf) {
+                return -1;
+            }
+            cnt = pread(job->testfd, buf, BUFSIZ, 0);
+            disabled = (cnt > 0 && parse_disabled(buf, cnt, &treason));
+        }
+        if(!disabled) {
+            return 0;
+        }
+        test->status = test_was_disabled;
+        test->last_file_processed = arena_strdup(test->arena, test->testfile);
+        if(treason) {
+            test->status_reason = arena_strdup(test->arena, treason);
+            free(treason);
+        }
+    }
+
+    job->skipped = 1;
+    job->reaped = 1;
+    job->child = -1;
+    return 1;
+}
+
+
+/** Frees everything the job holds and gives its slot and arena back.
+ */
+
+static void free_job(struct runner *r, struct job *job)
+{
+    struct arena *arena = job->test.arena;
+
+    // only happens if the test couldn't be finished.
+    if(job->diffpid > 0) {
+        close(job->test.rewritefd);
+        waitpid(job->diffpid, NULL, 0);
+    }
+
+    // if we had to open the testfile to read it, we now close it.
+    // because the scanner is statically allocated, there's no
+    // need to destroy it.
+    if(job->testfd >= 0) {
+        close(job->testfd);
+    }
+
+    if(job->snap) {
+        release_snapshot(r, job->snap);
+    }
+
+    test_free(&job->test);
+    if(job->slot) {
+        job->slot->busy = 0;
+    }
+
+    // the job itself is in the arena.
+    arena_reset(arena);
+    arena->next_free = r->free_arenas;
+    r->free_arenas = arena;
+}
+
+
+/** Frees a job that couldn't be run or finished.  If test_abort()
+ *  recorded why, the reason is printed first.
+ */
+
+static void drop_job(struct runner *r, struct job *job)
+{
+    if(job->test.aborted) {
+        fprintf(stderr, "Test aborted: %s\n", job->test.status_reason);
+    }
+    free_job(r, job);
+}
+
+
+/** Returns an empty arena for a test.  Arenas are reused so, once
+ *  enough are allocated for all the tests that run at once, tests can
+ *  start and finish without calling malloc.
+ */
+
+static struct arena* get_arena(struct runner *r)
+{
+    struct arena *arena = r->free_arenas;
+
+    if(arena) {
+        r->free_arenas = arena->next_free;
+    } else {
+        arena = malloc(sizeof(struct arena));
+        if(arena) {
+            arena_init(arena);
+        }
+    }
+
+    return arena;
+}
+
+
+/** Starts the named testfile running.
+ *
+ * When config files are executing, they use the standard stdout
+ * and stderr.  That way, the user sees any output while the test
+ * is running (should help with debugging).  However, when the
+ * test itself is running, its output is redirected into outfd/errfd.
+ *
+ * It may appear that outmode_dump mixes stdio and Unix I/O, but it
+ * doesn't really.  We only print to stdio when testing, and we only
+ * dump the file when dumping.  They cannot both happen simultaneously.
+ *
+ * @param src if non-null, the test is scanned from this in-memory copy
+ *   of the testfile rather than being opened again.
+ * @returns the job that needs to be passed to finish_test(), or NULL
+ *   if there was an error.
+ */
+
+static struct job* start_test(struct runner *r, const char *abspath,
+        const char *relpath, struct testsrc *src)
+{
+    struct arena *arena;
+    struct job *job;
+    struct test *test;
+    const struct template_segment *tmpl;
+    const char *shell;
+    int tmplcnt;
+    int i, err;
+    double t;
+
+    // defined in template.c and template-posix.c, generated by cstrfy.
+    extern const struct template_segment exec_template[];
+    extern const int exec_template_count;
+    extern const struct template_segment posix_template[];
+    extern const int posix_template_count;
+
+    arena = get_arena(r);
+    job = (arena ? arena_calloc(arena, sizeof(struct job)) : NULL);
+    if(!job) {
+        fprintf(stderr, "out of memory allocating test\n");
+        if(arena) {
+            arena->next_free = r->free_arenas;
+            r->free_arenas = arena;
+        }
+        return NULL;
+    }
+    job->test.arena = arena;
+    job->testfd = -1;
+    job->abspath = arena_strdup(arena, abspath);
+    job->relpath = arena_strdup(arena, relpath);
+    if(!job->abspath || !job->relpath) {
+        fprintf(stderr, "out of memory allocating test\n");
+        free_job(r, job);
+        return NULL;
+    }
+    job->slot = find_free_slot(r);
+    job->slot->busy = 1;
+    job->src = src;
+
+    test = &job->test;
+    test_init(test, &r->test_opts, &r->counts, arena);
+
+    test->testfile = job->relpath;
+    test->testpath = job->abspath;
+    test->outfd = job->slot->outfd;
+    test->errfd = job->slot->errfd;
+    test->fd3fd = job->slot->fd3fd;
+    test->fd3name = job->slot->fd3name;
+    test->statusfd = job->slot->statusfd;
+
+    t = prof_start(&r->prof);
+    err = verify_testhome(test, job->slot->home);
+    prof_stop(&r->prof, prof_verify, t);
+    if(err < 0) {
+        drop_job(r, job);
+        return NULL;
+    }
+
+    // initialize the test mode
+    switch(r->outmode) {
+        case outmode_test:
+            // nothing to do
+            break;
+        case outmode_dump:
+            test->rewritefd = STDOUT_FILENO;
+            test->rewrite_golden = 1;
+            break;
+        case outmode_diff:
+            job->diffpid = start_diff(r, test);
+            if(job->diffpid < 0) {
+                job->diffpid = 0;
+                drop_job(r, job);
+                return NULL;
+            }
+            break;
+        default:
+            assert(!"Unhandled outmode 1 in start_test()");
+    }
+
+    // reset the stdout, stderr, and fd 3 capture files.
+    if(reset_fd(test->outfd, "stdout") < 0 ||
+            reset_fd(test->errfd, "stderr") < 0 ||
+            reset_fd(test->fd3fd, "fd3") < 0 ||
+            reset_fd(test->statusfd, "status") < 0) {
+        free_job(r, job);
+        return NULL;
+    }
+
+    // create the testfile scanner.  it will either scan from
+    // the testfile itself or from stdin if filename is "-".
+    if(src && src->data) {
+        readmem_init(&test->testscanner, src->data, src->len);
+    } else {
+        scanstate_init(&test->testscanner, job->scanbuf, sizeof(job->scanbuf));
+        if(test->diffname) {
+            if(lseek(test->diff_fd, 0, SEEK_SET) < 0) {
+                fprintf(stderr, "Couldn't seek to start of %s: %s\n",
+                        test->diffname, strerror(errno));
+                free_job(r, job);
+                return NULL;
+            }
+            readfd_attach(&test->testscanner, test->diff_fd);
+        } else {
+            i = open_test_file(test);
+            if(i < 0) {
+                free_job(r, job);
+                return NULL;
+            }
+            if(i != STDIN_FILENO) {
+                job->testfd = i;
+            }
+            readfd_attach(&test->testscanner, i);
+        }
+    }
+    tfscan_attach(&test->testscanner);
+
+    // tests that are disabled before they do anything don't need a shell.
+    if(r->outmode == outmode_test && !r->dumpscript) {
+        err = static_disabled(job);
+        if(err < 0) {
+            drop_job(r, job);
+            return NULL;
+        }
+        if(err) {
+            return job;
+        }
+    }
+
+    // bash gets the full template, other shells get the POSIX one.
+    shell = config_shell(test);
+    if(test->aborted) {
+        drop_job(r, job);
+        return NULL;
+    }
+    if(!shell) {
+        shell = r->shell_prog;
+    }
+    if(is_bash(shell)) {
+        tmpl = exec_template;
+        tmplcnt = exec_template_count;
+    } else {
+        tmpl = posix_template;
+        tmplcnt = posix_template_count;
+    }
+
+    if(!r->dumpscript) {
+        err = seed_testhome(r, job, shell);
+        if(err < 0) {
+            drop_job(r, job);
+            return NULL;
+        }
+        if(err) {
+            return job;
+        }
+    }
+
+    if(r->dumpscript) {
+        fflush(stdout);
+        script_reset(&r->pending->script);
+        if(expand_template(test, tmpl, tmplcnt, &r->pending->script) < 0 ||
+                write_script(&r->pending->script, STDOUT_FILENO, test->testfile) < 0) {
+            drop_job(r, job);
+            return NULL;
+        }
+        // don't want to print a summary of the tests run so make
+        // sure tmtest realizes it's dumping a test.
+        r->outmode = outmode_dump;
+        return job;
+    }
+
+    // a batch is run by a single shell (in a single directory
+    // with --dir-shell).
+    if(r->pending->njobs && batch_mismatch(r, shell, test->testpath)) {
+        if(launch_batch(r) < 0) {
+            free_job(r, job);
+            return NULL;
+        }
+    }
+    if(add_to_batch(r, job, shell, tmpl, tmplcnt) < 0) {
+        drop_job(r, job);
+        return NULL;
+    }
+    if(r->pending->njobs >= r->batch_size) {
+        if(launch_batch(r) < 0) {
+            free_job(r, job);
+            return NULL;
+        }
+    }
+
+    return job;
+}
+
+
+static void reaped_job(struct job *job, int status, struct rusage *ru, int batchcnt)
+{
+    job->status = status;
+    job->reaped = 1;
+    perf_stop(&job->sample, ru);
+
+    // we can only time the whole batch so each test gets an equal share.
+    job->sample.wall /= batchcnt;
+    job->sample.cpu /= batchcnt;
+}
+
+
+/** Marks every test that was run by the given shell as reaped.
+ *  job is the test being finished, NULL if none.
+ */
+
+static void reaped_child(struct runner *r, int pid, int status, struct rusage *ru, struct job *job)
+{
+    int count = (job ? 1 : 0);
+    int i;
+
+    for(i=0; i<r->nrunning; i++) {
+        count += (r->running[i]->child == pid);
+    }
+
+    if(job) {
+        reaped_job(job, status, ru, count);
+    }
+    for(i=0; i<r->nrunning; i++) {
+        if(r->running[i]->child == pid) {
+            reaped_job(r->running[i], status, ru, count);
+        }
+    }
+}
+
+
+/** Returns a pidfd for the given child, or -1 if the kernel is too
+ *  old to have them.
+ */
+
+static int open_pidfd(int pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+/** Waits for any of the running tests to finish.  This way a test's
+ *  time is accurate even when it finishes before the tests ahead of it.
+ *
+ *  Only this runner's shells are waited for, never wait(-1), so other
+ *  runners and the program that embeds us keep their own children.
+ *  A pidfd is polled for each shell.  Without pidfds we fall back to
+ *  waiting for the oldest test's shell.
+ */
+
+static int reap_any_job(struct runner *r)
+{
+    struct pollfd fds[r->nrunning];
+    int pids[r->nrunning];
+    struct rusage ru;
+    int pid, status;
+    int oldest = 0;
+    int nfds = 0;
+    int i, j, err;
+    double t;
+
+    for(i=0; i<r->nrunning; i++) {
+        pid = r->running[i]->child;
+        if(pid <= 0 || r->running[i]->reaped) {
+            continue;
+        }
+        // every test in a batch shares the same shell.
+        for(j=0; j<nfds && pids[j] != pid; j++)
+            ;
+        if(j < nfds) {
+            continue;
+        }
+        fds[nfds].fd = open_pidfd(pid);
+        if(fds[nfds].fd < 0) {
+            // no pidfds so wait for this one, the oldest left.
+            for(j=0; j<nfds; j++) {
+                close(fds[j].fd);
+            }
+            nfds = 0;
+            oldest = pid;
+            break;
+        }
+        fds[nfds].events = POLLIN;
+        fds[nfds].revents = 0;
+        pids[nfds++] = pid;
+    }
+    if(!oldest && nfds == 0) {
+        return 0;
+    }
+
+    t = prof_start(&r->prof);
+    if(oldest) {
+        do {
+            err = wait4(oldest, &status, 0, &ru);
+        } while(err < 0 && errno == EINTR && !r->interrupted);
+    } else {
+        do {
+            err = poll(fds, nfds, -1);
+        } while(err < 0 && errno == EINTR && !r->interrupted);
+    }
+    prof_stop(&r->prof, prof_wait, t);
+
+    for(i=0; i<nfds; i++) {
+        close(fds[i].fd);
+    }
+    if(err < 0 && r->interrupted) {
+        return -1;
+    }
+    if(err < 0) {
+        fprintf(stderr, "Error waiting for tests to finish: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if(oldest) {
+        if(check_child_status(status, "test") < 0) {
+            return -1;
+        }
+        reaped_child(r, oldest, status, &ru, NULL);
+        return 0;
+    }
+
+    for(i=0; i<nfds; i++) {
+        if(!fds[i].revents) {
+            continue;
+        }
+        pid = wait4(pids[i], &status, WNOHANG, &ru);
+        if(pid < 0) {
+            fprintf(stderr, "Error waiting for tests to finish: %s\n", strerror(errno));
+            return -1;
+        }
+        if(pid > 0) {
+            if(check_child_status(status, "test") < 0) {
+                return -1;
+            }
+            reaped_child(r, pid, status, &ru, NULL);
+        }
+    }
+
+    return 0;
+}
+
+
+/** Kills a test that won't be finished, along with anything else
+ *  running in its shell, and frees it without printing any results.
+ */
+
+static void abort_job(struct runner *r, struct job *job)
+{
+    struct batch *pending = r->pending;
+    int i;
+
+    // it may not have been handed to a shell yet.
+    for(i=0; pending && i<pending->njobs; i++) {
+        if(pending->jobs[i] == job) {
+            pending->njobs -= 1;
+            memmove(pending->jobs+i, pending->jobs+i+1,
+                    (pending->njobs - i) * sizeof(struct job*));
+            break;
+        }
+    }
+
+    // the shells have their own process groups so the terminal's
+    // SIGINT didn't reach them.
+    if(job->child > 0) {
+        kill(-job->child, SIGKILL);
+        while(waitpid(-job->child, NULL, 0) > 0 || errno == EINTR) {
+            // wait for every one of them to die
+        }
+    }
+    free_job(r, job);
+}
+
+
+/** Waits for a started test to finish and prints its results.
+ *
+ * @returns 1 if we should keep testing, 0 if we should stop now,
+ *   -1 if there was an error.
+ */
+
+static int finish_test(struct runner *r, struct job *job)
+{
+    struct test *test = &job->test;
+    struct testsrc *src = job->src;
+    struct rusage ru;
+    char *leftover, *aside;
+    int moved = 0;
+    int keepontruckin = 0;
+    int status;
+    double t;
+    int i, err;
+
+    if(!r->dumpscript) {
+        // a skipped test already has its results, it never ran.
+        if(!job->skipped) {
+            // wait for the test to finish
+            if(!job->reaped) {
+                t = prof_start(&r->prof);
+                status = wait_for_child(job->child, "test", &ru);
+                prof_stop(&r->prof, prof_wait, t);
+                if(status < 0) {
+                    abort_job(r, job);
+                    return -1;
+                }
+                reaped_child(r, job->child, status, &ru, job);
+            }
+            test->exitsignal = (WIFSIGNALED(job->status) ? WTERMSIG(job->status) : 0);
+            test->exitcored = (WIFSIGNALED(job->status) ? WCOREDUMP(job->status) : 0);
+            test->exitno = (WIFEXITED(job->status) ? WEXITSTATUS(job->status) : 256);
+
+            // tests in a batch share a shell so the first one to finish
+            // is blamed for anything the shell left running.
+            leftover = test_alloc(test, BUFSIZ);
+            if(!leftover) {
+                goto aborted;
+            }
+            leftover[0] = '\0';
+            if(!job->swept) {
+                t = prof_start(&r->prof);
+                sweep_processes(r, job->child, leftover, BUFSIZ);
+                prof_stop(&r->prof, prof_settle, t);
+                for(i=0; i<r->nrunning; i++) {
+                    if(r->running[i]->child == job->child) {
+                        r->running[i]->swept = 1;
+                    }
+                }
+            }
+
+            // read the status file to determine what happened
+            // and store the information in the test struct.
+            t = prof_start(&r->prof);
+            err = scan_status_file(test);
+            prof_stop(&r->prof, prof_status, t);
+            if(err < 0) {
+                goto aborted;
+            }
+
+            if(leftover[0] && test->status == test_was_started) {
+                test->status = test_has_failed;
+                test->status_reason = leftover;
+            }
+
+            // FILE sections read from the testhome after check_testhome()
+            // may have moved it aside so hang onto the directory itself.
+            test->homefd = open(job->slot->home, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+            if(test->homefd < 0) {
+                test_abort(test, "Could not open %s: %s\n", job->slot->home, strerror(errno));
+                goto aborted;
+            }
+
+            // the files that FILE sections name aren't leftovers so the
+            // sections need to be read before the testhome is checked.
+            if(r->outmode == outmode_test) {
+                t = prof_start(&r->prof);
+                err = test_compare_results(test);
+                prof_stop(&r->prof, prof_results, t);
+                if(err < 0) {
+                    goto aborted;
+                }
+            }
+
+            t = prof_start(&r->prof);
+            aside = test_alloc(test, PATH_MAX);
+            if(!aside) {
+                goto aborted;
+            }
+            moved = check_testhome(r, test, job->slot->home, aside, PATH_MAX,
+                    (job->snap ? job->snap->path : NULL));
+            prof_stop(&r->prof, prof_testhome, t);
+            if(test->aborted) {
+                if(moved > 0) {
+                    reaper_queue(&r->reaper, aside);
+                }
+                goto aborted;
+            }
+        }
+
+        // process and output the test results
+        t = prof_start(&r->prof);
+        err = 0;
+        switch(r->outmode) {
+            case outmode_test:
+                err = test_results(test);
+                break;
+            case outmode_dump:
+                err = dump_results(test);
+                break;
+            case outmode_diff:
+                err = dump_results(test);
+                if(err < 0) {
+                    break;
+                }
+                err = finish_diff(test, job->diffpid);
+                job->diffpid = 0;
+                break;
+            default:
+                assert(!"Unhandled outmode 2 in finish_test()");
+        }
+        prof_stop(&r->prof, prof_results, t);
+        if(err < 0) {
+            if(moved) {
+                reaper_queue(&r->reaper, aside);
+            }
+            goto aborted;
+        }
+
+        if(moved && r->keep_failed && test->failed) {
+            r->kept_count += 1;
+            if(r->test_opts.verbose) {
+                printf("     testhome kept in %s\n", aside);
+            }
+        } else if(moved) {
+            reaper_queue(&r->reaper, aside);
+        }
+
+        if((r->record_perf || src) && was_started(test->status) && !was_disabled(test->status)) {
+            perf_record(&r->perf, test->testfile, &job->sample, test->failed);
+        }
+        if(src) {
+            src->runs += 1;
+            src->failures += test->failed;
+        }
+        if(r->finished) {
+            r->finished(r, test);
+        }
+
+        keepontruckin = !was_aborted(test->status);
+    }
+
+    free_job(r, job);
+    return keepontruckin;
+
+aborted:
+    drop_job(r, job);
+    return -1;
+}
+
+
+/** Processes the results of the oldest running test.
+ *  Results are always printed in the order the tests were started.
+ */
+
+static int finish_oldest_test(struct runner *r)
+{
+    struct job *job = r->running[0];
+    int result;
+
+    assert(r->nrunning > 0);
+
+    // the test can't finish if it hasn't been handed to a shell yet.
+    if(!job->child && launch_batch(r) < 0) {
+        return -1;
+    }
+
+    // with one slot there's nothing else to wait for.
+    if(r->nslots > 1) {
+        while(!job->reaped) {
+            if(reap_any_job(r) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    r->nrunning -= 1;
+    memmove(r->running, r->running+1, r->nrunning * sizeof(struct job*));
+
+    result = finish_test(r, job);
+    if(result == 0) {
+        r->stop_testing = 1;
+    }
+
+    return result < 0 ? -1 : 0;
+}
+
+
+/** Processes the results of every test that's still running.
+ *
+ *  @returns 0, or -1 if there was an error.
+ */
+
+int runner_finish(struct runner *r)
+{
+    while(r->nrunning) {
+        if(finish_oldest_test(r) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/** Runs the named testfile.  If there are free slots, this returns as
+ *  soon as the test is started.  Otherwise it processes the results of
+ *  the oldest running test to make room.
+ *
+ * @returns 1 if we should keep testing, 0 if we should stop now,
+ *   -1 if there was an error.
+ */
+
+static int run_test(struct runner *r, const char *abspath, const char *relpath,
+        struct testsrc *src)
+{
+    struct job *job;
+
+    if(r->interrupted) {
+        return -1;
+    }
+
+    job = start_test(r, abspath, relpath, src);
+    if(!job) {
+        return -1;
+    }
+
+    r->running[r->nrunning++] = job;
+    while(r->nrunning >= r->nslots) {
+        if(finish_oldest_test(r) < 0) {
+            return -1;
+        }
+    }
+
+    return !r->stop_testing;
+}
+
+
+/** Reads the entire testfile into memory so repeated runs don't
+ *  need to open and read it again.  If it can't be read, data is
+ *  left NULL and each run will report the error itself.
+ */
+
+static void load_testsrc(struct testsrc *src, const char *path)
+{
+    struct stat st;
+    ssize_t cnt;
+    size_t len = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY|O_CLOEXEC);
+    if(fd < 0) {
+        return;
+    }
+
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        // The scanners may peek one byte past the end of their data.
+        // The extra byte keeps them inside the buffer.
+        src->data = malloc(st.st_size + 1);
+        if(src->data) {
+            while(len < st.st_size) {
+                cnt = read(fd, src->data + len, st.st_size - len);
+                if(cnt < 0 && errno == EINTR) continue;
+                if(cnt <= 0) break;
+                len += cnt;
+            }
+            src->data[len] = '\0';
+            src->len = len;
+        }
+    }
+
+    close(fd);
+}
+
+
+/** Runs the test repeat_count times, or until it fails if until_fail
+ *  is set.  Returns 0 if a run asked us to stop testing, 1 if we
+ *  should keep going, -1 if there was an error.
+ */
+
+int runner_run_test(struct runner *r, const char *abspath, const char *relpath)
+{
+    struct testsrc src;
+    int keepontruckin = 1;
+    int i;
+
+    if(!valid_filename(r, abspath)) {
+        return 1;
+    }
+
+    // so that we can safely single quote filenames in the shell.
+    if(strchr(abspath, '\'') || strchr(abspath, '"')) {
+        fprintf(stderr, "%s was skipped because its file name contains a quote character.\n", relpath);
+        return 1;
+    }
+
+    if(r->repeat_count == 1 && !r->until_fail) {
+        return run_test(r, abspath, relpath, NULL);
+    }
+
+    memset(&src, 0, sizeof(src));
+    load_testsrc(&src, abspath);
+
+    for(i=0; (r->repeat_count == 0 || i < r->repeat_count) && keepontruckin > 0; i++) {
+        if(r->until_fail && src.failures) {
+            break;
+        }
+        keepontruckin = run_test(r, abspath, relpath, &src);
+    }
+
+    // src is about to go away so all its runs need to be finished.
+    // If that fails, the ones that are left are killed instead.
+    while(r->nrunning && r->running[r->nrunning-1]->src == &src) {
+        if(keepontruckin >= 0 && finish_oldest_test(r) < 0) {
+            keepontruckin = -1;
+        }
+        if(keepontruckin < 0 && r->nrunning &&
+                r->running[r->nrunning-1]->src == &src) {
+            r->nrunning -= 1;
+            abort_job(r, r->running[r->nrunning]);
+        }
+    }
+    free(src.data);
+
+    if(keepontruckin < 0) {
+        return -1;
+    }
+    return keepontruckin && !r->stop_testing;
+}
+
+
+/** Returns the name that the test at path should be printed with,
+ *  or NULL if it couldn't be figured out.
+ */
+
+const char* runner_display_name(struct runner *r, const char *path,
+        int print_absolute, char *buf, int bufsiz)
+{
+    if(print_absolute) {
+        return path;
+    }
+
+    // We do the treewalk using absolute paths so that ../.. and friends
+    // don't mess us up and we don't walk off the end of a string.
+    // Need to convert back to relative before running the test.
+
+    if(!abs2rel(path, r->orig_cwd, buf, bufsiz)) {
+        fprintf(stderr, "Could not convert %s to relative from %s\n", path, r->orig_cwd);
+        return NULL;
+    }
+
+    return buf;
+}
+
+
+static int process_file(struct runner *r, const char *path, int print_absolute)
+{
+    char buf[PATH_MAX];
+    const char *relpath;
+
+    relpath = runner_display_name(r, path, print_absolute, buf, sizeof(buf));
+    if(!relpath) {
+        return -1;
+    }
+    if(r->found_test && valid_filename(r, path)) {
+        r->found_test(r, path, relpath);
+    }
+    return runner_run_test(r, path, relpath);
+}
+
+
+/** Returns 1 if path is a file, 0 if not, or -1 if it can't be read.
+ */
+
+int is_file(const char *path)
+{
+    struct stat st;
+
+    if(stat(path, &st) < 0) {
+        fprintf(stderr, "Could not locate %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if(!i_have_permission(&st, 0444)) {
+        fprintf(stderr, "Could not open %s: permission denied!\n", path);
+        return -1;
+    }
+
+    return S_ISREG(st.st_mode);
+}
+
+
+/** This routine filters out any dirents that begin with '.'.
+ *  We don't want to process any hidden files or special directories.
+ */
+
+static int select_nodots(const struct dirent *d)
+{
+    // common case: if the filename doesn't begin with a dot, use it.
+    if(d->d_name[0] != '.') {
+        return 1;
+    }
+
+    // otherwise, ignore it.
+    return 0;
+}
+
+
+static void shift_down(char **entry)
+{
+    do {
+        entry[0] = entry[1];
+    } while(*entry++);
+}
+
+
+/** Runs all tests in the current directory and all its subdirectories.
+ *  This routine operates on absolute paths and then converts back
+ *  to relative so that paths are always normalized properly.
+ */
+
+static int process_directory(struct runner *r, struct pathstack *ps, int print_absolute)
+{
+    int keepontruckin = 1;
+    char **entries, **entry;
+    struct pathstate save;
+    double t;
+    int isfile;
+
+    if(r->found_dir) {
+        r->found_dir(r, pathstack_absolute(ps), print_absolute);
+    }
+
+    t = prof_start(&r->prof);
+    entries = qscandir(pathstack_absolute(ps), select_nodots, qdirentcoll);
+    if(!entries) {
+        // qscandir has already printed the error message
+        return -1;
+    }
+    prof_stop(&r->prof, prof_discovery, t);
+
+    // first process files in dir
+    for(entry=entries; *entry && keepontruckin > 0; ) {
+        if(pathstack_push(ps, *entry, &save) != 0) {
+            fprintf(stderr, "path too long: %s\n", *entry);
+            keepontruckin = -1;
+            break;
+        }
+        isfile = is_file(pathstack_absolute(ps));
+        if(isfile < 0) {
+            keepontruckin = -1;
+        } else if(isfile) {
+            keepontruckin = process_file(r, pathstack_absolute(ps), print_absolute);
+            free(*entry);
+            shift_down(entry);
+        } else {
+            entry += 1;
+        }
+        pathstack_pop(ps, &save);
+    }
+
+    // then process the subdirectories
+    for(entry=entries; *entry; entry++) {
+        if(keepontruckin > 0) {
+            if(pathstack_push(ps, *entry, &save) != 0) {
+                fprintf(stderr, "path too long: %s\n", *entry);
+                keepontruckin = -1;
+            } else {
+                keepontruckin = process_directory(r, ps, print_absolute);
+                pathstack_pop(ps, &save);
+            }
+        }
+        free(*entry);
+    }
+
+    free(entries);
+    return keepontruckin;
+}
+
+
+/** Runs the testfile at path, or every testfile under it if it's a
+ *  directory.  Relative paths are relative to orig_cwd.
+ *
+ *  @returns 1 to keep testing, 0 to stop, -1 if there was an error.
+ */
+
+int runner_run_path(struct runner *r, const char *path)
+{
+    char buf[PATH_MAX];
+    struct pathstack stack;
+    int print_absolute = 0;
+    int isfile;
+
+    if(is_dash(path)) {
+        return run_test(r, path, path, NULL);
+    }
+
+    if(path[0] == '/') {
+        print_absolute = 1;
+        if(pathstack_init(&stack, buf, sizeof(buf), path)) {
+            fprintf(stderr, "path too long: %s\n", path);
+            return -1;
+        }
+    } else {
+        if(pathstack_init(&stack, buf, sizeof(buf), r->orig_cwd)) {
+            fprintf(stderr, "path too long: %s\n", r->orig_cwd);
+            return -1;
+        }
+        pathstack_push(&stack, path, NULL);
+    }
+
+    // nasty hack to normalize the path
+    normalize_absolute_path(buf);
+    stack.curlen = strlen(buf);
+
+    isfile = is_file(buf);
+    if(isfile < 0) {
+        return -1;
+    }
+    if(isfile) {
+        // make sure user gets a reason if a test is explicitly named on the cmdline but not run
+        if(!valid_filename(r, path)) {
+            fprintf(stderr, "%s was skipped because it doesn't end in '.test'.\n", path);
+        }
+
+        return process_file(r, buf, print_absolute);
+    } else {
+        return process_directory(r, &stack, print_absolute);
+    }
+}
+
+
+/** Runs every testfile under orig_cwd.
+ */
+
+int runner_run_tree(struct runner *r)
+{
+    char buf[PATH_MAX];
+    struct pathstack pathstack;
+
+    if(pathstack_init(&pathstack, buf, sizeof(buf), r->orig_cwd)) {
+        fprintf(stderr, "path too long: %s\n", r->orig_cwd);
+        return -1;
+    }
+
+    return process_directory(r, &pathstack, 0);
+}
+
+
+static void checkerr(int err, const char *op, const char *name)
+{
+    if(err < 0) {
+        fprintf(stderr, "There was an error %s %s: %s\n",
+                op, name, strerror(errno));
+        // not much else we can do other than complain...
+    }
+}
+
+
+/** Closes and deletes whatever start_slot() managed to create, so it
+ *  also cleans up after a slot that only got partway started.
+ */
+
+static void stop_slot(struct runner *r, struct slot *slot)
+{
+    struct { int fd; const char *name; } files[] = {
+        { slot->outfd, slot->outname },
+        { slot->errfd, slot->errname },
+        { slot->fd3fd, slot->fd3name },
+        { slot->statusfd, slot->statusname },
+        { slot->prologuefd, slot->prologuename },
+    };
+    int i;
+
+    for(i=0; i<sizeof(files)/sizeof(files[0]); i++) {
+        if(files[i].fd >= 0) {
+            checkerr(close(files[i].fd), "closing", files[i].name);
+            checkerr(unlink(files[i].name), "deleting", files[i].name);
+        }
+    }
+
+    // the test already ensured this dir is empty
+    if(slot->home[0]) {
+        checkerr(rmdir(slot->home), "deleting", slot->home);
+    }
+
+    if(slot != &r->slots[0]) {
+        checkerr(rmdir(slot->dir), "removing directory", slot->dir);
+    }
+}
+
+
+/** Gets ready for another round of tests.  The counts start from zero
+ *  and tmtest.setup is run again since it may have changed.
+ */
+
+void runner_new_round(struct runner *r)
+{
+    if(r->cur_snapshot) {
+        release_snapshot(r, r->cur_snapshot);
+        r->cur_snapshot = NULL;
+    }
+
+    memset(&r->counts, 0, sizeof(r->counts));
+    r->stop_testing = 0;
+    gettimeofday(&r->start_time, NULL);
+}
+
+
+/** Removes the testdir and frees everything runner_start() set up.
+ *  This may be called after runner_start() or any other runner
+ *  function fails, in which case any tests that are still running
+ *  are killed.  It isn't safe to call from a signal handler; set
+ *  r->interrupted instead and call it once the runner returns.
+ */
+
+void runner_stop(struct runner *r)
+{
+    struct arena *arena;
+    int i;
+
+    gettimeofday(&r->stop_time, NULL);
+
+    for(i=0; i<r->nrunning; i++) {
+        abort_job(r, r->running[i]);
+    }
+    r->nrunning = 0;
+
+    while(r->free_arenas) {
+        arena = r->free_arenas;
+        r->free_arenas = arena->next_free;
+        arena_free(arena);
+        free(arena);
+    }
+
+    if(r->cur_snapshot) {
+        release_snapshot(r, r->cur_snapshot);
+        r->cur_snapshot = NULL;
+    }
+
+    // the testhomes that were renamed aside must be gone before we
+    // can remove the testdir.
+    reaper_stop(&r->reaper);
+
+    for(i=0; i<r->nslots; i++) {
+        stop_slot(r, &r->slots[i]);
+    }
+    r->nslots = 0;
+
+    if(r->testdir[0] && !r->kept_count) {
+        checkerr(rmdir(r->testdir), "removing directory", r->testdir);
+    }
+
+    config_cache_free(r->test_opts.configs);
+    r->test_opts.configs = NULL;
+    free(r->slots);
+    r->slots = NULL;
+    free(r->running);
+    r->running = NULL;
+    if(r->pending) {
+        script_free(&r->pending->script);
+        free(r->pending->jobs);
+        free(r->pending);
+        r->pending = NULL;
+    }
+}
+
+
+/** Creates the capture files and testhome for a slot in dir.
+ */
+
+static int start_slot(struct runner *r, struct slot *slot, const char *dir)
+{
+    char home[PATH_MAX];
+    int ok;
+
+    copy_string(slot->dir, dir, sizeof(slot->dir));
+    if(slot != &r->slots[0] && mkdir(slot->dir, 0700) < 0) {
+        fprintf(stderr, "couldn't create %s: %s\n", slot->dir, strerror(errno));
+        return -1;
+    }
+
+    slot->outfd = -1;
+    slot->errfd = -1;
+    slot->fd3fd = -1;
+    slot->statusfd = -1;
+    slot->prologuefd = -1;
+    slot->home[0] = '\0';
+
+    // errors are printed by open_file.
+    slot->outfd = open_file(slot->outname, sizeof(slot->outname), dir, OUTNAME, 0);
+    if(slot->outfd >= 0) {
+        slot->errfd = open_file(slot->errname, sizeof(slot->errname), dir, ERRNAME, 0);
+    }
+    if(slot->errfd >= 0) {
+        slot->statusfd = open_file(slot->statusname, sizeof(slot->statusname), dir, STATUSNAME, O_APPEND);
+    }
+    // the shell opens fd3 by name so its fd isn't passed to the tests
+    // and its number doesn't matter.
+    if(slot->statusfd >= 0) {
+        slot->fd3fd = open_file(slot->fd3name, sizeof(slot->fd3name), dir, FD3NAME, 0);
+    }
+    ok = (slot->fd3fd >= 0);
+    if(ok && r->dir_shell) {
+        slot->prologuefd = open_file(slot->prologuename, sizeof(slot->prologuename), dir, PROLOGUENAME, O_APPEND);
+        ok = (slot->prologuefd >= 0);
+    }
+
+    if(ok && cat_path(home, dir, TESTHOME, sizeof(home)) < 0) {
+        fprintf(stderr, "path too long: %s/%s\n", dir, TESTHOME);
+        ok = 0;
+    }
+    if(ok && mkdir(home, 0700) < 0) {
+        fprintf(stderr, "couldn't create %s: %s\n", home, strerror(errno));
+        ok = 0;
+    }
+    if(!ok) {
+        stop_slot(r, slot);
+        return -1;
+    }
+
+    copy_string(slot->home, home, sizeof(slot->home));
+    return 0;
+}
+
+
+/** Returns the number of slots that fit in our fd limit.  Each slot
+ *  holds its capture files open for the whole run, and the tests
+ *  themselves need a few more while they're being started and checked.
+ */
+
+static int max_slots(struct runner *r)
+{
+    struct rlimit rl;
+    int per_slot = (r->dir_shell ? 5 : 4);
+
+    if(getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur == RLIM_INFINITY ||
+            rl.rlim_cur > INT_MAX) {
+        return INT_MAX;
+    }
+    if(rl.rlim_cur < SLOT_FD_RESERVE + per_slot) {
+        return 1;
+    }
+    return (rl.rlim_cur - SLOT_FD_RESERVE) / per_slot;
+}
+
+
+/** Fills in the default options.
+ */
+
+void runner_init(struct runner *r)
+{
+    memset(r, 0, sizeof(struct runner));
+    r->outmode = outmode_test;
+    r->jobs = 1;
+    r->grace = 1000;
+    r->repeat_count = 1;
+    r->shell_prog = SHPROG;
+}
+
+
+/** Prepare system for running tests.
+ *
+ * The caller must ignore SIGPIPE first, otherwise a shell that exits
+ * early kills us when we write the rest of its script.  The caller
+ * should also make itself a subreaper (PR_SET_CHILD_SUBREAPER) so
+ * anything a test leaves running is reparented to us rather than
+ * init and sweep_processes() can wait for it.
+ *
+ * Each slot does all I/O for all of its tests through only four file
+ * descriptors.  We seek to the beginning of each file before running
+ * each test.  This should save some inode thrashing.
+ *
+ * @returns 0, or -1 if the tests can't be run.  Either way, call
+ *   runner_stop() when done.
+ */
+
+int runner_start(struct runner *r)
+{
+    char buf[PATH_MAX];
+    int i, count;
+
+    if(reaper_start(&r->reaper) < 0) {
+        // reaper_start has already printed the error message
+        return -1;
+    }
+
+    memcpy(r->testdir, TESTDIR, sizeof(r->testdir));
+    if(!mkdtemp(r->testdir)) {
+        fprintf(stderr, "Could not call mkdtemp() on %s: %s\n", r->testdir, strerror(errno));
+        r->testdir[0] = '\0';
+        return -1;
+    }
+
+    // rewriting testfiles has to happen one test at a time.
+    if(r->outmode != outmode_test || r->dumpscript) {
+        r->jobs = 1;
+        r->batch_size = 1;
+        r->dir_shell = 0;
+    }
+
+    if(!r->batch_size) {
+        r->batch_size = (r->dir_shell ? DIR_BATCH : 1);
+    }
+    // shrink the batches rather than running out of fds partway.
+    count = max_slots(r);
+    if(r->jobs * r->batch_size > count) {
+        r->batch_size = (count / r->jobs > 0 ? count / r->jobs : 1);
+    }
+
+    r->test_opts.configs = config_cache_new();
+    if(!r->test_opts.configs) {
+        perror("allocating config cache");
+        return -1;
+    }
+
+    if(r->isolate && isolate_check() < 0) {
+        // isolate_check has already printed the error message
+        return -1;
+    }
+
+    // every test in every batch needs its own slot.
+    count = r->jobs * r->batch_size;
+    r->slots = calloc(count, sizeof(struct slot));
+    r->running = calloc(count, sizeof(struct job*));
+    r->pending = calloc(1, sizeof(struct batch));
+    if(r->pending) {
+        r->pending->jobs = calloc(r->batch_size, sizeof(struct job*));
+    }
+    if(!r->slots || !r->running || !r->pending || !r->pending->jobs) {
+        perror("allocating slots");
+        return -1;
+    }
+
+    for(i=0; i<count; i++) {
+        if(i == 0) {
+            copy_string(buf, r->testdir, sizeof(buf));
+        } else {
+            snprintf(buf, sizeof(buf), "%s/%d", r->testdir, i);
+        }
+        if(start_slot(r, &r->slots[i], buf) < 0) {
+            return -1;
+        }
+        r->nslots += 1;
+    }
+
+    gettimeofday(&r->start_time, NULL);
+    return 0;
+}
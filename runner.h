@@ -0,0 +1,110 @@
+/* runner.h
+ * 18 Oct 2026
+ *
+ * Runs testfiles and collects their results.  See runner.c.
+ * This file is covered by the MIT License.
+ */
+
+#include <sys/time.h>
+#include <signal.h>
+
+
+struct test;
+struct slot;
+struct batch;
+struct snapshot;
+struct job;
+struct arena;
+
+
+// The testdir contains fifos, tempfiles, etc for running the tests.
+#define TESTDIR "/tmp/tmtest-XXXXXX"
+
+// the shell used unless tmtest.conf says otherwise
+#define SHPROG "/bin/bash"
+
+// tmtest runs this once per directory and every test in the directory
+// starts with a copy of what it left in its cwd.
+#define SETUP_FILE "tmtest.setup"
+
+
+/** What to do with each test's results.
+ */
+
+enum outmode {
+    outmode_test,       ///< print whether the test passed
+    outmode_dump,       ///< print the testfile with the actual results
+    outmode_diff        ///< print a diff between the expected and actual results
+};
+
+
+/** Everything needed to run a series of tests.  Each runner has its
+ *  own testdir, slots, results, and reaper thread so a program can run
+ *  more than one at a time, each on its own thread.  Set the options
+ *  after runner_init() and before runner_start().
+ *
+ *  Include test.h, perf.h, prof.h, and reaper.h before this file.
+ */
+
+struct runner {
+    // options
+    enum outmode outmode;
+    int allfiles;               ///< run a testfile even if it doesn't end in .test
+    int dumpscript;             ///< print the script instead of running it
+    int jobs;                   ///< number of tests that may run at once
+    int batch_size;             ///< number of tests to send to each shell.  0 picks a default.
+    int dir_shell;              ///< read the config files once per directory
+    int isolate;                ///< run each shell in its own namespaces
+    int grace;                  ///< ms to wait for background processes to exit
+    int keep_failed;            ///< don't delete the testhomes of failed tests
+    int repeat_count;           ///< run each test this many times, 0 means forever
+    int until_fail;             ///< stop repeating a test once it fails
+    int record_perf;            ///< pass every test's timings to perf_record()
+    const char *shell_prog;     ///< default shell, tmtest.conf may override it
+    struct test_options test_opts;  ///< passed on to every test.  runner_start() sets up configs.
+    const char *orig_cwd;       ///< relative paths are relative to this
+
+    // hooks, any of which may be NULL
+    void (*found_test)(struct runner *r, const char *abspath, const char *relpath);
+    void (*found_dir)(struct runner *r, const char *path, int print_absolute);
+    void (*finished)(struct runner *r, struct test *test);
+    void *refcon;               ///< for use by the hooks
+
+    // results
+    struct test_counts counts;
+    int stop_testing;           ///< set once a test asks us to stop testing (i.e. it was aborted)
+    volatile sig_atomic_t interrupted;  ///< may be set by a signal handler.  makes the runner functions return -1.
+    int kept_count;             ///< the number of testhomes kept for keep_failed
+    struct perf perf;           ///< every test's timings if record_perf is set.  free with perf_free().
+    struct prof prof;           ///< time spent in each phase, call prof_enable() to collect it
+    struct timeval start_time;
+    struct timeval stop_time;
+
+    // the rest is private to runner.c
+    char testdir[sizeof(TESTDIR)];
+    struct slot *slots;
+    int nslots;
+    struct batch *pending;
+    struct snapshot *cur_snapshot;
+    int snapshot_count;
+    struct job **running;       ///< tests that are running, oldest first
+    int nrunning;
+    struct arena *free_arenas;  ///< arenas left by finished tests, ready for the next ones
+    int aside_count;
+    struct reaper reaper;
+};
+
+
+void runner_init(struct runner *r);
+int runner_start(struct runner *r);
+int runner_run_path(struct runner *r, const char *path);
+int runner_run_tree(struct runner *r);
+int runner_run_test(struct runner *r, const char *abspath, const char *relpath);
+int runner_finish(struct runner *r);
+void runner_new_round(struct runner *r);
+void runner_stop(struct runner *r);
+
+const char* runner_display_name(struct runner *r, const char *path,
+        int print_absolute, char *buf, int bufsiz);
+int valid_filename(struct runner *r, const char *name);
+int is_file(const char *path);
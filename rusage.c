@@ -18,6 +18,25 @@
 #include "rusage.h"
 
 
+// the children's times when rusage_mark() was called.
+static double mark_user, mark_sys;
+
+
+/** Makes the next print_rusage() only count what the children have
+ *  used from now on.  --watch prints a summary after each round.
+ */
+
+void rusage_mark()
+{
+    struct rusage child;
+
+    if(getrusage(RUSAGE_CHILDREN, &child) == 0) {
+        mark_user = child.ru_utime.tv_sec + child.ru_utime.tv_usec / 1000000.0;
+        mark_sys = child.ru_stime.tv_sec + child.ru_stime.tv_usec / 1000000.0;
+    }
+}
+
+
 void print_rusage(struct timeval *start_tv, struct timeval *stop_tv)
 {
     // struct rusage self;
@@ -40,9 +59,9 @@ void print_rusage(struct timeval *start_tv, struct timeval *stop_tv)
     double stop = stop_tv->tv_sec + stop_tv->tv_usec / 1000000.0;
 
 //  double uself = self.ru_utime.tv_sec + self.ru_utime.tv_usec / 1000000.0;
-    double uchild = child.ru_utime.tv_sec + child.ru_utime.tv_usec / 1000000.0;
+    double uchild = child.ru_utime.tv_sec + child.ru_utime.tv_usec / 1000000.0 - mark_user;
 //  double sself = self.ru_stime.tv_sec + self.ru_stime.tv_usec / 1000000.0;
-    double schild = child.ru_stime.tv_sec + child.ru_stime.tv_usec / 1000000.0;
+    double schild = child.ru_stime.tv_sec + child.ru_stime.tv_usec / 1000000.0 - mark_sys;
 //  double total = uchild + schild;
     double total = stop - start;
 
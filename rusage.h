@@ -1 +1,2 @@
+void rusage_mark();
 void print_rusage(struct timeval *start, struct timeval *stop);
@@ -0,0 +1,334 @@
+/* script.c
+ * 18 Oct 2026
+ *
+ * Gathers the pieces of a test script so it can be sent to the
+ * shell in a single writev.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file script.c
+ *
+ * A script is a list of iovecs.  Text that will stay put until the
+ * script is written (the template's literals) is referenced where it
+ * lies.  Text that won't (formatted numbers, config file lines, the
+ * command section as it passes through the scan buffer) is copied
+ * into blocks owned by the script.  Blocks are never reallocated so
+ * the iovecs that point into them stay valid.
+ *
+ * script_reset() keeps the blocks and the iovec array around so,
+ * after the first few tests, building a script doesn't allocate.
+ *
+ * Errors are sticky: once an allocation fails, the rest of the calls
+ * do nothing and script_write() returns the error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "script.h"
+
+
+#define SCRIPT_BLOCK_SIZE 4096
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+
+struct script_block {
+    struct script_block *next;
+    size_t size;        ///< number of bytes in data
+    size_t used;        ///< number of bytes of data that are in use
+    char data[1];
+};
+
+
+void script_init(struct script *sc)
+{
+    memset(sc, 0, sizeof(*sc));
+}
+
+
+/** Empties the script so it can be reused for the next test.
+ */
+
+void script_reset(struct script *sc)
+{
+    struct script_block *blk;
+
+    for(blk=sc->blocks; blk; blk=blk->next) {
+        blk->used = 0;
+    }
+    sc->curblock = sc->blocks;
+    sc->niov = 0;
+    sc->error = 0;
+}
+
+
+void script_free(struct script *sc)
+{
+    struct script_block *blk, *next;
+
+    for(blk=sc->blocks; blk; blk=next) {
+        next = blk->next;
+        free(blk);
+    }
+    free(sc->iov);
+    script_init(sc);
+}
+
+
+static struct iovec* new_iov(struct script *sc)
+{
+    struct iovec *iov;
+    int max;
+
+    if(sc->niov >= sc->maxiov) {
+        max = sc->maxiov ? sc->maxiov * 2 : 64;
+        iov = realloc(sc->iov, max * sizeof(struct iovec));
+        if(!iov) {
+            sc->error = ENOMEM;
+            return NULL;
+        }
+        sc->iov = iov;
+        sc->maxiov = max;
+    }
+
+    return &sc->iov[sc->niov++];
+}
+
+
+/** Adds text to the script without copying it.  The text must not
+ *  change until the script has been written.
+ */
+
+void script_add(struct script *sc, const char *text, size_t len)
+{
+    struct iovec *iov;
+
+    if(sc->error || len == 0) {
+        return;
+    }
+
+    iov = new_iov(sc);
+    if(iov) {
+        iov->iov_base = (void*)text;
+        iov->iov_len = len;
+    }
+}
+
+
+/** Returns room for len bytes, in the current block if it fits,
+ *  otherwise in the first unused block that's big enough or a new one.
+ */
+
+static char* reserve(struct script *sc, size_t len)
+{
+    struct script_block *blk, **link;
+    size_t size;
+
+    blk = sc->curblock;
+    if(blk && blk->size - blk->used >= len) {
+        return blk->data + blk->used;
+    }
+
+    // blocks after curblock are empty.  find one that's big enough.
+    link = (sc->curblock ? &sc->curblock->next : &sc->blocks);
+    for(blk=*link; blk; link=&blk->next, blk=blk->next) {
+        if(blk->used == 0 && blk->size >= len) {
+            break;
+        }
+    }
+
+    if(!blk) {
+        size = (len > SCRIPT_BLOCK_SIZE ? len : SCRIPT_BLOCK_SIZE);
+        blk = malloc(sizeof(struct script_block) + size);
+        if(!blk) {
+            sc->error = ENOMEM;
+            return NULL;
+        }
+        blk->size = size;
+        blk->used = 0;
+        blk->next = NULL;
+        *link = blk;
+    }
+
+    sc->curblock = blk;
+    return blk->data;
+}
+
+
+/** Records that len bytes were added at ptr in the current block.
+ *  If they directly follow the previous piece of the script, the two
+ *  are merged into one iovec.
+ */
+
+static void commit(struct script *sc, char *ptr, size_t len)
+{
+    struct iovec *iov;
+
+    sc->curblock->used += len;
+
+    if(sc->niov) {
+        iov = &sc->iov[sc->niov-1];
+        if((char*)iov->iov_base + iov->iov_len == ptr) {
+            iov->iov_len += len;
+            return;
+        }
+    }
+
+    iov = new_iov(sc);
+    if(iov) {
+        iov->iov_base = ptr;
+        iov->iov_len = len;
+    }
+}
+
+
+/** Copies text into the script.  Use this when the text might change
+ *  before the script is written.
+ */
+
+void script_copy(struct script *sc, const char *text, size_t len)
+{
+    char *ptr;
+
+    if(sc->error || len == 0) {
+        return;
+    }
+
+    ptr = reserve(sc, len);
+    if(ptr) {
+        memcpy(ptr, text, len);
+        commit(sc, ptr, len);
+    }
+}
+
+
+void script_printf(struct script *sc, const char *fmt, ...)
+{
+    va_list ap;
+    char *ptr;
+    int len;
+
+    if(sc->error) {
+        return;
+    }
+
+    // try to format straight into the current block.
+    ptr = reserve(sc, 1);
+    if(!ptr) {
+        return;
+    }
+    va_start(ap, fmt);
+    len = vsnprintf(ptr, sc->curblock->size - sc->curblock->used, fmt, ap);
+    va_end(ap);
+    if(len < 0) {
+        sc->error = EINVAL;
+        return;
+    }
+
+    if(len >= sc->curblock->size - sc->curblock->used) {
+        // didn't fit.  reserve enough room (plus the NUL) and do it again.
+        ptr = reserve(sc, len + 1);
+        if(!ptr) {
+            return;
+        }
+        va_start(ap, fmt);
+        vsnprintf(ptr, len + 1, fmt, ap);
+        va_end(ap);
+    }
+
+    commit(sc, ptr, len);
+}
+
+
+size_t script_length(const struct script *sc)
+{
+    size_t len = 0;
+    int i;
+
+    for(i=0; i<sc->niov; i++) {
+        len += sc->iov[i].iov_len;
+    }
+
+    return len;
+}
+
+
+/** Returns the script as a single string for sh -c, or NULL if it
+ *  couldn't be allocated.  Free it with free().
+ */
+
+char* script_string(const struct script *sc)
+{
+    char *str, *cp;
+    int i;
+
+    if(sc->error) {
+        errno = sc->error;
+        return NULL;
+    }
+
+    str = malloc(script_length(sc) + 1);
+    if(!str) {
+        return NULL;
+    }
+    cp = str;
+    for(i=0; i<sc->niov; i++) {
+        memcpy(cp, sc->iov[i].iov_base, sc->iov[i].iov_len);
+        cp += sc->iov[i].iov_len;
+    }
+    *cp = '\0';
+
+    return str;
+}
+
+
+/** Writes the entire script to fd.  Consumes the iovecs so call
+ *  script_reset() before building the next script.
+ *
+ *  @returns 0 on success or the errno of the failure.  EPIPE just
+ *  means the shell exited before reading the whole script, which
+ *  happens whenever a config file calls ABORT or DISABLED.
+ */
+
+int script_write(struct script *sc, int fd)
+{
+    struct iovec *iov = sc->iov;
+    int niov = sc->niov;
+    ssize_t cnt;
+
+    if(sc->error) {
+        return sc->error;
+    }
+
+    while(niov > 0) {
+        cnt = writev(fd, iov, (niov > IOV_MAX ? IOV_MAX : niov));
+        if(cnt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        // skip past whatever was written.  might be a partial iovec.
+        while(niov > 0 && cnt >= iov->iov_len) {
+            cnt -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if(niov > 0) {
+            iov->iov_base = (char*)iov->iov_base + cnt;
+            iov->iov_len -= cnt;
+        }
+    }
+
+    return 0;
+}
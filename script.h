@@ -0,0 +1,36 @@
+/* script.h
+ * 18 Oct 2026
+ *
+ * Gathers the pieces of a test script so it can be sent to the
+ * shell in a single writev.  See script.c.
+ * This file is covered by the MIT License.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+struct script_block;
+
+struct script {
+    struct iovec *iov;
+    int niov;
+    int maxiov;
+    struct script_block *blocks;    ///< holds the text that had to be copied
+    struct script_block *curblock;  ///< the block currently being filled
+    int error;                      ///< errno of the first failure, 0 if none
+};
+
+
+void script_init(struct script *sc);
+void script_reset(struct script *sc);
+void script_free(struct script *sc);
+
+void script_add(struct script *sc, const char *text, size_t len);
+void script_copy(struct script *sc, const char *text, size_t len);
+void script_printf(struct script *sc, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+size_t script_length(const struct script *sc);
+char* script_string(const struct script *sc);
+int script_write(struct script *sc, int fd);
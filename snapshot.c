@@ -0,0 +1,209 @@
+/* snapshot.c
+ * 18 Oct 2026
+ *
+ * Copies a directory tree as cheaply as the filesystem allows.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file snapshot.c
+ *
+ * Each test in a directory with a tmtest.setup starts with a copy of
+ * the tree that tmtest.setup built (see seed_testhome() in runner.c).  Files are reflinked
+ * with FICLONE when the filesystem supports it so they share blocks
+ * until the test writes to them.  Otherwise the kernel copies them
+ * with copy_file_range(), and if even that isn't supported, we do it
+ * ourselves.
+ *
+ * Files are never hardlinked: a test that appended to a hardlinked
+ * file would change the snapshot for every test that runs after it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "snapshot.h"
+
+
+static int copy_error(const char *what, const char *name)
+{
+    fprintf(stderr, "Could not %s %s: %s\n", what, name, strerror(errno));
+    return -1;
+}
+
+
+/** Copies the data from one open file to another.
+ */
+
+static int copy_data(int infd, int outfd, off_t size, const char *name)
+{
+    char buf[BUFSIZ];
+    ssize_t cnt, wcnt;
+
+#ifdef FICLONE
+    if(ioctl(outfd, FICLONE, infd) == 0) {
+        return 0;
+    }
+#endif
+
+    while(size > 0) {
+        cnt = copy_file_range(infd, NULL, outfd, NULL, size, 0);
+        if(cnt <= 0) {
+            break;
+        }
+        size -= cnt;
+    }
+    if(size <= 0) {
+        return 0;
+    }
+
+    // copy_file_range isn't supported here.  do whatever is left by hand.
+    while((cnt = read(infd, buf, sizeof(buf))) > 0) {
+        wcnt = write(outfd, buf, cnt);
+        if(wcnt != cnt) {
+            return copy_error("write", name);
+        }
+    }
+    if(cnt < 0) {
+        return copy_error("read", name);
+    }
+
+    return 0;
+}
+
+
+static int copy_file(int srcdir, int dstdir, const char *name, const struct stat *st)
+{
+    int infd, outfd;
+    int err;
+
+    infd = openat(srcdir, name, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+    if(infd < 0) {
+        return copy_error("open", name);
+    }
+    outfd = openat(dstdir, name, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC, st->st_mode & 07777);
+    if(outfd < 0) {
+        close(infd);
+        return copy_error("create", name);
+    }
+
+    err = copy_data(infd, outfd, st->st_size, name);
+
+    close(infd);
+    close(outfd);
+    return err;
+}
+
+
+static int copy_dir(int srcdir, const char *srcname, int dstdir, const char *dstname);
+
+
+static int copy_entry(int srcdir, int dstdir, const char *name)
+{
+    char target[PATH_MAX];
+    struct stat st;
+    ssize_t len;
+
+    if(fstatat(srcdir, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+        return copy_error("stat", name);
+    }
+
+    if(S_ISREG(st.st_mode)) {
+        return copy_file(srcdir, dstdir, name, &st);
+    }
+
+    if(S_ISDIR(st.st_mode)) {
+        // we need to be able to write the dir even if the copy can't.
+        if(mkdirat(dstdir, name, 0700) < 0) {
+            return copy_error("create", name);
+        }
+        if(copy_dir(srcdir, name, dstdir, name) < 0) {
+            return -1;
+        }
+        if(fchmodat(dstdir, name, st.st_mode & 07777, 0) < 0) {
+            return copy_error("chmod", name);
+        }
+        return 0;
+    }
+
+    if(S_ISLNK(st.st_mode)) {
+        len = readlinkat(srcdir, name, target, sizeof(target) - 1);
+        if(len < 0) {
+            return copy_error("read link", name);
+        }
+        target[len] = '\0';
+        if(symlinkat(target, dstdir, name) < 0) {
+            return copy_error("create link", name);
+        }
+        return 0;
+    }
+
+    fprintf(stderr, "Could not copy %s: not a file, dir, or symlink\n", name);
+    return -1;
+}
+
+
+/** Copies the contents of the dir srcname in srcdir to the empty dir
+ *  dstname in dstdir.
+ */
+
+static int copy_dir(int srcdir, const char *srcname, int dstdir, const char *dstname)
+{
+    struct dirent *ent;
+    int infd, outfd;
+    int err = 0;
+    DIR *dir;
+
+    infd = openat(srcdir, srcname, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if(infd < 0) {
+        return copy_error("open", srcname);
+    }
+    outfd = openat(dstdir, dstname, O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+    if(outfd < 0) {
+        close(infd);
+        return copy_error("open", dstname);
+    }
+    dir = fdopendir(infd);
+    if(!dir) {
+        close(infd);
+        close(outfd);
+        return copy_error("read", srcname);
+    }
+
+    while(!err && (ent = readdir(dir)) != NULL) {
+        if(ent->d_name[0] == '.' && (ent->d_name[1] == '\0' ||
+                (ent->d_name[1] == '.' && ent->d_name[2] == '\0'))) {
+            continue;
+        }
+        err = copy_entry(dirfd(dir), outfd, ent->d_name);
+    }
+
+    closedir(dir);
+    close(outfd);
+    return err;
+}
+
+
+/** Copies everything in the directory src into the existing empty
+ *  directory dst.
+ *
+ *  @returns 0 on success, -1 if not (and the reason was printed).
+ */
+
+int snapshot_copy(const char *src, const char *dst)
+{
+    return copy_dir(AT_FDCWD, src, AT_FDCWD, dst) < 0 ? -1 : 0;
+}
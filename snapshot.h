@@ -0,0 +1,10 @@
+/* snapshot.h
+ * 18 Oct 2026
+ *
+ * Copies a directory tree as cheaply as the filesystem allows.
+ * See snapshot.c.
+ * This file is covered by the MIT License.
+ */
+
+
+int snapshot_copy(const char *src, const char *dst);
@@ -1,4 +1,6 @@
 /* Generated by re2c 0.13.5 on Mon Feb 21 20:40:42 2011 */
+/* EXIT states (yy90-yy95), LEFTOVER states (yy100-yy109) and FILE
+ * states (yy110-yy115) added by hand to match stscan.re. */
 
 /* stscan.re
  * Scott Bronson
@@ -38,6 +40,9 @@ int stscan_start(scanstate *ss)
 	case 'A':	goto yy7;
 	case 'C':	goto yy3;
 	case 'D':	goto yy6;
+	case 'E':	goto yy90;
+	case 'F':	goto yy110;
+	case 'L':	goto yy100;
 	case 'P':	goto yy4;
 	case 'R':	goto yy5;
 	case 'S':	goto yy2;
@@ -470,6 +475,153 @@ yy86:
 	case '\n':	goto yy82;
 	default:	goto yy86;
 	}
+yy90:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'X':	goto yy91;
+	default:	goto yy9;
+	}
+yy91:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'I':	goto yy92;
+	default:	goto yy9;
+	}
+yy92:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'T':	goto yy93;
+	default:	goto yy9;
+	}
+yy93:
+	++YYCURSOR;
+	if (YYLIMIT <= YYCURSOR) YYFILL(1);
+	yych = *YYCURSOR;
+	switch (yych) {
+	case '\t':
+	case ' ':	goto yy93;
+	case '\n':	goto yy10;
+	case ':':	goto yy94;
+	default:	goto yy8;
+	}
+yy94:
+	++YYCURSOR;
+	if (YYLIMIT <= YYCURSOR) YYFILL(1);
+	yych = *YYCURSOR;
+	switch (yych) {
+	case '\n':	goto yy95;
+	default:	goto yy94;
+	}
+yy95:
+	++YYCURSOR;
+
+	{ return stEXIT; }
+yy100:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'E':	goto yy101;
+	default:	goto yy9;
+	}
+yy101:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'F':	goto yy102;
+	default:	goto yy9;
+	}
+yy102:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'T':	goto yy103;
+	default:	goto yy9;
+	}
+yy103:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'O':	goto yy104;
+	default:	goto yy9;
+	}
+yy104:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'V':	goto yy105;
+	default:	goto yy9;
+	}
+yy105:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'E':	goto yy106;
+	default:	goto yy9;
+	}
+yy106:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'R':	goto yy107;
+	default:	goto yy9;
+	}
+yy107:
+	++YYCURSOR;
+	if (YYLIMIT <= YYCURSOR) YYFILL(1);
+	yych = *YYCURSOR;
+	switch (yych) {
+	case '\t':
+	case ' ':	goto yy107;
+	case '\n':	goto yy10;
+	case ':':	goto yy108;
+	default:	goto yy8;
+	}
+yy108:
+	++YYCURSOR;
+	if (YYLIMIT <= YYCURSOR) YYFILL(1);
+	yych = *YYCURSOR;
+	switch (yych) {
+	case '\n':	goto yy109;
+	default:	goto yy108;
+	}
+yy109:
+	++YYCURSOR;
+
+	{ return stLEFTOVER; }
+yy110:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'I':	goto yy111;
+	default:	goto yy9;
+	}
+yy111:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'L':	goto yy112;
+	default:	goto yy9;
+	}
+yy112:
+	yych = *++YYCURSOR;
+	switch (yych) {
+	case 'E':	goto yy113;
+	default:	goto yy9;
+	}
+yy113:
+	++YYCURSOR;
+	if (YYLIMIT <= YYCURSOR) YYFILL(1);
+	yych = *YYCURSOR;
+	switch (yych) {
+	case '\t':
+	case ' ':	goto yy113;
+	case '\n':	goto yy10;
+	case ':':	goto yy114;
+	default:	goto yy8;
+	}
+yy114:
+	++YYCURSOR;
+	if (YYLIMIT <= YYCURSOR) YYFILL(1);
+	yych = *YYCURSOR;
+	switch (yych) {
+	case '\n':	goto yy115;
+	default:	goto yy114;
+	}
+yy115:
+	++YYCURSOR;
+
+	{ return stFILE; }
 }
 
 
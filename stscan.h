@@ -22,6 +22,9 @@ enum {
 
 	stABORTED,		///< if the test is aborted using ABORT.  optional argument telling why.
 	stDISABLED,		///< if the test is disabled using DISABLED.  optional argument telling why.
+	stEXIT,			///< only in batch mode: the exit status of the test's subshell ("EXIT: 0").  printed after the test.
+	stLEFTOVER,		///< only with --isolate: the files the test left in its testhome ("LEFTOVER: not deleted: a, b").  printed after the test.
+	stFILE,			///< only with --isolate: whether a FILE section matched ("FILE: yes path").  printed after the test.
 
 	stGARBAGE,		///< returned if we couldn't recognize the status entry.  the line should probably be ignored and we move on.
 };
@@ -0,0 +1,16 @@
+echo START >&%(STATUSFD)
+
+ABORT ()  { echo "ABORTED: $*" >&%(STATUSFD); exit 0; }
+
+DISABLED  () { echo "DISABLED: $*" >&%(STATUSFD); exit 0; }
+DISABLE   () { DISABLED $*; }
+
+%(CONFIG_FILES)
+
+echo PREPARE >&%(STATUSFD)
+
+%(TESTSTART)echo RUNNING >&%(STATUSFD)
+exec >&%(OUTFD) 2>&%(ERRFD) 3>%(FD3FILE) %(OUTFD)>&- %(ERRFD)>&-
+%(TESTCOPY)
+
+echo DONE >&%(STATUSFD)
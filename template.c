@@ -0,0 +1,38 @@
+/* Generated by cstrfy.  DO NOT EDIT! */
+
+#include <stdio.h>
+#include "vars.h"
+
+const struct template_segment exec_template[29] = {
+	{ "echo START >&", 13, tmplvar_literal },
+	{ 0, 0, tmplvar_STATUSFD },
+	{ "\n\nABORT ()  { echo \"ABORTED: $*\" >&", 35, tmplvar_literal },
+	{ 0, 0, tmplvar_STATUSFD },
+	{ "; exit 0; }\n\nDISABLED  () { echo \"DISABLED: $*\" >&", 50, tmplvar_literal },
+	{ 0, 0, tmplvar_STATUSFD },
+	{ "; exit 0; }\nDISABLE   () { DISABLED $*; }\n\n", 43, tmplvar_literal },
+	{ 0, 0, tmplvar_CONFIG_FILES },
+	{ "\n\necho PREPARE >&", 17, tmplvar_literal },
+	{ 0, 0, tmplvar_STATUSFD },
+	{ "\n\nSTDOUT () { exit 0; }\nSTDOUT: () { exit 0; }\nSTDERR () { exit 0; }\nSTDERR: () { exit 0; }\nFD3 () { exit 0; }\nFD3: () { exit 0; }\nFILE () { exit 0; }\nFILE: () { exit 0; }\n\n", 173, tmplvar_literal },
+	{ 0, 0, tmplvar_TESTSTART },
+	{ "echo RUNNING >&", 15, tmplvar_literal },
+	{ 0, 0, tmplvar_STATUSFD },
+	{ "\nexec >&", 8, tmplvar_literal },
+	{ 0, 0, tmplvar_OUTFD },
+	{ " 2>&", 4, tmplvar_literal },
+	{ 0, 0, tmplvar_ERRFD },
+	{ " 3>", 3, tmplvar_literal },
+	{ 0, 0, tmplvar_FD3FILE },
+	{ " ", 1, tmplvar_literal },
+	{ 0, 0, tmplvar_OUTFD },
+	{ ">&- ", 4, tmplvar_literal },
+	{ 0, 0, tmplvar_ERRFD },
+	{ ">&-\n", 4, tmplvar_literal },
+	{ 0, 0, tmplvar_TESTEXEC },
+	{ "\n\necho DONE >&", 14, tmplvar_literal },
+	{ 0, 0, tmplvar_STATUSFD },
+	{ "\n", 1, tmplvar_literal },
+};
+
+const int exec_template_count = 29;
@@ -13,9 +13,13 @@ STDOUT () { exit 0; }
 STDOUT: () { exit 0; }
 STDERR () { exit 0; }
 STDERR: () { exit 0; }
+FD3 () { exit 0; }
+FD3: () { exit 0; }
+FILE () { exit 0; }
+FILE: () { exit 0; }
 
-echo RUNNING >&%(STATUSFD)
-exec >&%(OUTFD) 2>&%(ERRFD) %(OUTFD)>&- %(ERRFD)>&-
+%(TESTSTART)echo RUNNING >&%(STATUSFD)
+exec >&%(OUTFD) 2>&%(ERRFD) 3>%(FD3FILE) %(OUTFD)>&- %(ERRFD)>&-
 %(TESTEXEC)
 
 echo DONE >&%(STATUSFD)
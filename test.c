@@ -13,6 +13,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <dirent.h>
@@ -20,19 +23,22 @@
 #include <stdarg.h>
 
 #include "re2c/read-fd.h"
+#include "re2c/scan-dyn.h"
 
 #include "test.h"
+#include "arena.h"
+#include "script.h"
 #include "stscan.h"
 #include "tfscan.h"
 #include "rusage.h"
 
 
+// the status file scanner's buffer may grow to hold a line this long
+#define MAX_STATUS_LINE (16*1024*1024)
+
 // utility function so you can say i.e. write_strconst(fd, "/");
 #define write_strconst(fd, str) write((fd), (str), sizeof(str)-1)
 
-static int test_runs = 0;
-static int test_successes = 0;
-static int test_failures = 0;
 
 
 /** Returns a human-readable testfile name (i.e. (STDIN) instead of -)
@@ -52,14 +58,15 @@ const char *convert_testfile_name(const char *fn)
  * NOTE: it changes the file offset to the end of the file.
  *
  * Returns nonzero if file has data, zero if it doesn't.
- * Actually, it just returns the file's length.
+ * Actually, it just returns the file's length, or -1 if the test
+ * had to be aborted.
  */
 
-int fd_has_data(struct test *test, int fd)
+off_t fd_has_data(struct test *test, int fd)
 {
     off_t pos = lseek(fd, 0, SEEK_END);
     if(pos < 0) {
-        test_abort(test, "fd_has_data lseek error: %s", strerror(errno));
+        return test_abort(test, "fd_has_data lseek error: %s", strerror(errno));
     }
 
     return pos;
@@ -97,17 +104,13 @@ static int locate_status_arg(const char **incp, const char **ince)
 }
 
 
-static char* dup_status_arg(const char *cp, const char *ce)
+static char* dup_status_arg(struct test *test, const char *cp, const char *ce)
 {
     char *ret = NULL;
 
     if(locate_status_arg(&cp, &ce)) {
-        ret = malloc(ce - cp + 1);
-        if(ret) {
-            memcpy(ret, cp, ce-cp);
-            // replace the NL on the end with the null terminator.
-            ret[ce-cp] = '\0';
-        }
+        // leaves off the NL on the end.
+        ret = arena_strndup(test->arena, cp, ce - cp);
     }
 
     return ret;
@@ -128,114 +131,215 @@ static int copy_status_arg(const char *cp, const char *ce, char *buf, int size)
 }
 
 
+/** Adds a FILE section's result, "yes path" or "no path", that
+ *  test_report_files() wrote to the status file.
+ *
+ *  @returns 0, or -1 if arg isn't a result.
+ */
+
+static int add_reported_file(struct test *test, char *arg)
+{
+    struct test_file *file;
+    enum matchval match;
+
+    if(!arg) {
+        return -1;
+    }
+    if(strncmp(arg, "yes ", 4) == 0) {
+        match = match_yes;
+        arg += 4;
+    } else if(strncmp(arg, "no ", 3) == 0) {
+        match = match_no;
+        arg += 3;
+    } else {
+        return -1;
+    }
+
+    file = test_alloc(test, sizeof(struct test_file));
+    if(!file) {
+        return 0;
+    }
+    file->path = arg;
+    file->fd = -1;
+    file->match = match;
+    file->next = test->files;
+    test->files = file;
+    test->files_reported = 1;
+
+    return 0;
+}
+
+
 /** Looks through the status file and stores the items of interest
  * in the test structure.
+ *
+ * @returns 0, or -1 if the test had to be aborted.
  */
 
-void scan_status_file(struct test *test)
+int scan_status_file(struct test *test)
 {
-    char lastfile[PATH_MAX];
+    char *lastfile, *buf;
     int lastfile_good = 0;
-    char buf[BUFSIZ];
+    char exitbuf[32];
     scanstate ss;
-    int tok;
+    int fds[2];
+    int i, tok;
     int state = 0;
 
-    // first rewind the status file
-    if(lseek(test->statusfd, 0, SEEK_SET) < 0) {
-        test_abort(test, "read_file lseek on status file: %s\n",
-            strerror(errno));
+    // With --dir-shell, the config files were read once for all the
+    // tests in the directory and their messages are in the prologue.
+    // The prologue must be scanned first.
+    fds[0] = test->prologuefd;
+    fds[1] = test->statusfd;
+
+    lastfile = test_alloc(test, PATH_MAX);
+    buf = test_alloc(test, BUFSIZ);
+    if(!lastfile || !buf) {
+        return -1;
     }
 
-    // then create our scanner
-    scanstate_init(&ss, buf, sizeof(buf));
-    readfd_attach(&ss, test->statusfd);
-    stscan_attach(&ss);
+    for(i=0; i<2; i++) {
+        if(fds[i] < 0) {
+            continue;
+        }
 
-    // now, if we see the token "CBRUNNING" in the token stream,
-    // it means that we attempted to start the test.  If not,
-    // then the test bailed early.
-    do {
-        tok = scan_next_token(&ss);
-
-        // look for errors...
-        if(tok < 0) {
-            test_abort(test, "Error %d pulling status tokens: %s\n",
-                tok, strerror(errno));
-        } else if(tok == stGARBAGE) {
-            fprintf(stderr, "Garbage on line %d in the status file: '%.*s'\n",
-                    ss.line, (int)token_length(&ss)-1, token_start(&ss));
-        } else {
-            state = tok;
+        // first rewind the status file
+        if(lseek(fds[i], 0, SEEK_SET) < 0) {
+            return test_abort(test, "read_file lseek on status file: %s\n",
+                strerror(errno));
         }
 
-        switch(tok) {
-            case stSTART:
-                // nothing to do
-                break;
+        // then create our scanner.  ABORTED and DISABLED may be
+        // given reasons that won't fit in buf.
+        scanstate_init(&ss, buf, BUFSIZ);
+        dynscan_growable(&ss, MAX_STATUS_LINE);
+        readfd_attach(&ss, fds[i]);
+        stscan_attach(&ss);
+
+        // now, if we see the token "CBRUNNING" in the token stream,
+        // it means that we attempted to start the test.  If not,
+        // then the test bailed early.
+        do {
+            tok = scan_next_token(&ss);
+
+            // look for errors...
+            if(tok < 0) {
+                dynscan_release(&ss);
+                return test_abort(test, "Error %d pulling status tokens: %s\n",
+                    tok, strerror(errno));
+            } else if(tok == stGARBAGE) {
+                fprintf(stderr, "Garbage on line %d in the status file: '%.*s'\n",
+                        ss.line, (int)token_length(&ss)-1, token_start(&ss));
+            } else {
+                state = tok;
+            }
 
-            case stCONFIG:
-                if(test->status == test_pending) {
-                    test->num_config_files += 1;
-                    if(copy_status_arg(token_start(&ss), token_end(&ss), lastfile, sizeof(lastfile))) {
-                        lastfile_good = 1;
+            switch(tok) {
+                case stSTART:
+                    // nothing to do
+                    break;
+
+                case stCONFIG:
+                    if(test->status == test_pending) {
+                        test->num_config_files += 1;
+                        if(copy_status_arg(token_start(&ss), token_end(&ss), lastfile, PATH_MAX)) {
+                            lastfile_good = 1;
+                        } else {
+                            fprintf(stderr, "CONFIG needs arg on line %d of the status file: '%.*s'\n",
+                                    ss.line, (int)token_length(&ss)-1, token_start(&ss));
+                        }
                     } else {
-                        fprintf(stderr, "CONFIG needs arg on line %d of the status file: '%.*s'\n",
-                                ss.line, (int)token_length(&ss)-1, token_start(&ss));
+                        fprintf(stderr, "CONFIG but status (%d) wasn't pending on line %d of the status file: '%.*s'\n",
+                                test->status, ss.line, (int)token_length(&ss)-1, token_start(&ss));
                     }
-                } else {
-                    fprintf(stderr, "CONFIG but status (%d) wasn't pending on line %d of the status file: '%.*s'\n",
-                            test->status, ss.line, (int)token_length(&ss)-1, token_start(&ss));
-                }
-                break;
-
-            case stPREPARE:
-                // nothing to do
-                break;
-
-            case stRUNNING:
-                if(test->status == test_pending) {
-                    test->status = test_was_started;
-                    if(strlen(test->testfile) < sizeof(lastfile)) {
-                        strcpy(lastfile, test->testfile);
-                        lastfile_good = 1;
+                    break;
+
+                case stPREPARE:
+                    // nothing to do
+                    break;
+
+                case stRUNNING:
+                    if(test->status == test_pending) {
+                        test->status = test_was_started;
+                        if(strlen(test->testfile) < PATH_MAX) {
+                            strcpy(lastfile, test->testfile);
+                            lastfile_good = 1;
+                        } else {
+                            fprintf(stderr, "RUNNING lastfile is not big enough for %s", test->testfile);
+                        }
                     } else {
-                        fprintf(stderr, "RUNNING lastfile is not big enough for %s", test->testfile);
+                        fprintf(stderr, "RUNNING but status (%d) wasn't pending on line %d of the status file: '%.*s'\n",
+                                test->status, ss.line, (int)token_length(&ss)-1, token_start(&ss));
                     }
-                } else {
-                    fprintf(stderr, "RUNNING but status (%d) wasn't pending on line %d of the status file: '%.*s'\n",
-                            test->status, ss.line, (int)token_length(&ss)-1, token_start(&ss));
-                }
-                break;
+                    break;
 
-            case stDONE:
-                if(test->status == test_was_started) {
-                    test->status = test_was_completed;
-                } else {
-                    fprintf(stderr, "DONE but status (%d) wasn't RUNNING on line %d of the status file: '%.*s'\n",
-                            test->status, ss.line, (int)token_length(&ss)-1, token_start(&ss));
-                }
-                break;
+                case stDONE:
+                    if(test->status == test_was_started) {
+                        test->status = test_was_completed;
+                    } else {
+                        fprintf(stderr, "DONE but status (%d) wasn't RUNNING on line %d of the status file: '%.*s'\n",
+                                test->status, ss.line, (int)token_length(&ss)-1, token_start(&ss));
+                    }
+                    break;
+
+                case stABORTED:
+                    test->status = (test->status >= test_was_started ? test_was_aborted : config_was_aborted);
+                    test->status_reason = dup_status_arg(test, token_start(&ss), token_end(&ss));
+                    break;
+
+                case stDISABLED:
+                    test->status = (test->status >= test_was_started ? test_was_disabled : config_was_disabled);
+                    test->status_reason = dup_status_arg(test, token_start(&ss), token_end(&ss));
+                    break;
+
+                case stEXIT:
+                    // the test was run in a subshell of a batch.  The batch's
+                    // shell exited normally so this is the test's real status.
+                    if(copy_status_arg(token_start(&ss), token_end(&ss), exitbuf, sizeof(exitbuf))) {
+                        test->exitno = atoi(exitbuf);
+                        // the shell reports a signal as 128+signo.
+                        if(test->exitno > 128 && test->status != test_was_completed) {
+                            test->exitsignal = test->exitno - 128;
+                            test->exitcored = 0;
+                        }
+                    } else {
+                        fprintf(stderr, "EXIT needs arg on line %d of the status file: '%.*s'\n",
+                                ss.line, (int)token_length(&ss)-1, token_start(&ss));
+                    }
+                    break;
+
+                case stLEFTOVER:
+                    // the test ran in its own namespace so only it could
+                    // see what it left behind.  see check_testhome().
+                    if(test->status == test_was_started) {
+                        test->status = test_has_failed;
+                        test->status_reason = dup_status_arg(test, token_start(&ss), token_end(&ss));
+                    }
+                    break;
 
-            case stABORTED:
-                test->status = (test->status >= test_was_started ? test_was_aborted : config_was_aborted);
-                test->status_reason = dup_status_arg(token_start(&ss), token_end(&ss));
-                break;
+                case stFILE:
+                    // the test ran in its own namespace so the FILE sections
+                    // were compared there.  see test_report_files().
+                    if(add_reported_file(test, dup_status_arg(test, token_start(&ss), token_end(&ss))) < 0) {
+                        fprintf(stderr, "FILE needs a match and a path on line %d of the status file: '%.*s'\n",
+                                ss.line, (int)token_length(&ss)-1, token_start(&ss));
+                    }
+                    break;
 
-            case stDISABLED:
-                test->status = (test->status >= test_was_started ? test_was_disabled : config_was_disabled);
-                test->status_reason = dup_status_arg(token_start(&ss), token_end(&ss));
-                break;
+                default:
+                    fprintf(stderr, "Unknown token (%d) on line %d of the status file: '%.*s'\n",
+                            tok, ss.line, (int)token_length(&ss)-1, token_start(&ss));
+            }
+        } while(!scan_is_finished(&ss));
 
-            default:
-                fprintf(stderr, "Unknown token (%d) on line %d of the status file: '%.*s'\n",
-                        tok, ss.line, (int)token_length(&ss)-1, token_start(&ss));
-        }
-    } while(!scan_is_finished(&ss));
+        dynscan_release(&ss);
+    }
 
     if(lastfile_good) {
-        test->last_file_processed = strdup(lastfile);
+        test->last_file_processed = lastfile;
     }
+
+    return 0;
 }
 
 
@@ -269,18 +373,20 @@ void rewrite_command_section(struct test *test, int tok, const char *ptr, int le
 }
 
 
-/** Copies the command section of the test to the given fileptr and
+/** Copies the command section of the test to the given script and
  * also supplies it to the dump_command_section() routine.
  *
- * If you don't want to dump to a fileptr (i.e. if you're running
- * the test from a file) just pass NULL for fp.
+ * If you don't want to copy it to a script (i.e. if you're running
+ * the test from a file) just pass NULL for sc.
  *
  * This routine is a whole lot like scan_sections except that it stops
  * at the end of the command section.  It leaves the result sections
  * on the stream to be parsed later.
+ *
+ * @returns 0, or -1 if the test had to be aborted.
  */
 
-void test_command_copy(struct test *test, FILE *fp)
+int test_command_copy(struct test *test, struct script *sc)
 {
     int oldline;
 
@@ -288,7 +394,7 @@ void test_command_copy(struct test *test, FILE *fp)
         oldline = test->testscanner.line;
         int tokno = scan_next_token(&test->testscanner);
         if(tokno < 0) {
-            test_abort(test, "Error %d pulling status tokens: %s\n",
+            return test_abort(test, "Error %d pulling status tokens: %s\n",
                     tokno, strerror(errno));
         } else if(tokno == 0) {
             // if the test file is totally empty.
@@ -315,13 +421,15 @@ void test_command_copy(struct test *test, FILE *fp)
         // print the modified data to the output stream.
         rewrite_command_section(test, tokno, token_start(&test->testscanner), token_length(&test->testscanner));
 
-        if(fp) {
-            // print the unmodified data to the command script.
-            fwrite(token_start(&test->testscanner), token_length(&test->testscanner), 1, fp);
+        if(sc) {
+            // add the unmodified data to the command script.  it has to
+            // be copied since the scan buffer will be reused.
+            script_copy(sc, token_start(&test->testscanner), token_length(&test->testscanner));
         }
     } while(!scan_is_finished(&test->testscanner));
 
     rewrite_command_section(test, 0, NULL, 0);
+    return 0;
 }
 
 
@@ -329,15 +437,17 @@ void test_command_copy(struct test *test, FILE *fp)
  *
  * The comparison is handled by compare.c/h.  We just need to set
  * it up.
+ *
+ * @returns 0, or -1 if the test had to be aborted.
  */
 
-void compare_section_start(struct test *test,
+int compare_section_start(struct test *test,
     scanstate *cmpscan, int fd,
     const char *sectionname)
 {
     // rewind the file
     if(lseek(fd, 0, SEEK_SET) < 0) {
-        test_abort(test, "compare_section_start lseek compare: %s\n",
+        return test_abort(test, "compare_section_start lseek compare: %s\n",
             strerror(errno));
     }
 
@@ -347,6 +457,7 @@ void compare_section_start(struct test *test,
 
     // we may want to check the token to see if there are any
     // special requests (like detabbing).
+    return 0;
 }
 
 
@@ -423,9 +534,21 @@ int constreq(const char *cp, const char *ce, const char *str)
 }
 
 
+/** The arguments that may follow a section's name.
+ */
+
+struct section_args {
+    int no_trailing_newline;    ///< -n or --no-trailing-newline
+    const char *golden;         ///< --file=PATH: the expected output is in PATH, not the testfile.  NULL if not given.
+    int goldenlen;
+};
+
+
 int start_output_section_argproc(int i, const char *cp, const char *ce,
         const char *file, int line, void *refcon)
 {
+    struct section_args *args = refcon;
+
     if(i == 0) {
         // index == 0 is the name of this section
         return 0;
@@ -440,7 +563,10 @@ int start_output_section_argproc(int i, const char *cp, const char *ce,
     }
 
     if(constreq(cp,ce,"-n") || constreq(cp,ce,"--no-trailing-newline")) {
-        *(int*)refcon = 1;
+        args->no_trailing_newline = 1;
+    } else if(ce - cp > 7 && memcmp(cp, "--file=", 7) == 0) {
+        args->golden = cp + 7;
+        args->goldenlen = ce - cp - 7;
     } else if(cp < ce) {
         fprintf(stderr, "%s line %d: unknown arguments \"%.*s\"\n",
                 file, line, (int)(ce-cp), cp);
@@ -457,24 +583,131 @@ int start_output_section_argproc(int i, const char *cp, const char *ce,
     ///  from the expected output (so it can match actual).
 
 
+/** Returns the path of a --file golden file.  Relative paths are
+ *  relative to the directory containing the testfile.
+ */
+
+static char* golden_path(struct test *test, const struct section_args *args)
+{
+    const char *slash = strrchr(test->testpath, '/');
+    int dirlen = 0;
+    char *path;
+
+    if(args->golden[0] != '/' && slash) {
+        dirlen = slash - test->testpath + 1;
+    }
+
+    path = test_alloc(test, dirlen + args->goldenlen + 1);
+    if(!path) {
+        return NULL;
+    }
+    memcpy(path, test->testpath, dirlen);
+    memcpy(path + dirlen, args->golden, args->goldenlen);
+    path[dirlen + args->goldenlen] = '\0';
+
+    return path;
+}
+
+
+/** Maps len bytes of fd for reading straight through.
+ *  Aborts the test and returns NULL if they can't be mapped.
+ */
+
+static void* map_file(struct test *test, int fd, size_t len, const char *name)
+{
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED) {
+        test_abort(test, "Could not map %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    madvise(map, len, MADV_SEQUENTIAL);
+    return map;
+}
+
+
+/** Compares the actual output in fd against the golden file at path.
+ *  Both are mapped so the comparison runs at memory speed and the
+ *  data never goes through a scan buffer.  The golden file holds the
+ *  exact output so there's no newline fixup like there is for output
+ *  in the testfile.
+ *
+ *  @returns match_yes or match_no, or match_unknown if the golden file
+ *    couldn't be opened (errno tells why).  If the test had to be
+ *    aborted, match_no.
+ */
+
+static enum matchval compare_golden(struct test *test, int fd, const char *path)
+{
+    struct stat st, gst;
+    void *actual, *expected;
+    enum matchval val;
+    int gfd;
+
+    gfd = open(path, O_RDONLY|O_CLOEXEC);
+    if(gfd < 0) {
+        return match_unknown;
+    }
+
+    if(fstat(fd, &st) < 0 || fstat(gfd, &gst) < 0) {
+        close(gfd);
+        test_abort(test, "compare_golden fstat: %s\n", strerror(errno));
+        return match_no;
+    }
+
+    if(st.st_size != gst.st_size) {
+        close(gfd);
+        return match_no;
+    }
+    if(st.st_size == 0) {
+        close(gfd);
+        return match_yes;
+    }
+
+    actual = map_file(test, fd, st.st_size, "the actual output");
+    if(!actual) {
+        close(gfd);
+        return match_no;
+    }
+    expected = mmap(NULL, gst.st_size, PROT_READ, MAP_PRIVATE, gfd, 0);
+    close(gfd);
+    if(expected == MAP_FAILED) {
+        munmap(actual, st.st_size);
+        test_abort(test, "Could not map %s: %s\n", path, strerror(errno));
+        return match_no;
+    }
+    madvise(expected, gst.st_size, MADV_SEQUENTIAL);
+
+    val = (memcmp(actual, expected, st.st_size) == 0 ? match_yes : match_no);
+
+    munmap(actual, st.st_size);
+    munmap(expected, gst.st_size);
+    return val;
+}
+
+
 /**
  * Called when we're at the start of a STDOUT or STDERR section.
  * Sets the cmpscanner up to compare the section.
  * See end_output_section().
+ *
+ * If the section names a golden file with --file, it's compared right
+ * here and the section's result is stored in match.  Returns 0 since
+ * there's nothing left to compare; any lines in the section are ignored.
  */
 
 int start_output_section(struct test *test, const char *tok,
-        int toklen, scanstate *cmpscan, int fd, enum matchval val,
+        int toklen, scanstate *cmpscan, int fd, enum matchval *match,
         const char *secname)
 {
-    int suppress_trailing_newline = 0;
+    struct section_args args;
+    const char *path;
 
+    memset(&args, 0, sizeof(args));
     parse_section_args(tok, toklen,
             convert_testfile_name(test->testfile), test->testscanner.line,
-            start_output_section_argproc,
-            (void*)&suppress_trailing_newline);
+            start_output_section_argproc, &args);
 
-    if(val != match_unknown) {
+    if(*match != match_unknown) {
         // we've already obtained a value for this section!
         fprintf(stderr, "%s line %d Error: duplicate %s "
                 "section.  Ignored.\n", convert_testfile_name(test->testfile),
@@ -482,16 +715,225 @@ int start_output_section(struct test *test, const char *tok,
         return 0;
     }
 
+    if(args.golden) {
+        path = golden_path(test, &args);
+        if(!path) {
+            return 0;
+        }
+        *match = compare_golden(test, fd, path);
+        if(*match == match_unknown) {
+            fprintf(stderr, "%s line %d Error: couldn't open %.*s for %s: %s\n",
+                    convert_testfile_name(test->testfile), test->testscanner.line,
+                    args.goldenlen, args.golden, secname, strerror(errno));
+            *match = match_no;
+        }
+        return 0;
+    }
+
     scanstate_reset(cmpscan);
-    compare_section_start(test, cmpscan, fd, secname);
+    if(compare_section_start(test, cmpscan, fd, secname) < 0) {
+        return 0;
+    }
 
     // store the newline flag in the cmpscan structure
-    cmpscan_suppress_newline = suppress_trailing_newline;
+    cmpscan_suppress_newline = args.no_trailing_newline;
 
     return 1;
 }
 
 
+/** Finds the path in a "FILE path:" section heading.  The file must
+ *  be in the testhome so the path can't be absolute or contain "..".
+ *
+ *  @param args receives the start of the path.  Any section arguments
+ *    follow it.
+ *  @returns the path without any leading "./", or NULL if the heading
+ *    doesn't contain a usable path.
+ */
+
+static char* file_section_path(struct test *test, const char *tok,
+        int toklen, const char **args)
+{
+    const char *ce = tok + toklen;
+    const char *cp, *pe;
+    char *path;
+    int len;
+
+    // skip "FILE" and the whitespace after it
+    cp = tok + 4;
+    while(cp < ce && (*cp == ' ' || *cp == '\t')) {
+        cp++;
+    }
+    *args = cp;
+
+    pe = cp;
+    while(pe < ce && !isspace(*pe)) {
+        pe++;
+    }
+    while(pe > cp && pe[-1] == ':') {
+        pe--;
+    }
+    while(pe - cp > 2 && cp[0] == '.' && cp[1] == '/') {
+        cp += 2;
+    }
+
+    len = pe - cp;
+    if(len <= 0) {
+        fprintf(stderr, "%s line %d Error: FILE section has no filename.  "
+                "Ignored.\n", convert_testfile_name(test->testfile),
+                test->testscanner.line);
+        return NULL;
+    }
+
+    path = test_alloc(test, len + 1);
+    if(!path) {
+        return NULL;
+    }
+    memcpy(path, cp, len);
+    path[len] = '\0';
+
+    if(path[0] == '/' || strcmp(path, "..") == 0 ||
+            strncmp(path, "../", 3) == 0 || strstr(path, "/../") ||
+            (len > 3 && strcmp(path + len - 3, "/..") == 0)) {
+        fprintf(stderr, "%s line %d Error: FILE %s is outside the testhome.  "
+                "Ignored.\n", convert_testfile_name(test->testfile),
+                test->testscanner.line, path);
+        return NULL;
+    }
+
+    return path;
+}
+
+
+/** Opens the regular file at path in the testhome.
+ *  Returns the fd or -1 if the test didn't leave a file there.
+ */
+
+static int open_home_file(struct test *test, const char *path)
+{
+    struct stat st;
+    int fd;
+
+    if(test->homefd < 0) {
+        return -1;
+    }
+
+    fd = openat(test->homefd, path, O_RDONLY|O_CLOEXEC);
+    if(fd < 0) {
+        return -1;
+    }
+
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/** Returns true if a FILE section compared against the file at path,
+ *  which is relative to the testhome.
+ */
+
+int test_expects_file(struct test *test, const char *path)
+{
+    struct test_file *file;
+
+    for(file=test->files; file; file=file->next) {
+        if(strcmp(file->path, path) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Called when we're at the start of a FILE section.  Adds the file to
+ * test->files and, if the test left it behind, starts comparing it.
+ * A file that doesn't exist can't match.
+ */
+
+static int start_file_section(struct test *test, const char *tok,
+        int toklen, scanstate *cmpscan)
+{
+    struct test_file *file;
+    const char *args;
+    char *path;
+
+    // the results came in the status file.  see test_report_files().
+    if(test->files_reported) {
+        return 0;
+    }
+
+    path = file_section_path(test, tok, toklen, &args);
+    if(!path) {
+        return 0;
+    }
+
+    if(test_expects_file(test, path)) {
+        fprintf(stderr, "%s line %d Error: duplicate FILE %s "
+                "section.  Ignored.\n", convert_testfile_name(test->testfile),
+                test->testscanner.line, path);
+        return 0;
+    }
+
+    file = test_alloc(test, sizeof(struct test_file));
+    if(!file) {
+        return 0;
+    }
+    file->path = path;
+    file->match = match_unknown;
+    file->next = test->files;
+    test->files = file;
+
+    file->fd = open_home_file(test, path);
+    if(file->fd < 0) {
+        file->match = match_no;
+        return 0;
+    }
+
+    // the path takes the place of the section name
+    if(!start_output_section(test, args, tok + toklen - args, cmpscan,
+                file->fd, &file->match, path)) {
+        close(file->fd);
+        file->fd = -1;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/** Returns where the result of comparing the given section goes and,
+ *  in name, what to call the section in messages.  The FILE section
+ *  being compared is always the first one in test->files.
+ */
+
+static enum matchval* section_match(struct test *test, int sec, const char **name)
+{
+    switch(sec) {
+        case exSTDOUT:
+            *name = "STDOUT";
+            return &test->stdout_match;
+        case exSTDERR:
+            *name = "STDERR";
+            return &test->stderr_match;
+        case exFD3:
+            *name = "FD3";
+            return &test->fd3_match;
+        case exFILE:
+            *name = test->files->path;
+            return &test->files->match;
+    }
+
+    assert(!"not an output section");
+    return NULL;
+}
+
+
 /**
  * If the actual test results were found to not end in a newline,
  * but the expected results were marked in the testfile as expecting
@@ -584,6 +1026,8 @@ void parse_section_compare(struct test *test, int sec,
 
     // the section that we're processing (without the NEW flag attached)
     int newsec = EX_TOKEN(sec);
+    enum matchval *match;
+    const char *name;
 
     // make sure we're not fed an illegal token.
     assert(is_section_token(newsec) || sec == 0);
@@ -593,15 +1037,13 @@ void parse_section_compare(struct test *test, int sec,
 
     if(EX_ISNEW(sec) || sec == 0) {
         // ensure previoius section is finished
-        switch(cmpscan_state) {
-            case exSTDOUT:
-              test->stdout_match = end_output_section(test, cmpscan, "STDOUT");
-              break;
-            case exSTDERR:
-              test->stderr_match = end_output_section(test, cmpscan, "STDERR");
-              break;
-            default:
-                ;
+        if(cmpscan_state) {
+            match = section_match(test, cmpscan_state, &name);
+            *match = end_output_section(test, cmpscan, name);
+            if(cmpscan_state == exFILE) {
+                close(test->files->fd);
+                test->files->fd = -1;
+            }
         }
 
         // then fire up the new section
@@ -612,14 +1054,27 @@ void parse_section_compare(struct test *test, int sec,
                 break;
             case exSTDOUT:
                 if(!start_output_section(test, datap, len, cmpscan,
-                        test->outfd, test->stdout_match, "STDOUT")) {
+                        test->outfd, &test->stdout_match, "STDOUT")) {
                     // ignore the rest of this section
                     cmpscan_state = 0;
                 }
                 break;
             case exSTDERR:
                 if(!start_output_section(test, datap, len, cmpscan,
-                        test->errfd, test->stderr_match, "STDERR")) {
+                        test->errfd, &test->stderr_match, "STDERR")) {
+                    // ignore the rest of this section
+                    cmpscan_state = 0;
+                }
+                break;
+            case exFD3:
+                if(!start_output_section(test, datap, len, cmpscan,
+                        test->fd3fd, &test->fd3_match, "FD3")) {
+                    // ignore the rest of this section
+                    cmpscan_state = 0;
+                }
+                break;
+            case exFILE:
+                if(!start_file_section(test, datap, len, cmpscan)) {
                     // ignore the rest of this section
                     cmpscan_state = 0;
                 }
@@ -635,9 +1090,12 @@ void parse_section_compare(struct test *test, int sec,
                 break;
             case exSTDOUT:
             case exSTDERR:
+            case exFD3:
+            case exFILE:
                 val = compare_continue(cmpscan, datap, len);
                 if(val < 0) {
                     test_abort(test, "compare_continue error: %d\n", val);
+                    cmpscan_state = 0;
                 }
                 break;
             case exCOMMAND:
@@ -655,9 +1113,10 @@ void parse_section_compare(struct test *test, int sec,
  *
  *
  * @param scanner: used to provide the section tokens.
+ * @returns 0, or -1 if the parser or the scanner had to abort the test.
  */
 
-void scan_sections(struct test *test, scanstate *scanner,
+int scan_sections(struct test *test, scanstate *scanner,
         void (*parseproc)(struct test *test, int sec, const char *datap,
                 int len, void *refcon), void *refcon)
 {
@@ -665,13 +1124,13 @@ void scan_sections(struct test *test, scanstate *scanner,
     // it didn't have any sections.  therefore, we'll assume
     // defaults for all values.  we're done.
     if(scan_is_finished(scanner)) {
-        return;
+        return 0;
     }
 
     do {
         int tokno = scan_next_token(scanner);
         if(tokno < 0) {
-            test_abort(test, "scan_sections error %d pulling status tokens: "
+            return test_abort(test, "scan_sections error %d pulling status tokens: "
                 "%s\n", tokno, strerror(errno));
         } else if(tokno == 0) {
             break;
@@ -679,11 +1138,15 @@ void scan_sections(struct test *test, scanstate *scanner,
 
         (*parseproc)(test, tokno, token_start(scanner),
                 token_length(scanner), refcon);
+        if(test->aborted) {
+            return -1;
+        }
 
     } while(!scan_is_finished(scanner));
 
     // give the parser an eof token so it can finalize things.
     (*parseproc)(test, 0, NULL, 0, refcon);
+    return test->aborted ? -1 : 0;
 }
 
 
@@ -703,40 +1166,45 @@ static void print_reason(struct test *test, const char *name, const char *prep)
 }
 
 
-static void test_analyze_results(struct test *test, int *stdo, int *stde)
+/** Compares the expected results in the testfile against the actual
+ *  results.  The runner calls this before it checks the testhome so
+ *  the files that FILE sections compare aren't counted as leftovers.
+ *  Only the first call does anything.
+ *
+ *  @returns 0, or -1 if the test had to be aborted.
+ */
+
+int test_compare_results(struct test *test)
 {
     scanstate scanner;
-    char scanbuf[BUFSIZ];
-
-    *stdo = *stde = -1;
-
-    if(was_aborted(test->status)) {
-        test_failures++;
-        return;
-    }
+    char *scanbuf;
 
-    if(was_disabled(test->status)) {
-        return;
+    if(test->compared) {
+        return test->aborted ? -1 : 0;
     }
+    test->compared = 1;
 
-    if(test->status == test_has_failed) {
-        test_failures++;
-        return;
-    }
-
-    if(!was_started(test->status)) {
-        test_failures++;
-        return;
+    if(was_aborted(test->status) || was_disabled(test->status) ||
+            test->status == test_has_failed || !was_started(test->status)) {
+        return 0;
     }
 
     test->stdout_match = match_unknown;
     test->stderr_match = match_unknown;
+    test->fd3_match = match_unknown;
 
-    scanstate_init(&scanner, scanbuf, sizeof(scanbuf));
-    scan_sections(test, &test->testscanner, parse_section_compare, &scanner);
+    scanbuf = test_alloc(test, BUFSIZ);
+    if(!scanbuf) {
+        return -1;
+    }
+    scanstate_init(&scanner, scanbuf, BUFSIZ);
+    if(scan_sections(test, &test->testscanner, parse_section_compare, &scanner) < 0) {
+        return -1;
+    }
 
     assert(test->stdout_match != match_inprogress);
     assert(test->stderr_match != match_inprogress);
+    assert(test->fd3_match != match_inprogress);
 
     if(test->stdout_match == match_unknown) {
         test->stdout_match = (fd_has_data(test, test->outfd) ? match_no : match_yes);
@@ -744,69 +1212,250 @@ static void test_analyze_results(struct test *test, int *stdo, int *stde)
     if(test->stderr_match == match_unknown) {
         test->stderr_match = (fd_has_data(test, test->errfd) ? match_no : match_yes);
     }
+    if(test->fd3_match == match_unknown) {
+        test->fd3_match = (fd_has_data(test, test->fd3fd) ? match_no : match_yes);
+    }
+
+    return test->aborted ? -1 : 0;
+}
+
+
+/** Feeds only the FILE sections to parse_section_compare().
+ */
+
+static void parse_file_compare(struct test *test, int sec,
+        const char *datap, int len, void *refcon)
+{
+    if(sec != 0 && EX_TOKEN(sec) != exFILE) {
+        if(EX_ISNEW(sec)) {
+            // finishes the FILE section before this one, if any
+            parse_section_compare(test, 0, NULL, 0, refcon);
+        }
+        return;
+    }
+
+    parse_section_compare(test, sec, datap, len, refcon);
+}
+
+
+/** Writes the files in the order of their sections, the reverse of
+ *  test->files, so add_reported_file() rebuilds the same list.
+ */
+
+static void write_file_results(struct test_file *file, int fd)
+{
+    if(!file) {
+        return;
+    }
+
+    write_file_results(file->next, fd);
+    dprintf(fd, "FILE: %s %s\n", (file->match == match_yes ? "yes" : "no"), file->path);
+}
+
+
+/** With --isolate, tmtest can't see the files in the testhome so the
+ *  FILE sections are compared inside the test's namespace and written
+ *  to the status file, fd, as "FILE: yes path" or "FILE: no path".
+ *  The testfile is shared with tmtest, which reads the sections again
+ *  to compare the rest, so testfd's offset is put back when done.
+ *  Pass -1 if the testfile is being scanned from memory.
+ *
+ *  test->homefd must already be open.
+ *
+ *  @returns 0, or -1 if the testfile can't seek (it's stdin) or the
+ *  test had to be aborted.
+ */
+
+int test_report_files(struct test *test, int testfd, int fd)
+{
+    scanstate scanner;
+    char *scanbuf;
+    off_t pos;
+    int err;
+
+    pos = (testfd >= 0 ? lseek(testfd, 0, SEEK_CUR) : 0);
+    if(pos < 0) {
+        return -1;
+    }
+
+    scanbuf = test_alloc(test, BUFSIZ);
+    if(!scanbuf) {
+        return -1;
+    }
+    scanstate_init(&scanner, scanbuf, BUFSIZ);
+    err = scan_sections(test, &test->testscanner, parse_file_compare, &scanner);
+    if(testfd >= 0) {
+        lseek(testfd, pos, SEEK_SET);
+    }
+    if(err < 0) {
+        return -1;
+    }
+
+    write_file_results(test->files, fd);
+    return 0;
+}
+
+
+/** Returns true if fd 3 or any of the files didn't match.
+ */
+
+static int others_differ(struct test *test)
+{
+    struct test_file *file;
+
+    if(test->fd3_match != match_yes) {
+        return 1;
+    }
+    for(file=test->files; file; file=file->next) {
+        if(file->match != match_yes) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int test_analyze_results(struct test *test, int *stdo, int *stde)
+{
+    *stdo = *stde = -1;
+
+    if(was_aborted(test->status)) {
+        test->counts->failures++;
+        test->failed = 1;
+        return 0;
+    }
+
+    if(was_disabled(test->status)) {
+        return 0;
+    }
+
+    if(test->status == test_has_failed) {
+        test->counts->failures++;
+        test->failed = 1;
+        return 0;
+    }
+
+    if(!was_started(test->status)) {
+        test->counts->failures++;
+        test->failed = 1;
+        return 0;
+    }
+
+    if(test_compare_results(test) < 0) {
+        return -1;
+    }
 
     *stdo = (test->stdout_match != match_yes);
     *stde = (test->stderr_match != match_yes);
 
-    if(!*stdo && !*stde && !test->exitsignal) {
-        test_successes++;
+    if(!*stdo && !*stde && !others_differ(test) && !test->exitsignal) {
+        test->counts->successes++;
     } else {
-        test_failures++;
+        test->counts->failures++;
+        test->failed = 1;
+    }
+
+    return 0;
+}
+
+
+/** Prints the sections that didn't match, "stdout, fd3 and out.txt
+ *  differed".  The files are printed in the order of their sections.
+ */
+
+static void print_differences(struct test *test, int stdo, int stde)
+{
+    struct test_file *file;
+    const char **names;
+    int count = 0;
+    int nfiles = 0;
+    int i;
+
+    for(file=test->files; file; file=file->next) {
+        nfiles += (file->match != match_yes);
+    }
+    names = test_alloc(test, (nfiles + 3) * sizeof(char*));
+    if(!names) {
+        return;
+    }
+
+    if(stdo) names[count++] = "stdout";
+    if(stde) names[count++] = "stderr";
+    if(test->fd3_match != match_yes) names[count++] = "fd3";
+
+    i = count + nfiles;
+    for(file=test->files; file; file=file->next) {
+        if(file->match != match_yes) {
+            names[--i] = file->path;
+        }
+    }
+    count += nfiles;
+
+    for(i=0; i<count; i++) {
+        printf("%s%s", (i == 0 ? "" : i == count-1 ? " and " : ", "), names[i]);
+    }
+    if(count) {
+        printf(" differed");
     }
 }
 
 
 /** Checks the actual results against the expected results.
  * dispname is the name we should display for the test.
+ *
+ * @returns 0, or -1 if the test had to be aborted.
  */
 
-void test_results(struct test *test)
+int test_results(struct test *test)
 {
     int stdo, stde; // true if there are differences.
 
-    test_analyze_results(test, &stdo, &stde);
+    if(test_analyze_results(test, &stdo, &stde) < 0) {
+        return -1;
+    }
 
     if(was_aborted(test->status)) {
         print_reason(test, "ABRT", "by");
-        return;
+        return 0;
     }
 
     if(was_disabled(test->status)) {
-        if(verbose) {
+        if(test->opts->verbose) {
             print_reason(test, "dis ", "by");
         }
-        return;
+        return 0;
     }
 
     if(test->status == test_has_failed) {
-        if(verbose) {
+        if(test->opts->verbose) {
             print_reason(test, "FAIL", "by");
         } else {
             putchar('F');
             fflush(stdout);
         }
-        return;
+        return 0;
     }
 
     if(!was_started(test->status)) {
-        if(verbose) {
+        if(test->opts->verbose) {
             print_reason(test, "ERR ", "error in");
         } else {
             putchar('E');
             fflush(stdout);
         }
-        return;
+        return 0;
     }
 
-    if(!stdo && !stde && !test->exitsignal) {
-        if(verbose) {
+    if(!stdo && !stde && !others_differ(test) && !test->exitsignal) {
+        if(test->opts->verbose) {
             printf("ok   %s \n", convert_testfile_name(test->testfile));
         } else {
             putchar('.');
             fflush(stdout);
         }
     } else {
-        if(verbose) {
+        if(test->opts->verbose) {
             printf("FAIL %-25s ", convert_testfile_name(test->testfile));
             if(test->exitsignal) {
                 printf("terminated by signal %d%s", test->exitsignal,
@@ -815,12 +1464,7 @@ void test_results(struct test *test)
                 printf("%c%c  ",
                         (stdo ? 'O' : '.'),
                         (stde ? 'E' : '.'));
-                if(stdo || stde) {
-                    if(stdo) printf("stdout ");
-                    if(stdo && stde) printf("and ");
-                    if(stde) printf("stderr ");
-                    printf("differed");
-                }
+                print_differences(test, stdo, stde);
             }
             printf("\n");
         } else {
@@ -829,21 +1473,23 @@ void test_results(struct test *test)
         }
     }
 
-    return;
+    return 0;
 }
 
 
 /** Like test_results() except that it returns 1 if the test failed
- *  and 0 if it was disabled or succeeded.
+ *  and 0 if it was disabled or succeeded, or -1 if it was aborted.
  */
 
 int check_for_failure(struct test *test, const char *testpath)
 {
     int stdo, stde; // true if there are differences.
-    int oldfailures = test_failures;
+    int oldfailures = test->counts->failures;
 
-    test_analyze_results(test, &stdo, &stde);
-    if(oldfailures+1 == test_failures) {
+    if(test_analyze_results(test, &stdo, &stde) < 0) {
+        return -1;
+    }
+    if(oldfailures+1 == test->counts->failures) {
         return 1;
     }
 
@@ -856,24 +1502,29 @@ int check_for_failure(struct test *test, const char *testpath)
  *
  * @param endnl (optional) is set to true if the data written ended
  *   with a newline, false if not.  Pass NULL if you don't care.
- * @returns the number of bytes written.
+ * @returns the number of bytes written, or -1 if the test had to be
+ *   aborted.
  */
 
-size_t write_file(struct test *test, int outfd, int infd, int *endnl)
+ssize_t write_file(struct test *test, int outfd, int infd, int *endnl)
 {
-    char buf[BUFSIZ];
-    size_t rcnt, wcnt;
-    size_t total = 0;
+    char *buf = test_alloc(test, BUFSIZ);
+    ssize_t rcnt, wcnt;
+    ssize_t total = 0;
+
+    if(!buf) {
+        return -1;
+    }
 
     // first rewind the input file
     if(lseek(infd, 0, SEEK_SET) < 0) {
-        test_abort(test, "write_file lseek on %d: %s\n", infd, strerror(errno));
+        return test_abort(test, "write_file lseek on %d: %s\n", infd, strerror(errno));
     }
 
     // then write the file.
     do {
         do {
-            rcnt = read(infd, buf, sizeof(buf));
+            rcnt = read(infd, buf, BUFSIZ);
         } while(rcnt < 0 && errno == EINTR);
         if(rcnt > 0) {
             if(endnl) *endnl = (buf[rcnt-1] == '\n');
@@ -881,15 +1532,13 @@ size_t write_file(struct test *test, int outfd, int infd, int *endnl)
                 wcnt = write(outfd, buf, rcnt);
             } while(wcnt < 0 && errno == EINTR);
             if(wcnt < 0) {
-                test_abort(test, "write_file got %s while writing!",
+                return test_abort(test, "write_file got %s while writing!",
                     strerror(errno));
-                break;
             }
             total += rcnt;
         } else if (rcnt < 0) {
-            test_abort(test, "write_file got %s while reading!",
+            return test_abort(test, "write_file got %s while reading!",
                 strerror(errno));
-            break;
         }
     } while(rcnt);
 
@@ -897,21 +1546,88 @@ size_t write_file(struct test *test, int outfd, int infd, int *endnl)
 }
 
 
+/** Replaces the golden file at path with the contents of fd.  The new
+ *  contents are written to a tempfile that's renamed over the golden
+ *  file so it's never seen half written.  A golden file that already
+ *  matches is left alone.
+ */
+
+static void replace_golden(struct test *test, const char *path, int fd)
+{
+    struct stat st;
+    char *tmpname;
+    int len = strlen(path);
+    int tmpfd;
+
+    if(compare_golden(test, fd, path) == match_yes) {
+        return;
+    }
+
+    tmpname = test_alloc(test, len + 8);
+    if(!tmpname) {
+        return;
+    }
+    memcpy(tmpname, path, len);
+    memcpy(tmpname + len, ".XXXXXX", 8);
+
+    tmpfd = mkstemp(tmpname);
+    if(tmpfd < 0) {
+        fprintf(stderr, "Could not create %s: %s\n", tmpname, strerror(errno));
+        return;
+    }
+
+    // mkstemp makes the file private, keep the golden file's permissions.
+    fchmod(tmpfd, stat(path, &st) == 0 ? (st.st_mode & 07777) : 0644);
+    if(write_file(test, tmpfd, fd, NULL) < 0) {
+        close(tmpfd);
+        unlink(tmpname);
+        return;
+    }
+
+    if(close(tmpfd) < 0 || rename(tmpname, path) < 0) {
+        fprintf(stderr, "Could not replace %s: %s\n", path, strerror(errno));
+        unlink(tmpname);
+    }
+}
+
+
+/** Writes the section heading in datap, then the contents of fd.
+ *  args is where the section's arguments start in datap; the first is
+ *  the section name, or the path for a FILE section.
+ *
+ *  If the section names a golden file with --file, only the heading
+ *  is written.  With -o the golden file gets the contents of fd.
+ */
+
 static void write_section(struct test *test, const char *datap, int len,
-        int fd, const char *name)
+        const char *args, int fd, const char *name)
 {
-    int marked_no_nl = 0;
-    size_t cnt;
-    int has_nl;
+    struct section_args sargs;
+    const char *path;
+    ssize_t cnt;
+    int has_nl = 1;     // write_file() leaves it alone if there's no output
 
-    parse_section_args(datap, len,
+    memset(&sargs, 0, sizeof(sargs));
+    parse_section_args(args, datap + len - args,
             convert_testfile_name(test->testfile), test->testscanner.line,
-            start_output_section_argproc, &marked_no_nl);
+            start_output_section_argproc, &sargs);
 
     write(test->rewritefd, datap, len);
+
+    if(sargs.golden) {
+        path = (test->rewrite_golden ? golden_path(test, &sargs) : NULL);
+        if(path) {
+            replace_golden(test, path, fd);
+        }
+        return;
+    }
+
     cnt = write_file(test, test->rewritefd, fd, &has_nl);
+    if(cnt < 0) {
+        return;
+    }
 
-    if(marked_no_nl) {
+    if(sargs.no_trailing_newline) {
         // if a section is marked with --no-trailing-newline, we need
         // to print a newline here so that the testfile isn't messed up.
         // Otherwise, you'd end up with "STDOUT -n:STDERR:" on one line.
@@ -933,6 +1649,33 @@ static void write_section(struct test *test, const char *datap, int len,
 }
 
 
+/** Rewrites a FILE section with what the test left in the file.  If
+ *  the test didn't leave the file, the section is dropped.
+ */
+
+static void write_file_section(struct test *test, const char *datap, int len)
+{
+    const char *args;
+    char *path;
+    int fd;
+
+    path = file_section_path(test, datap, len, &args);
+    if(!path) {
+        // keep the heading so the error can be fixed.
+        write(test->rewritefd, datap, len);
+        return;
+    }
+
+    fd = open_home_file(test, path);
+    if(fd < 0) {
+        return;
+    }
+
+    write_section(test, datap, len, args, fd, path);
+    close(fd);
+}
+
+
 /** Writes the actual results in place of the expected results.
  */
 
@@ -947,7 +1690,7 @@ void parse_section_output(struct test *test, int sec,
             break;
 
         case exSTDOUT|exNEW:
-            write_section(test, datap, len, test->outfd, "STDOUT");
+            write_section(test, datap, len, datap, test->outfd, "STDOUT");
             test->stdout_match = match_yes;
             break;
         case exSTDOUT:
@@ -955,13 +1698,28 @@ void parse_section_output(struct test *test, int sec,
             break;
 
         case exSTDERR|exNEW:
-            write_section(test, datap, len, test->errfd, "STDERR");
+            write_section(test, datap, len, datap, test->errfd, "STDERR");
             test->stderr_match = match_yes;
             break;
         case exSTDERR:
             // ignore all data in the expected stderr
             break;
 
+        case exFD3|exNEW:
+            write_section(test, datap, len, datap, test->fd3fd, "FD3");
+            test->fd3_match = match_yes;
+            break;
+        case exFD3:
+            // ignore all data in the expected fd 3 output
+            break;
+
+        case exFILE|exNEW:
+            write_file_section(test, datap, len);
+            break;
+        case exFILE:
+            // ignore all data in the expected file
+            break;
+
         default:
             write(test->rewritefd, datap, len);
     }
@@ -985,58 +1743,70 @@ static void dump_reason(struct test *test, const char *name)
 
 
 /** Prints the result sections as tested.
+ *
+ *  @returns 0, or -1 if the test had to be aborted.
  */
 
-void dump_results(struct test *test)
+int dump_results(struct test *test)
 {
     int tempref = 0;
 
     if(was_aborted(test->status)) {
         dump_reason(test, "was aborted");
-        return;
+        return 0;
     }
 
     if(was_disabled(test->status)) {
         dump_reason(test, "is disabled");
-        return;
+        return 0;
 
     }
 
     if(!was_started(test->status)) {
         fprintf(stderr, "Error: %s was not started due to errors in %s.\n",
                 convert_testfile_name(test->testfile), test->last_file_processed);
-        test_failures++;
-        return;
+        test->counts->failures++;
+        test->failed = 1;
+        return 0;
     }
 
     // The command section has already been dumped.  We just
-    // need to dump the STDERR and STDOUT results.
+    // need to dump the STDERR, STDOUT, FD3, and FILE results.
 
     test->stdout_match = match_unknown;
     test->stderr_match = match_unknown;
+    test->fd3_match = match_unknown;
 
-    scan_sections(test, &test->testscanner, parse_section_output, &tempref);
+    if(scan_sections(test, &test->testscanner, parse_section_output, &tempref) < 0) {
+        return -1;
+    }
 
     // if any sections haven't been output, but they differ from
     // the default, then they need to be output here at the end.
-    if(test->stderr_match == match_unknown && fd_has_data(test, test->errfd)) {
+    if(test->stderr_match == match_unknown && fd_has_data(test, test->errfd) > 0) {
         write_strconst(test->rewritefd, "STDERR:\n");
         write_file(test, test->rewritefd, test->errfd, NULL);
     }
-    if(test->stdout_match == match_unknown && fd_has_data(test, test->outfd)) {
+    if(test->stdout_match == match_unknown && fd_has_data(test, test->outfd) > 0) {
         write_strconst(test->rewritefd, "STDOUT:\n");
         write_file(test, test->rewritefd, test->outfd, NULL);
     }
+    if(test->fd3_match == match_unknown && fd_has_data(test, test->fd3fd) > 0) {
+        write_strconst(test->rewritefd, "FD3:\n");
+        write_file(test, test->rewritefd, test->fd3fd, NULL);
+    }
+
+    return test->aborted ? -1 : 0;
 }
 
 
-void print_test_summary(struct timeval *start, struct timeval *stop)
+void print_test_summary(struct test_counts *counts, int quiet, struct timeval *start, struct timeval *stop)
 {
     printf("\n");
-    printf("%d test%s run, ", test_runs, (test_runs != 1 ? "s" : ""));
-    printf("%d success%s, ", test_successes,
-            (test_successes != 1 ? "es" : ""));
-    printf("%d failure%s", test_failures, (test_failures != 1 ? "s" : ""));
+    printf("%d test%s run, ", counts->runs, (counts->runs != 1 ? "s" : ""));
+    printf("%d success%s, ", counts->successes,
+            (counts->successes != 1 ? "es" : ""));
+    printf("%d failure%s", counts->failures, (counts->failures != 1 ? "s" : ""));
 
     if(!quiet) {
         printf(", in ");
@@ -1047,33 +1817,86 @@ void print_test_summary(struct timeval *start, struct timeval *stop)
 }
 
 
-void test_init(struct test *test)
+void test_init(struct test *test, const struct test_options *opts,
+        struct test_counts *counts, struct arena *arena)
 {
-    test_runs++;
+    counts->runs++;
     memset(test, 0, sizeof(struct test));
+    test->opts = opts;
+    test->counts = counts;
+    test->arena = arena;
     test->rewritefd = -1;
+    test->prologuefd = -1;
+    test->homefd = -1;
 }
 
 
-void test_abort(struct test *test, const char *fmt, ...)
+/** Stops a test because tmtest itself couldn't go on with it.  The
+ *  reason is stored as if the test had called ABORT and test->aborted
+ *  is set so the runner knows not to print any results.  Callers must
+ *  then return their own error.
+ *
+ *  @returns -1 so callers can return it directly.
+ */
+
+int test_abort(struct test *test, const char *fmt, ...)
 {
-    char buf[BUFSIZ];
+    static char nomem[] = "out of memory";
+    char *buf;
     va_list ap;
 
-    va_start(ap, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, ap);
-    va_end(ap);
+    // only the first reason is kept, the rest are fallout from it.
+    if(test->aborted) {
+        return -1;
+    }
+
+    buf = arena_alloc(test->arena, BUFSIZ);
+    if(buf) {
+        va_start(ap, fmt);
+        vsnprintf(buf, BUFSIZ, fmt, ap);
+        va_end(ap);
+    }
 
+    test->aborted = 1;
     test->status = test_was_aborted;
-    test->status_reason = strdup(buf);
-    longjmp(test->abort_jump, 1);
+    test->status_reason = (buf ? buf : nomem);
+    return -1;
+}
+
+
+/** Allocates size bytes from the test's arena.  They're released
+ *  when the arena is reset so there's no need to free them.
+ *  Aborts the test and returns NULL if there's no memory left.
+ */
+
+void* test_alloc(struct test *test, size_t size)
+{
+    void *ret = arena_alloc(test->arena, size);
+    if(!ret) {
+        test_abort(test, "out of memory allocating %d bytes\n", (int)size);
+    }
+    return ret;
 }
 
 
+/** Releases what the test holds outside its arena.
+ */
+
 void test_free(struct test *test)
 {
+    struct test_file *file;
     int err;
 
+    // only open if the test was aborted while comparing the file
+    for(file=test->files; file; file=file->next) {
+        if(file->fd >= 0) {
+            close(file->fd);
+        }
+    }
+    if(test->homefd >= 0) {
+        close(test->homefd);
+    }
+
     if(test->diffname) {
         err = close(test->diff_fd);
         if(err < 0) {
@@ -1083,21 +1906,12 @@ void test_free(struct test *test)
         if(err < 0) {
             fprintf(stderr, "Could not remove %s: %s\n", test->diffname, strerror(errno));
         }
-        free(test->diffname);
-    }
-
-    if(test->status_reason) {
-        free(test->status_reason);
-    }
-
-    if(test->last_file_processed) {
-        free(test->last_file_processed);
     }
 }
 
 
-int test_get_exit_value()
+int test_get_exit_value(struct test_counts *counts)
 {
-    return test_failures < 99 ? test_failures : 99;
+    return counts->failures < 99 ? counts->failures : 99;
 }
 
@@ -7,7 +7,10 @@
  */
 
 #include "compare.h"
-#include <setjmp.h>
+
+struct script;
+struct arena;
+struct config_cache;
 
 
 /**
@@ -43,15 +46,41 @@ typedef enum {
 #define was_disabled(st) ((st) == config_was_disabled || (st) == test_was_disabled)
 
 
-// flags for how test output should be printed
-extern int quiet;
-extern int verbose;
+/** The settings a test gets from the runner that starts it.  Every
+ *  test points at its runner's copy.
+ */
 
+struct test_options {
+    int quiet;                  ///< print less when running tests
+    int verbose;                ///< print more when running tests
+    const char *config_file;    ///< if set then read this config file before scanning through directories
+    struct config_cache *configs;   ///< what the config files said last time, see vars.c
+};
 
-// if set then read this config file before scanning through directories
-extern char *config_file;
+/** Counts the tests as their results are processed.
+ */
+
+struct test_counts {
+    int runs;
+    int successes;
+    int failures;
+};
 
-// all strings are malloc'd and need to be freed when the test is finished.
+
+/** A file that a FILE section compared against.  The test leaves it
+ *  in its testhome.
+ */
+
+struct test_file {
+    const char *path;           ///< relative to the testhome, with no leading "./"
+    int fd;                     ///< open while the section is being compared, otherwise -1
+    enum matchval match;        ///< tells whether the expected and actual file matches.
+    struct test_file *next;
+};
+
+
+// all strings and buffers are allocated from the test's arena and go
+// away when the arena is reset.
 
 struct test {
     const char *testfile;       ///< relative or absolute path to the testfile
@@ -59,10 +88,15 @@ struct test {
     scanstate testscanner;      ///< scans the testfile.  may be stdin so seeking is not allowed.
 
     int rewritefd;              ///< where to dump the rewritten test.  -1 if we're just running the tests, or the fd of the file that should receive the test contents.
+    int rewrite_golden;         ///< when rewriting the test, also replace the golden files named by --file sections.
 
     int outfd;                  ///< the file that receives the test's stdout.
     int errfd;                  ///< the file that receives the test's stderr.
+    int fd3fd;                  ///< the file that receives whatever the test writes to fd 3.
+    const char *fd3name;        ///< the name of fd3fd's file.  The shell opens it for the test.
+    int homefd;                 ///< the testhome, even after it's been moved aside.  Opened once the test finishes, -1 until then.
     int statusfd;               ///< receives the runtime test status messages.
+    int prologuefd;             ///< with --dir-shell, holds the status messages from reading the config files.  -1 if not used.
     int exitno;                 ///< the testfile exited with this value
     int exitsignal;             ///< the value returned for the test by waitpid(2)
     int exitcored;              ///< if exitsignal is true, true if child core dumped.
@@ -79,27 +113,39 @@ struct test {
 
     enum matchval stdout_match; ///< tells whether the expected and actual stdout matches.
     enum matchval stderr_match; ///< tells whether the expected and actual stderr matches.
-
-    jmp_buf abort_jump;
+    enum matchval fd3_match;    ///< tells whether the expected and actual fd 3 output matches.
+    struct test_file *files;    ///< the files compared by FILE sections, the most recent section first.
+    int files_reported;         ///< set if the FILE sections were compared inside the test's namespace.  see test_report_files().
+    int compared;               ///< set once test_compare_results() has run.
+    int failed;                 ///< set when the results are analyzed if the test counted as a failure.
+    const struct test_options *opts;  ///< the runner's settings
+    struct test_counts *counts; ///< the test's results are counted here
+    struct arena *arena;        ///< owns everything allocated for the test
+    int aborted;                ///< set by test_abort().  the test can't go on and its results mustn't be printed.
 };
 
 
-void scan_status_file(struct test *test);
-void test_command_copy(struct test *test, FILE *fp);
+int scan_status_file(struct test *test);
+int test_command_copy(struct test *test, struct script *sc);
 
-void test_results(struct test *test);
-void dump_results(struct test *test);
-void print_test_summary(struct timeval *start, struct timeval *stop);
+int test_compare_results(struct test *test);
+int test_expects_file(struct test *test, const char *path);
+int test_report_files(struct test *test, int testfd, int fd);
+int test_results(struct test *test);
+int dump_results(struct test *test);
+void print_test_summary(struct test_counts *counts, int quiet, struct timeval *start, struct timeval *stop);
 int check_for_failure(struct test *test, const char *testpath);
-int test_get_exit_value();
+int test_get_exit_value(struct test_counts *counts);
 
-void test_init(struct test *test);
+void test_init(struct test *test, const struct test_options *opts,
+        struct test_counts *counts, struct arena *arena);
 void test_free(struct test *test);
-void test_abort(struct test *test, const char *fmt, ...);
+int test_abort(struct test *test, const char *fmt, ...);
+void* test_alloc(struct test *test, size_t size);
 
 
 // random utility function for start_diff.  Return value is true if the
 // file ends in a newline, false if not.
-size_t write_file(struct test *test, int outfd, int infd, int *ending_nl);
+ssize_t write_file(struct test *test, int outfd, int infd, int *ending_nl);
 
 const char *convert_testfile_name(const char *fn);
@@ -13,8 +13,7 @@
 // by anything else, it's interpreted as data.
 
 
-// TOTEST: >8K token not containing a cr
-// STDOUT:, STDERR:, etc at the EOF with no data.
+// TOTEST: STDOUT:, STDERR:, etc at the EOF with no data.
 // STDOUT at the beginning of the file.
 // keyword without a colon
 // 		NO NO NO keyword without a colon is still the keyword.
@@ -25,7 +24,10 @@
 // 		What happes when platform doesn't match the testfile?
 // 	Get rid of rewrite_command_section
 
+#include <string.h>
+
 #include "tfscan.h"
+#include "re2c/read-mem.h"
 
 
 #define START(x) (ss->scanref=(void*)(long int)(x))
@@ -35,8 +37,26 @@
 #endif
 
 
+// Every routine below is written once with a mem argument and
+// compiled twice: with mem false it works with any reader, with mem
+// true it's only used on scanners attached by readmem_init().  All
+// of those scanners' data is already in the buffer so a refill is
+// always eof.  tfscan_attach() picks the set once and each set only
+// ever hands off to itself, so the memory scanner makes no indirect
+// calls and the compiler can throw the refill paths away.
+
+#define INLINE static inline __attribute__((always_inline))
+
+// refills the buffer.  returns what the reader returned.
+#define FILL(mem) ((mem) ? 0 : (*ss->read)(ss))
+
 int tfscan_tok_start(scanstate *ss);
 int tfscan_nontok_start(scanstate *ss);
+static int tfscan_mem_tok_start(scanstate *ss);
+static int tfscan_mem_nontok_start(scanstate *ss);
+
+#define TOK_START(mem) ((mem) ? tfscan_mem_tok_start : tfscan_tok_start)
+#define NONTOK_START(mem) ((mem) ? tfscan_mem_nontok_start : tfscan_nontok_start)
 
 
 /*!re2c
@@ -49,6 +69,8 @@ ANYN    = [\000-\377]\[\n];
 
 "STDOUT" WS* ":" ANYN* "\n"  { START(exSTDOUT); return exNEW|exSTDOUT; }
 "STDERR" WS* ":" ANYN* "\n"  { START(exSTDERR); return exNEW|exSTDERR; }
+"FD3" WS* ":" ANYN* "\n"     { START(exFD3); return exNEW|exFD3; }
+"FILE" [ \t:] ANYN* "\n"     { START(exFILE); return exNEW|exFILE; }
 
 ANYN* "\n"                  { return (int)ss->scanref; }
 
@@ -64,10 +86,36 @@ ANYN* "\n"                  { return (int)ss->scanref; }
 */
 
 
-static int nontok_start(scanstate *ss)
+/** Returns the first CR or LF between cp and ce, or ce if there isn't
+ *  one.  Most lines are short so the first few bytes are checked
+ *  directly, after that memchr goes much faster than looking at a
+ *  byte at a time.
+ */
+
+INLINE const char* find_eol(const char *cp, const char *ce)
+{
+    const char *stop = (ce - cp > 32 ? cp + 32 : ce);
+    const char *nl, *cr;
+
+    for(; cp < stop; cp++) {
+        if(*cp == '\r' || *cp == '\n') {
+            return cp;
+        }
+    }
+    if(cp >= ce) {
+        return ce;
+    }
+
+    nl = memchr(cp, '\n', ce - cp);
+    cr = memchr(cp, '\r', (nl ? nl : ce) - cp);
+    return cr ? cr : nl ? nl : ce;
+}
+
+
+INLINE int nontok_start(scanstate *ss, int mem)
 {
 	if(YYCURSOR >= YYLIMIT) {
-		int r = (*ss->read)(ss);
+		int r = FILL(mem);
 		// if there was an error, return an error token.
 		if(r < 0) return r;
 		// if we're completely out of data, return eof.
@@ -77,10 +125,7 @@ static int nontok_start(scanstate *ss)
 
 	// Since it's impossible to have a token at this point so we
 	// scan forward to the next CR/LF.
-	while(YYCURSOR < YYLIMIT) {
-		if(*YYCURSOR == '\r' || *YYCURSOR == '\n') break;
-		YYCURSOR++;
-	}
+	YYCURSOR = find_eol(YYCURSOR, YYLIMIT);
 	if(YYCURSOR >= YYLIMIT) {
 		// We have to assume that we previously read as much data as
 		// possible.  So the entire buffer is just data with no tokens
@@ -94,13 +139,13 @@ static int nontok_start(scanstate *ss)
     ss->line += 1;
 
 	// We have potential for finding a token at this point.
-	ss->state = tfscan_tok_start;
+	ss->state = TOK_START(mem);
 	return (long int)ss->scanref;
 }
 
 
 
-static int scan_to_end_of_keyword(scanstate *ss, int tok)
+INLINE int scan_to_end_of_keyword(scanstate *ss, int tok, int mem)
 {
     int r;
 
@@ -112,7 +157,7 @@ static int scan_to_end_of_keyword(scanstate *ss, int tok)
     // there's a chance we can be called with an empty buffer.
     // If so, we need to fill it before proceeding.
     if(YYCURSOR >= YYLIMIT) {
-        r = (*ss->read)(ss);
+        r = FILL(mem);
         if(r < 0) return r;
         // if we're at eof, then the current token is just data.
         if(r == 0) return (long int)ss->scanref;
@@ -123,18 +168,22 @@ static int scan_to_end_of_keyword(scanstate *ss, int tok)
     {
         // We had a keyword but it didn't end in a proper delimiter.
         // Therefore, it's data, not a keyword.
-        ss->state = tfscan_nontok_start;
-        return nontok_start(ss);
+        ss->state = NONTOK_START(mem);
+        return nontok_start(ss, mem);
     }
 
 	while(*YYCURSOR != '\r' && *YYCURSOR != '\n') {
 		YYCURSOR++;
 		if(YYCURSOR >= YYLIMIT) {
             // try to fill the buffer (maybe it's a really long keyword)
-            r = (*ss->read)(ss);
+            r = FILL(mem);
             if(r < 0) return r;
-            // if we're at eof, then the current token is just data.
-            if(r == 0) return (long int)ss->scanref;
+            // if we're at eof or the line won't fit in the buffer, then
+            // the current token is just data.
+            if(r == 0) {
+                ss->state = NONTOK_START(mem);
+                return (long int)ss->scanref;
+            }
 		}
 	}
 
@@ -154,7 +203,7 @@ static int scan_to_end_of_keyword(scanstate *ss, int tok)
  * finds a new section, you get a exNEW+TOKEN of the new section.
  */
 
-int tfscan_tok_start(scanstate *ss)
+INLINE int tok_start(scanstate *ss, int mem)
 {
     int r;
 
@@ -166,7 +215,7 @@ int tfscan_tok_start(scanstate *ss)
     // statement is an arbitrary number; if we have less than that
     // number of bytes available in the buffer, we read some more data.
 	if(YYCURSOR+16 >= YYLIMIT) {
-		r = (*ss->read)(ss);
+		r = FILL(mem);
 		// if there was an error, return an error token.
 		if(r < 0) return r;
 		// Only if we're _completely_ out of data, return eof.
@@ -181,26 +230,36 @@ int tfscan_tok_start(scanstate *ss)
     // of a line (previous character was either start-of-file or \n).
 	// So check to see if there's a token.
 
-	if(YYCURSOR + 7 <= YYLIMIT) {
+	if(YYCURSOR + 4 <= YYLIMIT) {
 		// There's enough data in this buffer to contain a keyword.
-		// If there are less than 8 bytes in the buffer then it means
-		// that we're 7 bytes from the EOF and there's no chance that
-		// there's another keyword to scan.  (6 bytes for the keyword,
-		// 1 byte for the colon, one byte for the newline).
+		// If there are less than 4 bytes in the buffer then it means
+		// that we're 3 bytes from the EOF and there's no chance that
+		// there's another keyword to scan.  (3 bytes for FD3, 1 byte
+		// for the colon.  STDOUT and STDERR need 7).
 		switch(*YYCURSOR) {
 			case 'S':
-				if(YYCURSOR[1] == 'T' && YYCURSOR[2] == 'D') {
+				if(YYCURSOR + 7 <= YYLIMIT && YYCURSOR[1] == 'T' && YYCURSOR[2] == 'D') {
 					if(YYCURSOR[3]=='O' && YYCURSOR[4]=='U' && YYCURSOR[5]=='T') {
                         YYCURSOR += 6;
-						return scan_to_end_of_keyword(ss, exSTDOUT);
+						return scan_to_end_of_keyword(ss, exSTDOUT, mem);
 					}
 					if(YYCURSOR[3]=='E' && YYCURSOR[4]=='R' && YYCURSOR[5]=='R') {
                         YYCURSOR += 6;
-						return scan_to_end_of_keyword(ss, exSTDERR);
+						return scan_to_end_of_keyword(ss, exSTDERR, mem);
 					}
 				}
 				// else it wasn't a token so we can just keep scanning.
 				break;
+			case 'F':
+				if(YYCURSOR[1] == 'D' && YYCURSOR[2] == '3') {
+                    YYCURSOR += 3;
+					return scan_to_end_of_keyword(ss, exFD3, mem);
+				}
+				if(YYCURSOR[1] == 'I' && YYCURSOR[2] == 'L' && YYCURSOR[3] == 'E') {
+                    YYCURSOR += 4;
+					return scan_to_end_of_keyword(ss, exFILE, mem);
+				}
+				break;
 			default:
 				break;
 		}
@@ -209,20 +268,40 @@ int tfscan_tok_start(scanstate *ss)
 	// So there wasn't a keyword at this point in the buffer.
 	// We just treat it as random data.  Since we haven't moved the
     // cursor we can just call straight into the nontok routine.
-	ss->state = tfscan_nontok_start;
-	return tfscan_nontok_start(ss);
+	ss->state = NONTOK_START(mem);
+	return nontok_start(ss, mem);
+}
+
+
+int tfscan_tok_start(scanstate *ss)
+{
+    return tok_start(ss, 0);
 }
 
 
 int tfscan_nontok_start(scanstate *ss)
 {
 	scanner_enter(ss);
-    return nontok_start(ss);
+    return nontok_start(ss, 0);
+}
+
+
+static int tfscan_mem_tok_start(scanstate *ss)
+{
+    return tok_start(ss, 1);
+}
+
+
+static int tfscan_mem_nontok_start(scanstate *ss)
+{
+	scanner_enter(ss);
+    return nontok_start(ss, 1);
 }
 	
 
 
-/** Prepares the given scanner to scan a testfile.
+/** Prepares the given scanner to scan a testfile.  Attach the reader
+ *  first: a scanner reading from memory gets a faster scanner.
  *
  *  @param ss the scanstate to attach to.  Passing NULL is safely ignored.
  *  @returns ss.  Always.  This routine makes no calls that can fail.
@@ -232,7 +311,7 @@ scanstate* tfscan_attach(scanstate *ss)
 {
     if(ss) {
         START(exCOMMAND);
-        ss->state = tfscan_tok_start;
+        ss->state = TOK_START(readmem_attached(ss));
     }
 
     return ss;
@@ -9,18 +9,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <pwd.h>
+#include <fcntl.h>
 #include <assert.h>
 
 #include "test.h"
 #include "vars.h"
-
-#define CONFIG_FILE "tmtest.conf"
+#include "script.h"
 
 
 /** @file vars.c
@@ -33,13 +34,12 @@
  * They should ignore write errors.  They will happpen whenever the
  * test (or a config file) exits early and should properly be ignored.
  *
- * NOTE: this file is the only place in this project that we use
- * fileptrs.  Well, other than printing status information from main.c,
- * and, by proxy, the test_command_copy() routine.
- * Everywhere else we use Unix I/O.  Ensure they never mix.
+ * Everything is appended to a struct script (see script.c) which is
+ * sent to the shell in a single writev once the whole template has
+ * been expanded.
  */
 
-static int var_testexec(struct test *test, FILE* fp, const char *var)
+static int var_testexec(struct test *test, struct script *sc)
 {
     // If the filename is a dash, it means we should feed the test
     // from stdin.  Otherwise, just have the shell execute the testfile.
@@ -48,33 +48,39 @@ static int var_testexec(struct test *test, FILE* fp, const char *var)
     if(test->testfile[0] == '-' && test->testfile[1] == '\0') {
         // bash3 doesn't support setting LINENO anymore.  Bash2 did.
         // what the hell, it's worth a shot.
-        fprintf(fp, "LINENO=0\n");
-        test_command_copy(test, fp);
-    } else {
-
-        test_command_copy(test, NULL);
-        fprintf(fp, ". '%s'", test->testpath);
+        script_printf(sc, "LINENO=0\n");
+        return test_command_copy(test, sc);
     }
 
+    if(test_command_copy(test, NULL) < 0) {
+        return -1;
+    }
+    script_printf(sc, ". '%s'", test->testpath);
     return 0;
 }
 
 
-static int var_outfd(struct test *test, FILE *fp, const char *var)
+static int var_outfd(struct test *test, struct script *sc)
+{
+    script_printf(sc, "%d", test->outfd);
+    return 0;
+}
+
+static int var_errfd(struct test *test, struct script *sc)
 {
-    fprintf(fp, "%d", test->outfd);
+    script_printf(sc, "%d", test->errfd);
     return 0;
 }
 
-static int var_errfd(struct test *test, FILE *fp, const char *var)
+static int var_statusfd(struct test *test, struct script *sc)
 {
-    fprintf(fp, "%d", test->errfd);
+    script_printf(sc, "%d", test->statusfd);
     return 0;
 }
 
-static int var_statusfd(struct test *test, FILE *fp, const char *var)
+static int var_fd3file(struct test *test, struct script *sc)
 {
-    fprintf(fp, "%d", test->statusfd);
+    script_printf(sc, "'%s'", test->fd3name);
     return 0;
 }
 
@@ -90,23 +96,26 @@ int file_exists(char *path)
 
 
 
-#define check_config_str(t,f,s,n) check_config((t),(f),(s),strlen(s),(n))
+typedef void (*config_proc)(struct test *test, const char *path, void *ref);
+
+#define check_config_str(t,p,r,s,n,k) check_config((t),(p),(r),(s),strlen(s),(n),(k))
 
 
 /** Checks to see if the file exists and, if it does, then it
- *  outputs the appropriate commands.
+ *  calls proc on it.
  *
  *  @param base The path.
  *  @param len The number of characters from base to use.
  *  @param name The filename.  It will be concatenated with a '/'
  *  onto the end of base.  Optional: if name is null then base will
  *  be used directly.  This is a 0-terminated string.
+ *  @param skip The --config file, which was already read.  May be NULL.
  *
- *  @see var_config_files()
+ *  @see walk_config_files()
  */
 
-static void check_config(struct test *test, FILE *fp,
-        const char *base, int len, const char *name)
+static void check_config(struct test *test, config_proc proc, void *ref,
+        const char *base, int len, const char *name, const char *skip)
 {
     char buf[PATH_MAX];
 
@@ -124,7 +133,7 @@ static void check_config(struct test *test, FILE *fp,
         strcat(buf+len+1, name);
     }
 
-    if(config_file && strcmp(buf,config_file) == 0) {
+    if(skip && strcmp(buf,skip) == 0) {
         // If buf == config_file then it means the user must have
         // specified a config file within the current search path.
         // This ensures that we don't include it twice.
@@ -132,37 +141,35 @@ static void check_config(struct test *test, FILE *fp,
     }
 
     if(file_exists(buf)) {
-        fprintf(fp, "echo 'CONFIG: %s' >&%d\n", buf, test->statusfd);
-        fprintf(fp, "MYFILE='%s'\n. '%s'\n", buf, buf);
+        (*proc)(test, buf, ref);
     }
 }
 
 
-/** Prints the shell commands needed to read in all available config files.
+/** Calls proc on every config file that applies to the test, in the
+ *  order they should be read.
+ *
+ *  @returns 0, or -1 if the test had to be aborted.
  */
 
-static int var_config_files(struct test *test, FILE *fp, const char *var)
+static int walk_config_files(struct test *test, config_proc proc, void *ref)
 {
+    const char *config_file = test->opts->config_file;
     char buf[PATH_MAX];
-    char *cp, *oldcfg;
+    char *cp;
     int confbaselen;
 
-    // check global configuration files
+    // check global configuration files.  It mustn't be skipped as
+    // a duplicate of itself.
     if(config_file) {
-        // Need to temporarily forget config_file, otherwise it will think
-        // that it has included config_file twice and refuse to include it.
-        oldcfg = config_file;
-        config_file = NULL;
-
         buf[0] = '\0';
-        strncat(buf, oldcfg, sizeof(buf) - 1);
+        strncat(buf, config_file, sizeof(buf) - 1);
         cp = strrchr(buf, '/');
         if(cp == NULL) {
-            test_abort(test, "Illegal config_file: '%s'\n", buf);
+            return test_abort(test, "Illegal config_file: '%s'\n", buf);
         }
         *cp = '\0';
-        check_config_str(test, fp, buf, cp+1);
-        config_file = oldcfg;
+        check_config_str(test, proc, ref, buf, cp+1, NULL);
     }
 
     // check config files in the current hierarchy
@@ -181,45 +188,465 @@ static int var_config_files(struct test *test, FILE *fp, const char *var)
                 memcmp(buf, config_file, cp-buf)==0) {
             continue;
         }
-        check_config(test, fp, buf, cp-buf, CONFIG_FILE);
+        check_config(test, proc, ref, buf, cp-buf, CONFIG_FILE, config_file);
+    }
+    check_config_str(test, proc, ref, buf, CONFIG_FILE, config_file);
+    return 0;
+}
+
+
+static void print_config_file(struct test *test, const char *path, void *ref)
+{
+    struct script *sc = ref;
+
+    script_printf(sc, "echo 'CONFIG: %s' >&%d\n", path, test->statusfd);
+    script_printf(sc, "MYFILE='%s'\n. '%s'\n", path, path);
+}
+
+
+/** Prints the shell commands needed to read in all available config files.
+ */
+
+static int var_config_files(struct test *test, struct script *sc)
+{
+    return walk_config_files(test, print_config_file, sc);
+}
+
+
+static void print_setup_config(struct test *test, const char *path, void *ref)
+{
+    script_printf(ref, "MYFILE='%s'\n. '%s'\n", path, path);
+}
+
+
+/** Prints the shell commands that read the config files before a
+ *  directory's tmtest.setup runs.  They're the same as the test's
+ *  except nothing is reported to the status file.
+ */
+
+int setup_config_files(struct test *test, struct script *sc)
+{
+    return walk_config_files(test, print_setup_config, sc);
+}
+
+
+/** If line is a top-level TM_SHELL assignment, copies its value into
+ *  buf.  The value may be single or double quoted but must not contain
+ *  any expansions; tmtest needs to know the shell before any shell runs.
+ */
+
+static void parse_shell_line(const char *line, char *buf, int bufsiz)
+{
+    const char *cp, *ce;
+
+    if(strncmp(line, "TM_SHELL=", 9) != 0) {
+        return;
+    }
+
+    cp = line + 9;
+    if(*cp == '\'' || *cp == '"') {
+        ce = strchr(cp+1, *cp);
+        if(!ce) {
+            return;
+        }
+        cp += 1;
+    } else {
+        ce = cp + strcspn(cp, " \t\r\n;#");
+    }
+
+    if(ce - cp >= bufsiz || memchr(cp, '$', ce - cp) || memchr(cp, '`', ce - cp)) {
+        return;
+    }
+    memcpy(buf, cp, ce - cp);
+    buf[ce - cp] = '\0';
+}
+
+
+struct disabled_state {
+    char path[PATH_MAX];        ///< the config file that disables the tests, empty if none
+    char *reason;
+    int inert;                  ///< set while the config files read so far can't change what DISABLED does
+};
+
+
+/** What config_shell() and config_disabled() remember about the config
+ *  files for the last directory.  Each runner has its own.
+ */
+
+struct config_cache {
+    int shell_known;            ///< set once shell is valid for shell_dir
+    char shell_dir[PATH_MAX];
+    char shell[PATH_MAX];
+    int disabled_known;         ///< set once ds is valid for disabled_dir
+    char disabled_dir[PATH_MAX];
+    struct disabled_state ds;
+};
+
+
+struct config_cache* config_cache_new()
+{
+    return calloc(1, sizeof(struct config_cache));
+}
+
+
+void config_cache_free(struct config_cache *cc)
+{
+    if(cc) {
+        free(cc->ds.reason);
+        free(cc);
+    }
+}
+
+
+/** Makes config_shell() and config_disabled() read the config files
+ *  again rather than trusting what they remember.  Used by --watch
+ *  when a config file changes.
+ */
+
+void forget_config_files(struct config_cache *cc)
+{
+    cc->shell_known = 0;
+    cc->disabled_known = 0;
+}
+
+
+static void scan_config_shell(struct test *test, const char *path, void *ref)
+{
+    char line[BUFSIZ];
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if(!fp) {
+        // the shell will complain about it when it tries to read it.
+        return;
+    }
+
+    while(fgets(line, sizeof(line), fp)) {
+        parse_shell_line(line, ref, PATH_MAX);
+    }
+
+    fclose(fp);
+}
+
+
+/** Returns the shell that the config files ask the test to be run
+ *  with (the last TM_SHELL= line at the start of a line wins), or
+ *  NULL if they don't specify one or the test had to be aborted.
+ *
+ *  Tests are run directory by directory so the answer for the last
+ *  directory is remembered.
+ */
+
+const char* config_shell(struct test *test)
+{
+    struct config_cache *cc = test->opts->configs;
+    const char *cp;
+    int len;
+
+    cp = strrchr(test->testpath, '/');
+    len = (cp ? cp - test->testpath : strlen(test->testpath));
+    if(len >= sizeof(cc->shell_dir)) {
+        return NULL;
+    }
+
+    if(!cc->shell_known || len != strlen(cc->shell_dir) ||
+            memcmp(cc->shell_dir, test->testpath, len) != 0) {
+        cc->shell_known = 1;
+        memcpy(cc->shell_dir, test->testpath, len);
+        cc->shell_dir[len] = '\0';
+        cc->shell[0] = '\0';
+        if(walk_config_files(test, scan_config_shell, cc->shell) < 0) {
+            cc->shell_known = 0;
+            return NULL;
+        }
+    }
+
+    return cc->shell[0] ? cc->shell : NULL;
+}
+
+
+/** Returns true if the first command in buf is an unconditional
+ *  DISABLED or DISABLE.  Only blank lines and comments may come before
+ *  it and its arguments must be plain words, otherwise we can't be
+ *  sure what the shell would do and the caller should run the test.
+ *
+ *  If it was given a reason, a malloc'd copy is stored in *reason
+ *  (with words separated by single spaces, just like "$*").
+ */
+
+int parse_disabled(const char *buf, size_t len, char **reason)
+{
+    const char *end = buf + len;
+    const char *cp, *nl, *wp;
+    char *rp;
+
+    *reason = NULL;
+
+    for(cp=buf; cp < end; cp = nl + 1) {
+        nl = memchr(cp, '\n', end - cp);
+        if(!nl) {
+            // we may not have the whole line.
+            return 0;
+        }
+
+        while(cp < nl && (*cp == ' ' || *cp == '\t')) {
+            cp++;
+        }
+        if(cp == nl || *cp == '#') {
+            continue;
+        }
+
+        if(nl - cp >= 8 && memcmp(cp, "DISABLED", 8) == 0) {
+            cp += 8;
+        } else if(nl - cp >= 7 && memcmp(cp, "DISABLE", 7) == 0) {
+            cp += 7;
+        } else {
+            return 0;
+        }
+        if(cp < nl && *cp != ' ' && *cp != '\t') {
+            return 0;
+        }
+
+        // anything that the shell might expand, redirect, or treat as
+        // the end of the command means we have to let the shell do it.
+        for(wp=cp; wp < nl; wp++) {
+            if(!(*wp == ' ' || *wp == '\t') && (*wp < '!' || *wp > '~' ||
+                        strchr("\"'\\$`;&|<>(){}*?[]~#=", *wp))) {
+                return 0;
+            }
+        }
+
+        rp = malloc(nl - cp + 1);
+        if(!rp) {
+            return 0;
+        }
+        *reason = rp;
+        for(wp=cp; wp < nl; wp++) {
+            if(*wp != ' ' && *wp != '\t') {
+                if(rp > *reason && (wp[-1] == ' ' || wp[-1] == '\t')) {
+                    *rp++ = ' ';
+                }
+                *rp++ = *wp;
+            }
+        }
+        *rp = '\0';
+        if(rp == *reason) {
+            free(*reason);
+            *reason = NULL;
+        }
+        return 1;
     }
-    check_config_str(test, fp, buf, CONFIG_FILE);
 
     return 0;
 }
 
 
-/** Prints the value for variable varname to file fp.
- * Returns zero if successful, nonzero if not.
+
+
+/** Returns true if buf holds nothing but blank lines, comments, and
+ *  assignments of plain values.  Sourcing it can't define functions,
+ *  run commands, or change IFS so it can't change what DISABLED does.
  */
 
-int printvar(struct test *test, FILE *fp, const char *varname)
+static int parse_inert(const char *buf, size_t len)
 {
-    int i;
+    const char *end = buf + len;
+    const char *cp, *nl, *ce;
 
-    struct {
-        char *name;
-        int (*func)(struct test *test, FILE *fp, const char *var);
-    } funcs[] = {
-        { "CONFIG_FILES",   var_config_files },
-        { "OUTFD",          var_outfd },
-        { "ERRFD",          var_errfd },
-        { "STATUSFD",       var_statusfd },
-        { "TESTEXEC",       var_testexec },
-    };
+    for(cp=buf; cp < end; cp = nl + 1) {
+        nl = memchr(cp, '\n', end - cp);
+        if(!nl) {
+            nl = end;
+        }
+
+        while(cp < nl && (*cp == ' ' || *cp == '\t')) {
+            cp++;
+        }
+        if(cp == nl || *cp == '#') {
+            continue;
+        }
+
+        // the variable name
+        if(!(isalpha((unsigned char)*cp) || *cp == '_')) {
+            return 0;
+        }
+        for(ce=cp; ce < nl && (isalnum((unsigned char)*ce) || *ce == '_'); ce++) {
+            // skip it
+        }
+        if(ce == nl || *ce != '=' || (ce - cp == 3 && memcmp(cp, "IFS", 3) == 0)) {
+            return 0;
+        }
+        cp = ce + 1;
 
-    for(i=0; i<sizeof(funcs)/sizeof(funcs[0]); i++) {
-        if(strcmp(varname, funcs[i].name) == 0) {
-            if(funcs[i].func) {
-                return (*funcs[i].func)(test, fp, varname);
-            } else {
-                fprintf(fp, "<<<%s>>>", varname);
+        // the value, which may be quoted but can't expand anything.
+        if(cp < nl && (*cp == '\'' || *cp == '"')) {
+            ce = memchr(cp+1, *cp, nl - cp - 1);
+            if(!ce) {
                 return 0;
             }
+            if(*cp == '"' && (memchr(cp, '$', ce - cp) ||
+                        memchr(cp, '`', ce - cp) || memchr(cp, '\\', ce - cp))) {
+                return 0;
+            }
+            cp = ce + 1;
+        } else {
+            while(cp < nl && *cp != ' ' && *cp != '\t') {
+                if(*cp < '!' || *cp > '~' || strchr("\"'\\$`;&|<>(){}*?[]~#", *cp)) {
+                    return 0;
+                }
+                cp++;
+            }
+        }
+
+        // only a comment may follow it.
+        while(cp < nl && (*cp == ' ' || *cp == '\t')) {
+            cp++;
+        }
+        if(cp < nl && (*cp != '#' || (cp[-1] != ' ' && cp[-1] != '\t'))) {
+            return 0;
         }
     }
 
-    fprintf(stderr, "Unknown variable '%s' in template.\n", varname);
     return 1;
 }
 
+
+static void scan_config_disabled(struct test *test, const char *path, void *ref)
+{
+    struct disabled_state *ds = ref;
+    char buf[BUFSIZ];
+    ssize_t cnt;
+    int fd;
+
+    // the first config file to disable the tests is the one that's
+    // run, and only if the ones before it couldn't have changed that.
+    if(ds->path[0] || !ds->inert) {
+        return;
+    }
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        // the shell will complain about it when it tries to read it.
+        ds->inert = 0;
+        return;
+    }
+    cnt = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    if(cnt > 0 && parse_disabled(buf, cnt, &ds->reason)) {
+        snprintf(ds->path, sizeof(ds->path), "%s", path);
+    } else if(cnt < 0 || cnt == sizeof(buf) || !parse_inert(buf, cnt)) {
+        ds->inert = 0;
+    }
+}
+
+
+/** Returns the path of the config file that unconditionally disables
+ *  the test (see parse_disabled()), or NULL if the shell needs to read
+ *  the config files to find out or the test had to be aborted.  If the
+ *  config file gave a reason, it's stored in *reason.  Neither needs
+ *  to be freed.  A config file only counts if the ones read before it
+ *  do nothing but assign plain values (see parse_inert()).
+ *
+ *  If no config file disables the test, *inert is set if they all do
+ *  nothing but assign plain values.  Only then can the testfile's own
+ *  DISABLED be trusted without running the shell.
+ *
+ *  Like config_shell(), the answer for the last directory is
+ *  remembered.  A config file disables the whole tree below it too, so
+ *  a disabled directory's subdirectories don't need to be checked.
+ */
+
+const char* config_disabled(struct test *test, const char **reason, int *inert)
+{
+    struct config_cache *cc = test->opts->configs;
+    struct disabled_state *ds = &cc->ds;
+    const char *cp;
+    int len, dlen;
+
+    cp = strrchr(test->testpath, '/');
+    len = (cp ? cp - test->testpath : strlen(test->testpath));
+    *inert = 0;
+    if(len >= sizeof(cc->disabled_dir)) {
+        return NULL;
+    }
+
+    if(!cc->disabled_known) {
+        // the config files may have changed so don't trust anything.
+        ds->path[0] = '\0';
+        cc->disabled_dir[0] = '\0';
+    }
+
+    if(!cc->disabled_known || len != strlen(cc->disabled_dir) ||
+            memcmp(cc->disabled_dir, test->testpath, len) != 0) {
+        // still below the directory containing the disabling config file?
+        dlen = strrchr(ds->path, '/') ? strrchr(ds->path, '/') - ds->path : -1;
+        if(dlen < 0 || len < dlen || memcmp(ds->path, test->testpath, dlen) != 0 ||
+                (len > dlen && test->testpath[dlen] != '/')) {
+            ds->path[0] = '\0';
+            free(ds->reason);
+            ds->reason = NULL;
+            ds->inert = 1;
+            if(walk_config_files(test, scan_config_disabled, ds) < 0) {
+                cc->disabled_known = 0;
+                return NULL;
+            }
+        }
+        cc->disabled_known = 1;
+        memcpy(cc->disabled_dir, test->testpath, len);
+        cc->disabled_dir[len] = '\0';
+    }
+
+    *reason = ds->reason;
+    *inert = ds->inert;
+    return ds->path[0] ? ds->path : NULL;
+}
+
+
+/** Copies the command section straight into the script.  Shells that
+ *  can't define a function named "STDOUT:" use this instead of
+ *  sourcing the testfile, so they never see the expected results.
+ */
+
+static int var_testcopy(struct test *test, struct script *sc)
+{
+    return test_command_copy(test, sc);
+}
+
+
+/** Marks where the config files are done and the test itself starts.
+ *  It expands to nothing, it only tells --dir-shell where to split
+ *  the template.
+ */
+
+static int var_teststart(struct test *test, struct script *sc)
+{
+    return 0;
+}
+
+
+/** Appends the value for the given variable to the script.
+ * Returns zero if successful, nonzero if not.
+ */
+
+int printvar(struct test *test, struct script *sc, enum tmplvar var)
+{
+    // indexed by enum tmplvar
+    static int (*funcs[tmplvar_count])(struct test *test, struct script *sc) = {
+        var_config_files,
+        var_outfd,
+        var_errfd,
+        var_statusfd,
+        var_fd3file,
+        var_testexec,
+        var_testcopy,
+        var_teststart,
+    };
+
+    if(var < 0 || var >= tmplvar_count) {
+        fprintf(stderr, "Unknown variable %d in template.\n", var);
+        return 1;
+    }
+
+    return (*funcs[var])(test, sc);
+}
@@ -1,3 +1,45 @@
 struct test;
+struct script;
+struct config_cache;
 int file_exists(char *path);
-int printvar(struct test *test, FILE *fp, const char *varname);
+
+#define CONFIG_FILE "tmtest.conf"
+
+
+/** Identifies each variable that can be substituted into the template.
+ *  cstrfy -s refers to these by name so they must match the %(VAR)
+ *  names used in template.sh.
+ */
+
+enum tmplvar {
+    tmplvar_literal = -1,   ///< not a variable, the segment is literal text
+    tmplvar_CONFIG_FILES,
+    tmplvar_OUTFD,
+    tmplvar_ERRFD,
+    tmplvar_STATUSFD,
+    tmplvar_FD3FILE,
+    tmplvar_TESTEXEC,
+    tmplvar_TESTCOPY,
+    tmplvar_TESTSTART,
+    tmplvar_count
+};
+
+
+/** The template is split into these by cstrfy at build time.
+ */
+
+struct template_segment {
+    const char *text;       ///< the literal text, or NULL for a variable
+    int len;                ///< length of text
+    enum tmplvar var;       ///< which variable to substitute, or tmplvar_literal
+};
+
+
+int printvar(struct test *test, struct script *sc, enum tmplvar var);
+int setup_config_files(struct test *test, struct script *sc);
+const char* config_shell(struct test *test);
+int parse_disabled(const char *buf, size_t len, char **reason);
+const char* config_disabled(struct test *test, const char **reason, int *inert);
+struct config_cache* config_cache_new();
+void config_cache_free(struct config_cache *cc);
+void forget_config_files(struct config_cache *cc);
@@ -0,0 +1,293 @@
+/* watch.c
+ * 18 Oct 2026
+ *
+ * Waits for files to change.
+ *
+ * This file is covered by the MIT License.
+ */
+
+/** @file watch.c
+ *
+ * A thin layer over inotify for --watch.  The dirs in the tree are
+ * watched rather than their files because editors usually save by
+ * writing a new file and renaming it over the old one, and because a
+ * directory watch also notices new testfiles, config files, and
+ * subdirectories.  Config files outside the tree are watched one by
+ * one with watch_file(), which follows them when they're replaced.
+ *
+ * Saving a file tends to produce a flurry of events, and saving
+ * several files at once is common too, so watch_changes() keeps
+ * collecting events until things have been quiet for WATCH_DEBOUNCE
+ * milliseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+
+
+#define WATCH_DEBOUNCE 100
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_CREATE|IN_ONLYDIR)
+#define WATCH_FILE_EVENTS (IN_CLOSE_WRITE|IN_ATTRIB|IN_MOVE_SELF|IN_DELETE_SELF)
+
+
+struct watch {
+    char *path;         ///< the watched dir or file
+    int file;           ///< path is a file, see watch_file()
+    int replaced;       ///< the file was moved or deleted, so watch it again
+};
+
+static int watch_fd = -1;
+static struct watch *watches;   ///< indexed by watch descriptor
+static int watch_max;           ///< the number of entries in watches
+
+
+/** Starts watching.
+ *
+ *  @returns 0 if it worked, -1 if not (and the reason was printed).
+ */
+
+int watch_init()
+{
+    watch_fd = inotify_init1(IN_CLOEXEC);
+    if(watch_fd < 0) {
+        perror("--watch could not start inotify");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int add_watch(const char *path, int file)
+{
+    struct watch *grow;
+    int wd;
+
+    wd = inotify_add_watch(watch_fd, path, file ? WATCH_FILE_EVENTS : WATCH_EVENTS);
+    if(wd < 0) {
+        return -1;
+    }
+
+    if(wd >= watch_max) {
+        grow = realloc(watches, (wd + 64) * sizeof(struct watch));
+        if(!grow) {
+            perror("allocating watches");
+            exit(1);
+        }
+        memset(grow + watch_max, 0, (wd + 64 - watch_max) * sizeof(struct watch));
+        watches = grow;
+        watch_max = wd + 64;
+    }
+    if(!watches[wd].path) {
+        watches[wd].path = strdup(path);
+        watches[wd].file = file;
+    }
+    watches[wd].replaced = 0;
+
+    return 0;
+}
+
+
+/** Watches the files in dir.  Watching the same dir twice is harmless.
+ *  New subdirectories are reported but not watched; that's up to the
+ *  caller.
+ */
+
+void watch_dir(const char *dir)
+{
+    if(add_watch(dir, 0) < 0) {
+        fprintf(stderr, "Could not watch %s: %s\n", dir, strerror(errno));
+    }
+}
+
+
+/** Watches a single file, such as a config file outside the tree.
+ */
+
+void watch_file(const char *path)
+{
+    if(add_watch(path, 1) < 0) {
+        fprintf(stderr, "Could not watch %s: %s\n", path, strerror(errno));
+    }
+}
+
+
+/** Moves the watches of files that were replaced onto their new
+ *  files.  This waits until the events have settled so the editor
+ *  has had time to put the new file in place.  If it's gone for
+ *  good, so is the watch.
+ */
+
+static void rewatch_files()
+{
+    char *path;
+    int wd;
+
+    for(wd=0; wd<watch_max; wd++) {
+        if(!watches[wd].path || !watches[wd].replaced) {
+            continue;
+        }
+        path = watches[wd].path;
+        inotify_rm_watch(watch_fd, wd);
+        watches[wd].path = NULL;
+        watches[wd].replaced = 0;
+        add_watch(path, 1);
+        free(path);
+    }
+}
+
+
+static int add_path(char ***paths, int *count, const char *dir, const char *name)
+{
+    char **grow;
+    char *path;
+    int i;
+
+    path = malloc(strlen(dir) + strlen(name) + 2);
+    if(!path) {
+        return -1;
+    }
+    if(name[0]) {
+        sprintf(path, "%s%s%s", dir, (dir[strlen(dir)-1] == '/' ? "" : "/"), name);
+    } else {
+        strcpy(path, dir);
+    }
+
+    for(i=0; i<*count; i++) {
+        if(strcmp((*paths)[i], path) == 0) {
+            free(path);
+            return 0;
+        }
+    }
+
+    grow = realloc(*paths, (*count + 2) * sizeof(char*));
+    if(!grow) {
+        free(path);
+        return -1;
+    }
+    grow[(*count)++] = path;
+    grow[*count] = NULL;
+    *paths = grow;
+    return 0;
+}
+
+
+/** Reads whatever events are waiting and adds the paths they refer to.
+ *  Returns -1 if a signal interrupted the read.
+ */
+
+static int read_events(char ***paths, int *count, int *overflow)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    struct watch *w;
+    const char *name;
+    ssize_t len;
+    char *cp;
+
+    len = read(watch_fd, buf, sizeof(buf));
+    if(len < 0) {
+        if(errno != EINTR && errno != EAGAIN) {
+            perror("reading inotify events");
+            exit(1);
+        }
+        return (errno == EINTR ? -1 : 0);
+    }
+
+    for(cp=buf; cp < buf + len; cp += sizeof(struct inotify_event) + ev->len) {
+        ev = (const struct inotify_event*)cp;
+        if(ev->mask & IN_Q_OVERFLOW) {
+            *overflow = 1;
+            continue;
+        }
+        if(ev->wd < 0 || ev->wd >= watch_max || !watches[ev->wd].path) {
+            continue;
+        }
+        w = &watches[ev->wd];
+        if(ev->mask & IN_IGNORED) {
+            // the kernel dropped the watch, probably because its file
+            // or dir was deleted.  A replaced file is watched again later.
+            if(!w->replaced) {
+                free(w->path);
+                w->path = NULL;
+            }
+            continue;
+        }
+        if(w->file) {
+            if(ev->mask & (IN_MOVE_SELF|IN_DELETE_SELF)) {
+                w->replaced = 1;
+            }
+            name = "";
+        } else {
+            // a new file is reported when it's closed, but a new dir
+            // needs to be watched right away.
+            if(ev->len == 0 || ((ev->mask & IN_CREATE) && !(ev->mask & IN_ISDIR))) {
+                continue;
+            }
+            name = ev->name;
+        }
+        if(add_path(paths, count, w->path, name) < 0) {
+            perror("allocating changes");
+            exit(1);
+        }
+    }
+
+    return 0;
+}
+
+
+/** Waits until something in the watched dirs or files changes.
+ *
+ *  @returns the absolute paths of the files and new dirs that changed in a
+ *  NULL-terminated array.  Free it with watch_free().  If inotify
+ *  dropped events, *overflow is set and the caller can't know
+ *  everything that changed.  If a signal interrupts the wait, the
+ *  changes found so far are returned, which may be none at all.
+ */
+
+char** watch_changes(int *overflow)
+{
+    struct pollfd pfd;
+    char **paths = NULL;
+    int count = 0;
+    int ret;
+
+    *overflow = 0;
+    pfd.fd = watch_fd;
+    pfd.events = POLLIN;
+
+    // block for the first event, then wait for things to settle down.
+    while(!count && !*overflow) {
+        if(read_events(&paths, &count, overflow) < 0) {
+            return paths;
+        }
+    }
+    for(;;) {
+        ret = poll(&pfd, 1, WATCH_DEBOUNCE);
+        if(ret <= 0 || read_events(&paths, &count, overflow) < 0) {
+            break;
+        }
+    }
+    rewatch_files();
+
+    return paths;
+}
+
+
+void watch_free(char **paths)
+{
+    int i;
+
+    for(i=0; paths && paths[i]; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
@@ -0,0 +1,13 @@
+/* watch.h
+ * 18 Oct 2026
+ *
+ * Waits for files to change.  See watch.c.
+ * This file is covered by the MIT License.
+ */
+
+
+int watch_init();
+void watch_dir(const char *dir);
+void watch_file(const char *path);
+char** watch_changes(int *overflow);
+void watch_free(char **paths);